@@ -3,16 +3,28 @@
 //
 
 #include "AIHPCApplication.h"
+#include <algorithm>
+#include <cmath>
+#include "FluidNetwork.h"
+#include "UETTransport.h"
 
 Define_Module(AIHPCApplication);
 
 AIHPCApplication::AIHPCApplication() {
     trafficTimer = nullptr;
+    incTimeoutTimer = nullptr;
     sequenceNumber = 0;
+    fluid = nullptr;
+    transport = nullptr;
+    fluidThreshold = 0;
+    incStep = 0;
+    incResultsVerified = 0;
+    incResultMismatches = 0;
 }
 
 AIHPCApplication::~AIHPCApplication() {
     cancelAndDelete(trafficTimer);
+    cancelAndDelete(incTimeoutTimer);
 }
 
 void AIHPCApplication::initialize() {
@@ -28,23 +40,59 @@ void AIHPCApplication::initialize() {
     if (patternStr == "ALLREDUCE") commPattern = ALLREDUCE;
     else if (patternStr == "ALLGATHER") commPattern = ALLGATHER;
     else if (patternStr == "BROADCAST") commPattern = BROADCAST;
+    else if (patternStr == "PERMUTATION") commPattern = PERMUTATION;
     else commPattern = ALLREDUCE;
     
     messageSize = par("messageSize").intValue();
     jobSize = par("jobSize").intValue();
+    permutationShift = par("permutationShift").intValue();
     communicationIntensity = par("communicationIntensity").doubleValue();
     trafficStartTime = par("trafficStartTime").doubleValue();
     trafficRate = par("trafficRate").doubleValue();
+    incAllReduce = par("incAllReduce").boolValue();
+    incChunkSize = par("incChunkSize").intValue();
+    incStepTimeout = par("incStepTimeout").doubleValue();
+    incVerifyResults = par("incVerifyResults").boolValue();
+    
+    std::string elementStr = par("incElementType").stdstringValue();
+    incCarryData = !elementStr.empty();
+    if (elementStr.empty() || elementStr == "fp32") incElementType = ELEMENT_FP32;
+    else if (elementStr == "fp16") incElementType = ELEMENT_FP16;
+    else if (elementStr == "bf16") incElementType = ELEMENT_BF16;
+    else if (elementStr == "int32") incElementType = ELEMENT_INT32;
+    else throw cRuntimeError("Unknown incElementType '%s' (expected \"\", fp32, fp16, bf16 or int32)", elementStr.c_str());
+    
+    std::string opStr = par("incReductionOp").stdstringValue();
+    if (opStr == "sum") incReductionOp = REDUCE_SUM;
+    else if (opStr == "max") incReductionOp = REDUCE_MAX;
+    else if (opStr == "min") incReductionOp = REDUCE_MIN;
+    else if (opStr == "prod") incReductionOp = REDUCE_PROD;
+    else throw cRuntimeError("Unknown incReductionOp '%s' (expected sum, max, min or prod)", opStr.c_str());
     
     // Initialize statistics
     messagesSent = registerSignal("messagesSent");
     messagesReceived = registerSignal("messagesReceived");
     throughput = registerSignal("throughput");
     latency = registerSignal("latency");
+    messageCompletionTime = registerSignal("messageCompletionTime");
+    reductionError = registerSignal("reductionError");
+    incStepsTimedOut = registerSignal("incStepsTimedOut");
+    
+    // Hybrid mode: large messages bypass the transport as fluid flows
+    cModule *network = getSimulation()->getSystemModule();
+    fluid = network ? dynamic_cast<FluidNetwork*>(network->getSubmodule("fluid")) : nullptr;
+    if (fluid && !fluid->isEnabled()) {
+        fluid = nullptr;
+    }
+    if (fluid) {
+        fluidThreshold = fluid->getElephantThreshold();
+        transport = check_and_cast<UETTransport*>(gate("transportOut")->getPathEndGate()->getOwnerModule());
+    }
     
     // Initialize traffic timer
     trafficTimer = new cMessage("trafficTimer");
     scheduleAt(trafficStartTime, trafficTimer);
+    incTimeoutTimer = new cMessage("incTimeoutTimer");
 }
 
 void AIHPCApplication::handleMessage(cMessage *msg) {
@@ -53,10 +101,16 @@ void AIHPCApplication::handleMessage(cMessage *msg) {
             generateTraffic();
             // Schedule next traffic generation
             scheduleAt(simTime() + 0.1, trafficTimer);
+        } else if (msg == incTimeoutTimer) {
+            expireIncSteps();
         }
     } else {
         UETPacket *pkt = check_and_cast<UETPacket*>(msg);
-        processReceivedMessage(pkt);
+        if (INCPacket *incPkt = dynamic_cast<INCPacket*>(pkt)) {
+            processIncResult(incPkt);
+        } else {
+            processReceivedMessage(pkt);
+        }
         delete pkt;
     }
 }
@@ -78,6 +132,13 @@ void AIHPCApplication::generateTraffic() {
 }
 
 void AIHPCApplication::generateAITrainingWorkload() {
+    // In-network reduction needs every participant in every step, so the
+    // step is not left to chance
+    if (incAllReduce && commPattern == ALLREDUCE) {
+        initiateIncAllReduce();
+        return;
+    }
+    
     // AI Training: periodic AllReduce operations
     if (uniform(0, 1) < communicationIntensity) {
         switch (commPattern) {
@@ -90,6 +151,9 @@ void AIHPCApplication::generateAITrainingWorkload() {
             case BROADCAST:
                 initiateBroadcast();
                 break;
+            case PERMUTATION:
+                initiatePermutation();
+                break;
             default:
                 initiateAllReduce();
         }
@@ -126,6 +190,14 @@ void AIHPCApplication::sendMessage(int dest, int size, const char* type) {
     pkt->setSequenceNum(sequenceNumber++);
     pkt->setTimestamp(simTime().raw());
     
+    if (fluid && size >= fluidThreshold) {
+        // One flowId per destination, so fluid flows spread over ECMP like packet flows
+        fluid->startFlow(pkt->getSrcAddr(), dest, size, transport->getFlowId(dest), type);
+        delete pkt;
+        emit(messagesSent, 1);
+        return;
+    }
+    
     sentTimes[pkt->getSequenceNum()] = simTime();
     
     send(pkt, "transportOut");
@@ -143,6 +215,9 @@ void AIHPCApplication::processReceivedMessage(UETPacket* pkt) {
         sentTimes.erase(it);
     }
     
+    // From the sender's timestamp, so packet and fluid mode compare directly
+    emit(messageCompletionTime, simTime() - SimTime::fromRaw(pkt->getTimestamp()));
+    
     // Calculate throughput
     double currentThroughput = (double)pkt->getByteLength() * 8.0 / SIMTIME_DBL(simTime());
     emit(throughput, currentThroughput);
@@ -157,6 +232,167 @@ void AIHPCApplication::initiateAllReduce() {
     }
 }
 
+void AIHPCApplication::initiateIncAllReduce() {
+    // Every participant sends its chunks towards the root, host 0. The
+    // switch the root hangs off sums them and returns one result per chunk;
+    // the shared flowId keeps all contributions on the same rails
+    int self = getParentModule()->isVector() ? getParentModule()->getIndex() : 0;
+    uint32_t step = incStep++;
+    if (self >= jobSize) {
+        return;
+    }
+    
+    int chunks = (messageSize + incChunkSize - 1) / incChunkSize;
+    incPending[step] = std::make_pair(simTime(), chunks);
+    incDeadlines.push_back(std::make_pair(simTime() + incStepTimeout, step));
+    if (!incTimeoutTimer->isScheduled()) {
+        scheduleAt(incDeadlines.front().first, incTimeoutTimer);
+    }
+    for (int c = 0; c < chunks; c++) {
+        INCPacket *pkt = new INCPacket("INC_ALLREDUCE");
+        pkt->setByteLength(std::min(incChunkSize, messageSize - c * incChunkSize));
+        pkt->setDestAddr(0);
+        pkt->setFlowId(0x80000000u | step);
+        pkt->setOperationTag(step);
+        pkt->setChunk(c);
+        pkt->setCollectiveType(0);      // ALLREDUCE
+        pkt->setReductionOp(incReductionOp);
+        pkt->setParticipantCount(jobSize);
+        pkt->setTimestamp(simTime().raw());
+        if (incCarryData) {
+            TensorPayload& tensor = pkt->getTensorForUpdate();
+            tensor.allocate(incElementType, pkt->getByteLength() / getElementSize(incElementType));
+            for (size_t i = 0; i < tensor.getCount(); i++) {
+                tensor.set(i, getIncElement(step, c, self, i));
+            }
+        }
+        send(pkt, "transportOut");
+    }
+    emit(messagesSent, 1);
+}
+
+void AIHPCApplication::processIncResult(INCPacket* pkt) {
+    // Contributions only reach an application when no switch reduced them
+    auto it = incPending.find(pkt->getOperationTag());
+    if (pkt->getContributions() < pkt->getParticipantCount() || it == incPending.end()) {
+        return;
+    }
+    if (incVerifyResults && !pkt->getTensor().isEmpty()) {
+        verifyIncResult(pkt);
+    }
+    if (--it->second.second == 0) {
+        emit(messagesReceived, 1);
+        emit(messageCompletionTime, simTime() - it->second.first);
+        incPending.erase(it);
+    }
+}
+
+void AIHPCApplication::expireIncSteps() {
+    // Contributions and results bypass the transport, so a chunk lost on
+    // the way or expired in the switch never comes back. Such a step is
+    // counted and given up; messageCompletionTime only covers the others.
+    simtime_t now = simTime();
+    while (!incDeadlines.empty() && incDeadlines.front().first <= now) {
+        auto it = incPending.find(incDeadlines.front().second);
+        incDeadlines.pop_front();
+        if (it != incPending.end()) {
+            emit(incStepsTimedOut, it->second.second);
+            incPending.erase(it);
+        }
+    }
+    if (!incDeadlines.empty()) {
+        scheduleAt(incDeadlines.front().first, incTimeoutTimer);
+    }
+}
+
+double AIHPCApplication::getIncElement(uint32_t step, uint32_t chunk, int src, size_t i) {
+    // Any host can recompute any other's contribution. Products stay near 1
+    // so that they neither overflow nor underflow the 16-bit types.
+    uint64_t x = ((uint64_t)step << 40 ^ (uint64_t)chunk << 20 ^ (uint64_t)src) * 0x9e3779b97f4a7c15ULL + i;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    if (incElementType == ELEMENT_INT32) {
+        return (int32_t)(uint32_t)x;
+    }
+    double u = (x >> 11) * (1.0 / (1ULL << 53));
+    return incReductionOp == REDUCE_PROD ? 0.9 + 0.2 * u : 2 * u - 1;
+}
+
+void AIHPCApplication::verifyIncResult(INCPacket* pkt) {
+    // Reference reduction of every participant's contribution, in double or
+    // wrapping 32-bit integers. Floating point SUM and PROD round once per
+    // contribution in the switch, in arrival order, so they are held to the
+    // worst-case bound gamma(n - 1) = (n - 1)u / (1 - (n - 1)u), which says
+    // nothing once (n - 1)u reaches 1, as for bf16 beyond 256 participants.
+    const TensorPayload& result = pkt->getTensor();
+    int n = pkt->getParticipantCount();
+    double unitRoundoff = incElementType == ELEMENT_FP16 ? std::ldexp(1.0, -11) :
+            incElementType == ELEMENT_BF16 ? std::ldexp(1.0, -8) : std::ldexp(1.0, -24);
+    double steps = (n - 1) * unitRoundoff;
+    double gamma = steps < 1 ? steps / (1 - steps) : INFINITY;
+    bool exact = incElementType == ELEMENT_INT32 || incReductionOp == REDUCE_MAX || incReductionOp == REDUCE_MIN;
+    
+    // Contributions as they went on the wire, rounded to the element type
+    TensorPayload rounded;
+    rounded.allocate(incElementType, 1);
+    
+    double worstError = 0;
+    bool mismatch = result.getCount() != (size_t)pkt->getByteLength() / getElementSize(incElementType);
+    for (size_t i = 0; i < result.getCount() && !mismatch; i++) {
+        double reference = 0;
+        double magnitude = 0;
+        uint32_t wrapped = 0;
+        for (int src = 0; src < n; src++) {
+            rounded.set(0, getIncElement(pkt->getOperationTag(), pkt->getChunk(), src, i));
+            double x = rounded.get(0);
+            if (src == 0) {
+                reference = x;
+                magnitude = std::abs(x);
+                wrapped = (uint32_t)(int32_t)x;
+                continue;
+            }
+            switch (incReductionOp) {
+                case REDUCE_SUM:
+                    reference += x;
+                    magnitude += std::abs(x);
+                    wrapped += (uint32_t)(int32_t)x;
+                    break;
+                case REDUCE_MAX:
+                    reference = std::max(reference, x);
+                    break;
+                case REDUCE_MIN:
+                    reference = std::min(reference, x);
+                    break;
+                case REDUCE_PROD:
+                    reference *= x;
+                    wrapped *= (uint32_t)(int32_t)x;
+                    break;
+            }
+        }
+        if (incElementType == ELEMENT_INT32 && (incReductionOp == REDUCE_SUM || incReductionOp == REDUCE_PROD)) {
+            reference = (int32_t)wrapped;
+        }
+        
+        double error = std::abs(result.get(i) - reference);
+        if (exact) {
+            mismatch = error != 0;
+        } else {
+            double scale = incReductionOp == REDUCE_SUM ? magnitude : std::abs(reference);
+            mismatch = error > gamma * scale;
+            worstError = std::max(worstError, scale > 0 ? error / scale : error);
+        }
+    }
+    
+    incResultsVerified++;
+    emit(reductionError, worstError);
+    if (mismatch) {
+        incResultMismatches++;
+        EV_WARN << "INC result of step " << pkt->getOperationTag() << " chunk " << pkt->getChunk()
+                << " disagrees with the host reference" << endl;
+    }
+}
+
 void AIHPCApplication::initiateAllGather() {
     // Simplified AllGather: send to all peers
     for (int i = 0; i < jobSize; i++) {
@@ -175,6 +411,21 @@ void AIHPCApplication::initiateBroadcast() {
     }
 }
 
+void AIHPCApplication::initiatePermutation() {
+    // Fixed shift permutation; shifting by a whole Dragonfly group or pod
+    // sends every node's traffic over the same few minimal paths
+    int self = getParentModule()->isVector() ? getParentModule()->getIndex() : 0;
+    int dest = (self + permutationShift) % jobSize;
+    if (dest != self) {
+        sendMessage(dest, messageSize, "PERMUTATION");
+    }
+}
+
 void AIHPCApplication::finish() {
     // Record final statistics
+    if (incAllReduce) {
+        recordScalar("incAllReducesPending", incPending.size());
+        recordScalar("incResultsVerified", incResultsVerified);
+        recordScalar("incResultMismatches", incResultMismatches);
+    }
 }
\ No newline at end of file
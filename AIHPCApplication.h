@@ -6,8 +6,12 @@
 #define __AIHPC_APPLICATION_H
 
 #include <omnetpp.h>
+#include <deque>
 #include "UltraEthernetMsg_m.h"
 
+class FluidNetwork;
+class UETTransport;
+
 using namespace omnetpp;
 
 enum WorkloadType {
@@ -22,7 +26,8 @@ enum CommunicationPattern {
     ALLGATHER,
     BROADCAST,
     POINT_TO_POINT,
-    PARAMETER_SERVER
+    PARAMETER_SERVER,
+    PERMUTATION
 };
 
 class AIHPCApplication : public cSimpleModule {
@@ -32,20 +37,43 @@ private:
     CommunicationPattern commPattern;
     int messageSize;
     int jobSize;
+    int permutationShift;
     double communicationIntensity;
     simtime_t trafficStartTime;
     double trafficRate;
+    bool incAllReduce;
+    int incChunkSize;
+    simtime_t incStepTimeout;
+    bool incCarryData;
+    ElementType incElementType;
+    ReductionOperation incReductionOp;
+    bool incVerifyResults;
     
     // Statistics
     simsignal_t messagesSent;
     simsignal_t messagesReceived;
     simsignal_t throughput;
     simsignal_t latency;
+    simsignal_t messageCompletionTime;
+    simsignal_t reductionError;
+    simsignal_t incStepsTimedOut;
     
     // Internal state
     cMessage *trafficTimer;
     int sequenceNumber;
     std::map<int, simtime_t> sentTimes;
+    FluidNetwork *fluid;        // set in hybrid mode
+    UETTransport *transport;    // in hybrid mode, for the flowId fluid flows are routed by
+    int64_t fluidThreshold;
+    
+    // In-network AllReduce: steps started, and per step its start and the
+    // chunks of the result still to come back
+    uint32_t incStep;
+    std::map<uint32_t, std::pair<simtime_t, int>> incPending;
+    std::deque<std::pair<simtime_t, uint32_t>> incDeadlines;   // by step, so in time order
+    cMessage *incTimeoutTimer;
+    long incResultsVerified;
+    long incResultMismatches;
     
     // Workload generation
     void generateTraffic();
@@ -61,6 +89,12 @@ private:
     void initiateAllReduce();
     void initiateAllGather();
     void initiateBroadcast();
+    void initiatePermutation();
+    void initiateIncAllReduce();
+    void processIncResult(INCPacket* pkt);
+    void expireIncSteps();
+    double getIncElement(uint32_t step, uint32_t chunk, int src, size_t i);
+    void verifyIncResult(INCPacket* pkt);
     
 public:
     AIHPCApplication();
@@ -0,0 +1,63 @@
+//
+// ChannelErrorModel.cc - Precomputed packet error probabilities per length
+//
+
+#include "ChannelErrorModel.h"
+#include <cmath>
+
+ChannelErrorModel::ChannelErrorModel() {
+    codewordFailure = 0;
+    codewordErrors = 0;
+    fecEnabled = false;
+}
+
+void ChannelErrorModel::build(double bitErrorRate, int correctableSymbols, bool fec, int64_t maxBits) {
+    fecEnabled = fec;
+    bins.clear();
+    codewordFailure = 0;
+    codewordErrors = 0;
+    
+    if (bitErrorRate > 0 && !fecEnabled) {
+        // Any flipped data bit in the bin loses the packet
+        codewordFailure = -std::expm1(CODEWORD_DATA_BITS * std::log1p(-bitErrorRate));
+        codewordErrors = codewordFailure;
+    } else if (bitErrorRate > 0) {
+        // Binomial tail of symbol errors beyond what the decoder corrects,
+        // summed in log space; the terms underflow harmlessly to zero
+        double symbolError = -std::expm1(SYMBOL_BITS * std::log1p(-bitErrorRate));
+        double logHit = std::log(symbolError);
+        double logMiss = std::log1p(-symbolError);
+        int n = CODEWORD_SYMBOLS;
+        for (int k = correctableSymbols + 1; k <= n; k++) {
+            double logTerm = std::lgamma(n + 1.0) - std::lgamma(k + 1.0) - std::lgamma(n - k + 1.0)
+                    + k * logHit + (n - k) * logMiss;
+            codewordFailure += std::exp(logTerm);
+        }
+        codewordErrors = -std::expm1(n * logMiss);
+    }
+    
+    int count = codewords(maxBits);
+    bins.reserve(count);
+    while ((int)bins.size() < count) {
+        addBin();
+    }
+}
+
+void ChannelErrorModel::addBin() {
+    double c = bins.size() + 1;
+    Bin bin;
+    bin.lost = -std::expm1(c * std::log1p(-codewordFailure));
+    bin.damaged = -std::expm1(c * std::log1p(-codewordErrors));
+    if (bin.damaged < bin.lost) {
+        bin.damaged = bin.lost;
+    }
+    bins.push_back(bin);
+}
+
+double ChannelErrorModel::getLossProbability(int64_t bits) {
+    int bin = codewords(bits) - 1;
+    while (bin >= (int)bins.size()) {
+        addBin();
+    }
+    return bins[bin].lost;
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+//
+// ChannelErrorModel.h - Precomputed packet error probabilities per length
+//
+
+#ifndef __CHANNEL_ERROR_MODEL_H
+#define __CHANNEL_ERROR_MODEL_H
+
+#include <cstdint>
+#include <vector>
+
+//
+// Packet outcomes for one bit error rate, binned by the number of FEC
+// codewords a packet spans. The code is RS(544,514) over 10-bit symbols as
+// in 800G Ethernet: a codeword carries 5140 data bits and fails when more
+// than correctableSymbols of its 544 symbols are hit. Symbol errors within
+// a codeword are binomial and codewords fail independently, so a packet of
+// c codewords is lost with probability 1 - (1 - Pcw)^c. Without FEC, any
+// bit error in the bin's data bits loses the packet.
+//
+// classify() maps one uniform draw onto the bin's cumulative thresholds.
+// Bins beyond the precomputed range are added on first use.
+//
+class ChannelErrorModel {
+public:
+    static const int SYMBOL_BITS = 10;
+    static const int CODEWORD_SYMBOLS = 544;
+    static const int DATA_SYMBOLS = 514;
+    static const int CODEWORD_DATA_BITS = DATA_SYMBOLS * SYMBOL_BITS;
+    
+    enum Outcome {
+        CLEAN,
+        CORRECTED,
+        UNCORRECTABLE
+    };
+    
+private:
+    struct Bin {
+        double lost;            // P(some codeword fails)
+        double damaged;         // P(lost or corrected)
+    };
+    
+    double codewordFailure;     // per codeword, or per bin without FEC
+    double codewordErrors;      // P(at least one symbol error)
+    bool fecEnabled;
+    std::vector<Bin> bins;      // index = codewords - 1
+    
+    void addBin();
+    
+public:
+    ChannelErrorModel();
+    
+    // Precomputes bins for packets of up to maxBits
+    void build(double bitErrorRate, int correctableSymbols, bool fecEnabled, int64_t maxBits);
+    
+    static int codewords(int64_t bits) {
+        return bits <= 0 ? 1 : (int)((bits + CODEWORD_DATA_BITS - 1) / CODEWORD_DATA_BITS);
+    }
+    
+    Outcome classify(int64_t bits, double uniform) {
+        int bin = codewords(bits) - 1;
+        while (bin >= (int)bins.size()) {
+            addBin();
+        }
+        const Bin& b = bins[bin];
+        return uniform < b.lost ? UNCORRECTABLE : uniform < b.damaged ? CORRECTED : CLEAN;
+    }
+    
+    double getLossProbability(int64_t bits);
+    double getCodewordFailure() const { return codewordFailure; }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,91 @@
+//
+// CreditFlowControl.h - Credit-based link flow control per virtual lane
+//
+
+#ifndef __CREDIT_FLOW_CONTROL_H
+#define __CREDIT_FLOW_CONTROL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "UltraEthernetMsg_m.h"
+
+//
+// Both halves of credit-based flow control (CBFC) on one link. The
+// receiver owns a buffer per virtual lane, counted in creditSize units.
+// Every frame carries the units its sender has sent on its lane so far,
+// itself included, so frames lost on the wire or discarded after a gap are
+// accounted for by the next one that arrives. The receiver advertises an
+// absolute limit per lane, units received plus free space, and the sender
+// may send while its total stays within the last limit heard. Absolute
+// values make lost or reordered advertisements harmless.
+//
+class CreditState {
+private:
+    struct Lane {
+        int64_t sent;           // sender: units sent so far
+        int64_t limit;          // sender: last limit heard
+        int64_t received;       // receiver: units the peer has sent up to the last frame seen
+        int64_t occupied;       // receiver: units held in the buffer
+    };
+    
+    std::vector<Lane> lanes;
+    int64_t bufferUnits;
+    int creditSize;
+    
+public:
+    CreditState() : bufferUnits(0), creditSize(1) {}
+    
+    // Both ends of a link must agree on the lanes and the buffer
+    void init(int numLanes, int64_t bufferBytes, int unitBytes) {
+        creditSize = std::max(unitBytes, 1);
+        bufferUnits = std::max<int64_t>(bufferBytes / creditSize, 1);
+        lanes.assign(std::max(numLanes, 1), Lane{0, bufferUnits, 0, 0});
+    }
+    
+    int getNumLanes() const { return lanes.size(); }
+    
+    // Transport ACKs and NACKs get their own lane, so they never wait
+    // behind data that ran out of credits
+    int getLane(const UETPacket *pkt) const {
+        return lanes.size() > 1 && pkt->getTransportType() != 0 ? 1 : 0;
+    }
+    
+    int64_t getUnits(const cPacket *pkt) const {
+        return std::max<int64_t>((pkt->getByteLength() + creditSize - 1) / creditSize, 1);
+    }
+    
+    // A frame larger than the whole buffer goes once the buffer is empty
+    bool canSend(int lane, int64_t units) const {
+        const Lane& l = lanes[lane];
+        return l.sent + std::min(units, bufferUnits) <= l.limit;
+    }
+    
+    // Returns the running total the frame carries
+    int64_t consume(int lane, int64_t units) {
+        return lanes[lane].sent += units;
+    }
+    
+    void updateLimit(int lane, int64_t limit) {
+        lanes[lane].limit = std::max(lanes[lane].limit, limit);
+    }
+    
+    void receive(int lane, int64_t creditsSent, int64_t units, bool buffered) {
+        Lane& l = lanes[lane];
+        l.received = std::max(l.received, creditsSent);
+        if (buffered) {
+            l.occupied += units;
+        }
+    }
+    
+    void release(int lane, int64_t units) {
+        lanes[lane].occupied -= units;
+    }
+    
+    int64_t advertise(int lane) const {
+        const Lane& l = lanes[lane];
+        return l.received + bufferUnits - l.occupied;
+    }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,138 @@
+//
+// FluidModel.cc - Max-min fair rate allocation for fluid flows
+//
+
+#include "FluidModel.h"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+FluidModel::FluidModel() {
+    numActive = 0;
+}
+
+int FluidModel::addLink(double linkCapacity) {
+    capacity.push_back(linkCapacity);
+    load.push_back(0);
+    return capacity.size() - 1;
+}
+
+int FluidModel::addFlow(const std::vector<int>& links, double bits) {
+    int id;
+    if (freeFlows.empty()) {
+        id = flows.size();
+        flows.emplace_back();
+    } else {
+        id = freeFlows.back();
+        freeFlows.pop_back();
+    }
+    Flow& flow = flows[id];
+    flow.links = links;
+    flow.remaining = bits;
+    flow.rate = 0;
+    flow.active = true;
+    numActive++;
+    return id;
+}
+
+void FluidModel::removeFlow(int id) {
+    Flow& flow = flows[id];
+    for (int link : flow.links) {
+        load[link] -= flow.rate;
+    }
+    flow.links.clear();
+    flow.rate = 0;
+    flow.active = false;
+    freeFlows.push_back(id);
+    numActive--;
+}
+
+void FluidModel::solve() {
+    int numLinks = capacity.size();
+    std::vector<double> left(capacity);
+    std::vector<int> unfixed(numLinks, 0);
+    std::vector<std::vector<int>> crossing(numLinks);
+    for (int id = 0; id < (int)flows.size(); id++) {
+        if (!flows[id].active) continue;
+        flows[id].rate = -1;
+        for (int link : flows[id].links) {
+            crossing[link].push_back(id);
+            unfixed[link]++;
+        }
+    }
+    
+    // Entries are (share, link); an entry is stale once the link's share
+    // changed after it was pushed
+    typedef std::pair<double, int> Share;
+    std::priority_queue<Share, std::vector<Share>, std::greater<Share>> shares;
+    for (int link = 0; link < numLinks; link++) {
+        if (unfixed[link] > 0) {
+            shares.push(Share(left[link] / unfixed[link], link));
+        }
+    }
+    
+    while (!shares.empty()) {
+        Share top = shares.top();
+        shares.pop();
+        int link = top.second;
+        if (unfixed[link] == 0 || top.first != left[link] / unfixed[link]) {
+            continue;
+        }
+        
+        // This link is the bottleneck of every flow still unfixed on it
+        double share = std::max(top.first, 0.0);
+        for (int id : crossing[link]) {
+            Flow& flow = flows[id];
+            if (flow.rate >= 0) continue;
+            flow.rate = share;
+            for (int other : flow.links) {
+                left[other] -= share;
+                unfixed[other]--;
+                if (other != link && unfixed[other] > 0) {
+                    shares.push(Share(left[other] / unfixed[other], other));
+                }
+            }
+        }
+    }
+    
+    std::fill(load.begin(), load.end(), 0.0);
+    for (Flow& flow : flows) {
+        if (!flow.active) continue;
+        flow.rate = std::max(flow.rate, 0.0);     // a flow without links
+        for (int link : flow.links) {
+            load[link] += flow.rate;
+        }
+    }
+}
+
+void FluidModel::advance(double seconds) {
+    if (seconds <= 0) return;
+    for (Flow& flow : flows) {
+        if (flow.active) {
+            flow.remaining = std::max(0.0, flow.remaining - flow.rate * seconds);
+        }
+    }
+}
+
+double FluidModel::nextCompletion() const {
+    double next = -1;
+    for (const Flow& flow : flows) {
+        if (flow.active && flow.rate > 0) {
+            double t = flow.remaining / flow.rate;
+            if (next < 0 || t < next) {
+                next = t;
+            }
+        }
+    }
+    return next;
+}
+
+void FluidModel::collectFinished(double slack, std::vector<int>& finished) const {
+    for (int id = 0; id < (int)flows.size(); id++) {
+        const Flow& flow = flows[id];
+        if (flow.active && flow.remaining <= flow.rate * slack + 1e-3) {
+            finished.push_back(id);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+//
+// FluidModel.h - Max-min fair rate allocation for fluid flows
+//
+
+#ifndef __FLUID_MODEL_H
+#define __FLUID_MODEL_H
+
+#include <vector>
+
+//
+// Flows modeled as rates over a set of directed links. solve() computes the
+// max-min fair allocation by progressive filling: the link with the smallest
+// fair share fixes the rate of every flow still crossing it, which lowers
+// the share left on the other links those flows use. A heap of link shares
+// with lazy invalidation makes one solve O(F * P * log L) for F flows of
+// path length P. Rates stay fixed between solves; advance() only drains
+// the remaining bits.
+//
+class FluidModel {
+public:
+    struct Flow {
+        std::vector<int> links;
+        double remaining;       // bits
+        double rate;            // bit/s, zero until the next solve
+        bool active;
+    };
+    
+private:
+    std::vector<double> capacity;   // bit/s available to fluid flows
+    std::vector<double> load;       // sum of the rates crossing each link
+    std::vector<Flow> flows;
+    std::vector<int> freeFlows;
+    int numActive;
+    
+public:
+    FluidModel();
+    
+    int addLink(double capacity);
+    int getNumLinks() const { return capacity.size(); }
+    double getLoad(int link) const { return load[link]; }
+    double getCapacity(int link) const { return capacity[link]; }
+    
+    // The new flow gets no rate until the next solve()
+    int addFlow(const std::vector<int>& links, double bits);
+    void removeFlow(int flow);
+    const Flow& getFlow(int flow) const { return flows[flow]; }
+    int getNumFlows() const { return numActive; }
+    
+    void solve();
+    
+    // Drains every flow at its current rate
+    void advance(double seconds);
+    
+    // Seconds until the first flow runs out, negative if nothing is moving
+    double nextCompletion() const;
+    
+    // Flows with at most slack seconds of data left at their rate
+    void collectFinished(double slack, std::vector<int>& finished) const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,215 @@
+//
+// FluidNetwork.cc - Flow-level model of elephant flows for hybrid runs
+//
+
+#include "FluidNetwork.h"
+#include <chrono>
+#include "RouteService.h"
+#include "UltraEthernetMsg_m.h"
+
+Define_Module(FluidNetwork);
+
+FluidNetwork::FluidNetwork() {
+    plan = nullptr;
+    hostPorts = 0;
+    radix = 0;
+    solveTimer = nullptr;
+    completionTimer = nullptr;
+    flowsCompleted = 0;
+    recomputations = 0;
+    solveWallTime = 0;
+}
+
+FluidNetwork::~FluidNetwork() {
+    cancelAndDelete(solveTimer);
+    cancelAndDelete(completionTimer);
+}
+
+void FluidNetwork::initialize() {
+    linkSpeed = par("linkSpeed").doubleValue();
+    maxUtilization = par("maxUtilization").doubleValue();
+    backgroundPacketBits = par("backgroundPacketSize").intValue() * 8.0;
+    if (maxUtilization <= 0 || maxUtilization >= 1) {
+        throw cRuntimeError("maxUtilization must be between 0 and 1");
+    }
+    if (isEnabled() && getSimulation()->getParsimNumPartitions() > 1) {
+        throw cRuntimeError("Fluid mode needs a sequential run; hosts call into it directly");
+    }
+    
+    activeFlows = registerSignal("activeFlows");
+    flowCompletionTime = registerSignal("flowCompletionTime");
+    
+    // Starts of one instant are batched into a single solve after them
+    solveTimer = new cMessage("fluidSolve");
+    solveTimer->setSchedulingPriority(1);
+    completionTimer = new cMessage("fluidCompletion");
+}
+
+void FluidNetwork::buildLinks() {
+    // Ports may ask before this module is initialized
+    plan = &check_and_cast<UltraEthernetTopology*>(getParentModule())->getPlan();
+    routeService.reset(new RouteService(*plan));
+    switchTables.resize(plan->getNumSwitches());
+    hostPorts = plan->getHostPorts();
+    radix = plan->getRadix();
+    hostLinks.assign(plan->getNumNodes() * hostPorts, -1);
+    switchLinks.assign(plan->getNumSwitches() * radix, -1);
+    
+    cModule *network = getParentModule();
+    simtime_t delays[] = {
+        network->par("hostLinkDelay").doubleValue(),
+        network->par("fabricLinkDelay").doubleValue(),
+        network->par("globalLinkDelay").doubleValue()
+    };
+    double fluidCapacity = par("linkSpeed").doubleValue() * par("maxUtilization").doubleValue();
+    
+    auto addDirection = [&](const TopologyEndpoint& from, const TopologyEndpoint& to, LinkClass linkClass) {
+        int link = model.addLink(fluidCapacity);
+        linkTargets.push_back(to);
+        linkDelays.push_back(delays[linkClass]);
+        if (from.isHost) {
+            hostLinks[from.index * hostPorts + from.port] = link;
+        } else {
+            switchLinks[from.index * radix + from.port] = link;
+        }
+    };
+    for (const TopologyLink& link : plan->getLinks()) {
+        addDirection(link.a, link.b, link.linkClass);
+        addDirection(link.b, link.a, link.linkClass);
+    }
+}
+
+int FluidNetwork::findHostLink(int host, int port) {
+    Enter_Method_Silent();
+    if (!plan) {
+        buildLinks();
+    }
+    return port < hostPorts ? hostLinks[host * hostPorts + port] : -1;
+}
+
+int FluidNetwork::findSwitchLink(int sw, int port) {
+    Enter_Method_Silent();
+    if (!plan) {
+        buildLinks();
+    }
+    return port < radix ? switchLinks[sw * radix + port] : -1;
+}
+
+bool FluidNetwork::computePath(int srcAddr, int destAddr, uint32_t flowId, std::vector<int>& path, simtime_t& delay) {
+    // The same choices as UltraEthernetIP and SwitchFabric make for a packet
+    // of this flowId without spray entropy
+    int port = hostPorts > 1 ? selectEcmpMember(flowId, 0, 0, hostPorts) : 0;
+    int link = hostLinks[srcAddr * hostPorts + port];
+    
+    // No route in the fabric is longer than a Dragonfly detour
+    for (int hops = 0; hops < 16 && link >= 0; hops++) {
+        path.push_back(link);
+        delay += linkDelays[link];
+        const TopologyEndpoint& at = linkTargets[link];
+        if (at.isHost) {
+            return at.index == destAddr;
+        }
+        
+        if (!switchTables[at.index]) {
+            switchTables[at.index] = routeService->getSwitchTable(at.index);
+        }
+        const NextHopGroup *group = switchTables[at.index]->lookup(destAddr);
+        if (!group) {
+            return false;
+        }
+        uint32_t salt = (at.index + 1) * 0x27d4eb2du;
+        int hop = group->hops[group->count > 1 ? selectEcmpMember(flowId, 0, salt, group->count) : 0];
+        link = switchLinks[at.index * radix + hop];
+    }
+    return false;
+}
+
+void FluidNetwork::startFlow(int srcAddr, int destAddr, int64_t bytes, uint32_t flowId, const char *name) {
+    Enter_Method_Silent();
+    if (!plan) {
+        buildLinks();
+    }
+    advanceTo(simTime());
+    
+    std::vector<int> path;
+    simtime_t propagation = SIMTIME_ZERO;
+    if (!computePath(srcAddr, destAddr, flowId, path, propagation)) {
+        throw cRuntimeError("No fluid route from host %d to host %d", srcAddr, destAddr);
+    }
+    
+    int flow = model.addFlow(path, bytes * 8.0);
+    if (flow >= (int)messages.size()) {
+        messages.resize(flow + 1);
+    }
+    messages[flow] = FluidMessage{name, srcAddr, destAddr, bytes, simTime(), propagation};
+    emit(activeFlows, model.getNumFlows());
+    
+    if (!solveTimer->isScheduled()) {
+        scheduleAt(simTime(), solveTimer);
+    }
+}
+
+void FluidNetwork::handleMessage(cMessage *msg) {
+    advanceTo(simTime());
+    if (msg == completionTimer) {
+        completeFlows();
+    }
+    cancelEvent(solveTimer);
+    recompute();
+}
+
+void FluidNetwork::advanceTo(simtime_t now) {
+    model.advance((now - lastUpdate).dbl());
+    lastUpdate = now;
+}
+
+void FluidNetwork::recompute() {
+    auto start = std::chrono::steady_clock::now();
+    model.solve();
+    solveWallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    recomputations++;
+    
+    cancelEvent(completionTimer);
+    double next = model.nextCompletion();
+    if (next >= 0) {
+        scheduleAt(simTime() + next, completionTimer);
+    }
+}
+
+void FluidNetwork::completeFlows() {
+    // Flows with equal rates finish together; a few picoseconds of slack
+    // absorb the rounding of the completion time to simtime resolution
+    std::vector<int> finished;
+    model.collectFinished(1e-11, finished);
+    for (int flow : finished) {
+        const FluidMessage& message = messages[flow];
+        model.removeFlow(flow);
+        
+        // The application sees the same packet a transport would deliver
+        UETPacket *pkt = new UETPacket(message.name);
+        pkt->setByteLength(message.bytes);
+        pkt->setSrcAddr(message.srcAddr);
+        pkt->setDestAddr(message.destAddr);
+        pkt->setTimestamp(message.startTime.raw());
+        cModule *app = getParentModule()->getSubmodule("hosts", message.destAddr)->getSubmodule("app");
+        sendDirect(pkt, message.propagation, SIMTIME_ZERO, app, "fluidIn");
+        
+        emit(flowCompletionTime, simTime() + message.propagation - message.startTime);
+        flowsCompleted++;
+    }
+    emit(activeFlows, model.getNumFlows());
+}
+
+FluidBackground FluidNetwork::getBackground(int link) const {
+    // Fluid flows arrive as a stream of full-size packets; a packet from
+    // the packet-level model waits as in an M/D/1 queue at their load
+    double utilization = model.getLoad(link) / linkSpeed;
+    double serviceTime = backgroundPacketBits / linkSpeed;
+    return FluidBackground{utilization, utilization * serviceTime / (2 * (1 - utilization))};
+}
+
+void FluidNetwork::finish() {
+    recordScalar("fluidFlowsCompleted", flowsCompleted);
+    recordScalar("fluidRecomputations", recomputations);
+    recordScalar("fluidSolveTime", solveWallTime, "s");
+}
\ No newline at end of file
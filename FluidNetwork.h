@@ -0,0 +1,106 @@
+//
+// FluidNetwork.h - Flow-level model of elephant flows for hybrid runs
+//
+
+#ifndef __FLUID_NETWORK_H
+#define __FLUID_NETWORK_H
+
+#include <omnetpp.h>
+#include <memory>
+#include <vector>
+#include "FluidModel.h"
+#include "ForwardingTable.h"
+#include "UltraEthernetTopology.h"
+
+using namespace omnetpp;
+
+class RouteService;
+
+// What a packet crossing one directed link sees of the fluid traffic on it
+struct FluidBackground {
+    double utilization;         // fraction of the link taken by fluid flows
+    simtime_t queueingDelay;    // mean wait behind fluid packets (M/D/1)
+};
+
+//
+// Hybrid mode for UltraEthernetCluster. Applications hand messages at or
+// above elephantThreshold to this module instead of the transport. Each
+// becomes a flow along the ECMP route its packets would take, and rates
+// follow max-min fairness over the directed links, recomputed only when
+// flows start or finish. The completed message is delivered to the
+// destination application after the path's propagation delay.
+//
+// Packet-level traffic still crossing the fabric sees fluid flows as lost
+// capacity and added queueing through getBackground(); fluid flows only
+// see packets as the headroom left by maxUtilization. All hosts call into
+// this module directly, so it needs a sequential run.
+//
+class FluidNetwork : public cSimpleModule {
+private:
+    struct FluidMessage {
+        const char *name;       // static literal from AIHPCApplication
+        int srcAddr;
+        int destAddr;
+        int64_t bytes;
+        simtime_t startTime;
+        simtime_t propagation;
+    };
+    
+    // Configuration parameters
+    double linkSpeed;
+    double maxUtilization;
+    double backgroundPacketBits;
+    
+    // Links, two per topology link, and the ECMP state to route over them
+    const TopologyPlan *plan;
+    std::unique_ptr<RouteService> routeService;
+    std::vector<std::shared_ptr<const ForwardingTable>> switchTables;
+    std::vector<int> hostLinks;     // host * hostPorts + port -> outgoing link
+    std::vector<int> switchLinks;   // switch * radix + port -> outgoing link
+    std::vector<TopologyEndpoint> linkTargets;
+    std::vector<simtime_t> linkDelays;
+    int hostPorts;
+    int radix;
+    
+    FluidModel model;
+    std::vector<FluidMessage> messages;     // indexed like the model's flows
+    simtime_t lastUpdate;
+    cMessage *solveTimer;
+    cMessage *completionTimer;
+    
+    // Statistics
+    simsignal_t activeFlows;
+    simsignal_t flowCompletionTime;
+    long flowsCompleted;
+    long recomputations;
+    double solveWallTime;
+    
+    void buildLinks();
+    bool computePath(int srcAddr, int destAddr, uint32_t flowId, std::vector<int>& path, simtime_t& delay);
+    void advanceTo(simtime_t now);
+    void recompute();
+    void completeFlows();
+    
+public:
+    FluidNetwork();
+    virtual ~FluidNetwork();
+    
+    bool isEnabled() { return par("enabled").boolValue(); }
+    int64_t getElephantThreshold() { return par("elephantThreshold").intValue(); }
+    
+    // Starts a fluid transfer of bytes from srcAddr to destAddr, on the
+    // ECMP route of the transport's packets with this flowId
+    void startFlow(int srcAddr, int destAddr, int64_t bytes, uint32_t flowId, const char *name);
+    
+    // Outgoing link of a host NIC or switch port, -1 if unconnected
+    int findHostLink(int host, int port);
+    int findSwitchLink(int sw, int port);
+    FluidBackground getBackground(int link) const;
+    
+protected:
+    virtual void initialize() override;
+    virtual void handleMessage(cMessage *msg) override;
+    virtual void finish() override;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,138 @@
+//
+// ForwardingTable.cc - Dense destination-indexed forwarding table
+//
+
+#include "ForwardingTable.h"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+ForwardingTable::ForwardingTable() {
+    defaultGroup = NO_ROUTE;
+    numEntries = 0;
+}
+
+uint16_t ForwardingTable::internGroup(const std::vector<int>& nextHops, int metric) {
+    if (nextHops.empty() || nextHops.size() > NextHopGroup::MAX_HOPS) {
+        throw std::invalid_argument("ECMP group must have 1.." + std::to_string(NextHopGroup::MAX_HOPS) + " next hops");
+    }
+
+    std::vector<int> key(nextHops);
+    key.push_back(metric);
+    auto it = groupIndex.find(key);
+    if (it != groupIndex.end()) {
+        return it->second;
+    }
+
+    if (groups.size() >= NO_ROUTE) {
+        throw std::length_error("Too many distinct ECMP groups");
+    }
+
+    NextHopGroup group = {};
+    group.count = nextHops.size();
+    group.metric = metric;
+    for (size_t i = 0; i < nextHops.size(); i++) {
+        if (nextHops[i] < 0 || nextHops[i] > 255) {
+            throw std::invalid_argument("Next hop " + std::to_string(nextHops[i]) + " is not a valid port index");
+        }
+        group.hops[i] = nextHops[i];
+    }
+
+    uint16_t id = groups.size();
+    groups.push_back(group);
+    groupIndex.emplace(std::move(key), id);
+    return id;
+}
+
+void ForwardingTable::setRoute(int dest, const std::vector<int>& nextHops, int metric) {
+    if (dest < 0) {
+        throw std::invalid_argument("Negative destination address");
+    }
+    uint16_t id = internGroup(nextHops, metric);
+    if ((unsigned)dest >= entries.size()) {
+        entries.resize(dest + 1, NO_ROUTE);
+    }
+    if (entries[dest] == NO_ROUTE) {
+        numEntries++;
+    }
+    entries[dest] = id;
+}
+
+void ForwardingTable::setDefaultRoute(const std::vector<int>& nextHops, int metric) {
+    defaultGroup = internGroup(nextHops, metric);
+}
+
+bool ForwardingTable::removeRoute(int dest) {
+    if (!hasEntry(dest)) {
+        return false;
+    }
+    entries[dest] = NO_ROUTE;
+    numEntries--;
+    return true;
+}
+
+void ForwardingTable::clear() {
+    entries.clear();
+    groups.clear();
+    groupIndex.clear();
+    defaultGroup = NO_ROUTE;
+    numEntries = 0;
+}
+
+void ForwardingTable::assign(const std::vector<int>& destGroup, const std::vector<std::vector<int>>& nextHopGroups) {
+    clear();
+
+    std::vector<uint16_t> ids;
+    ids.reserve(nextHopGroups.size());
+    for (const std::vector<int>& nextHops : nextHopGroups) {
+        ids.push_back(internGroup(nextHops, 0));
+    }
+
+    entries.assign(destGroup.size(), NO_ROUTE);
+    for (size_t d = 0; d < destGroup.size(); d++) {
+        if (destGroup[d] >= 0) {
+            entries[d] = ids[destGroup[d]];
+            numEntries++;
+        }
+    }
+}
+
+size_t ForwardingTable::contentHash() const {
+    // FNV-1a over the entries and the group records they reference
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&h](uint64_t v) {
+        h ^= v;
+        h *= 1099511628211ull;
+    };
+    mix(entries.size());
+    mix(defaultGroup);
+    for (uint16_t id : entries) {
+        mix(id);
+    }
+    for (const NextHopGroup& group : groups) {
+        mix(group.count);
+        mix(group.metric);
+        for (int i = 0; i < group.count; i++) {
+            mix(group.hops[i]);
+        }
+    }
+    return h;
+}
+
+bool ForwardingTable::operator==(const ForwardingTable& other) const {
+    if (entries != other.entries || defaultGroup != other.defaultGroup || groups.size() != other.groups.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < groups.size(); i++) {
+        const NextHopGroup& a = groups[i];
+        const NextHopGroup& b = other.groups[i];
+        if (a.count != b.count || a.metric != b.metric || memcmp(a.hops, b.hops, a.count) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t ForwardingTable::getMemoryUsage() const {
+    return sizeof(*this) + entries.capacity() * sizeof(uint16_t) + groups.capacity() * sizeof(NextHopGroup);
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+//
+// ForwardingTable.h - Dense destination-indexed forwarding table
+//
+
+#ifndef __FORWARDING_TABLE_H
+#define __FORWARDING_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+//
+// ECMP next-hop set packed into one 64-byte cache line. Groups are
+// deduplicated per table, so a fat-tree switch holds a handful of them no
+// matter how many destinations it serves.
+//
+struct alignas(64) NextHopGroup {
+    static constexpr int MAX_HOPS = 60;
+
+    uint8_t count;
+    uint8_t reserved;
+    uint16_t metric;
+    uint8_t hops[MAX_HOPS];
+};
+
+//
+// Picks one member of an ECMP group from the packet's flowId and its
+// per-packet entropy (UETPacket::sprayPath). The same pair always takes
+// the same route, which is what lets the transport score paths; salt
+// differs per switch so consecutive tiers do not choose in lockstep.
+//
+inline int selectEcmpMember(uint32_t flowId, uint16_t entropy, uint32_t salt, int count) {
+    uint32_t h = flowId * 0x9e3779b1u ^ entropy * 0x85ebca6bu ^ salt;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h % count;
+}
+
+//
+// Forwarding table indexed directly by destAddr. Each destination costs a
+// 16-bit group id, so a lookup touches one entry and one group line. Routing
+// statistics are kept elsewhere so forwarding never writes to this table.
+//
+class ForwardingTable {
+public:
+    static constexpr uint16_t NO_ROUTE = 0xffff;
+
+private:
+    std::vector<uint16_t> entries;
+    std::vector<NextHopGroup> groups;
+    std::map<std::vector<int>, uint16_t> groupIndex;  // nextHops + metric -> group
+    uint16_t defaultGroup;
+    int numEntries;
+
+    uint16_t internGroup(const std::vector<int>& nextHops, int metric);
+
+public:
+    ForwardingTable();
+
+    // Hot path: nullptr when neither an entry nor a default route exists
+    const NextHopGroup *lookup(int dest) const {
+        uint16_t id = (unsigned)dest < entries.size() ? entries[dest] : NO_ROUTE;
+        if (id == NO_ROUTE) id = defaultGroup;
+        return id == NO_ROUTE ? nullptr : &groups[id];
+    }
+
+    bool hasDefaultRoute() const { return defaultGroup != NO_ROUTE; }
+
+    bool hasEntry(int dest) const {
+        return (unsigned)dest < entries.size() && entries[dest] != NO_ROUTE;
+    }
+
+    void setRoute(int dest, const std::vector<int>& nextHops, int metric);
+    void setDefaultRoute(const std::vector<int>& nextHops, int metric);
+    bool removeRoute(int dest);
+    void clear();
+
+    // Bulk install: destGroup[d] indexes into nextHopGroups, -1 for no route
+    void assign(const std::vector<int>& destGroup, const std::vector<std::vector<int>>& nextHopGroups);
+
+    // Content identity, used to share identical tables between nodes
+    size_t contentHash() const;
+    bool operator==(const ForwardingTable& other) const;
+
+    int size() const { return numEntries; }
+    int getCapacity() const { return entries.size(); }
+    int getNumGroups() const { return groups.size(); }
+    size_t getMemoryUsage() const;
+};
+
+#endif
\ No newline at end of file
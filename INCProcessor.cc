@@ -7,16 +7,33 @@
 Define_Module(INCProcessor);
 
 INCProcessor::INCProcessor() {
-    processingTimer = nullptr;
+    expiryTimer = nullptr;
     currentBufferSize = 0;
     activeOperations = 0;
+    processedBytes = 0;
+    chunksCompleted = 0;
+    chunksExpired = 0;
+    duplicateContributions = 0;
+    contributionBytes = 0;
+    resultBytes = 0;
+    reducedBytes = 0;
+    payloadMismatches = 0;
 }
 
 INCProcessor::~INCProcessor() {
-    cancelAndDelete(processingTimer);
+    cancelAndDelete(expiryTimer);
+    for (auto& slot : slots) {
+        cancelAndDelete(slot.timer);
+        if (slot.busy) {
+            delete slot.op.packet;
+        }
+    }
     for (auto& op : operationQueue) {
         delete op.packet;
     }
+    for (auto& entry : aggregationTable) {
+        delete entry.second.accumulator;
+    }
 }
 
 void INCProcessor::initialize() {
@@ -24,22 +41,38 @@ void INCProcessor::initialize() {
     enabled = par("enabled").boolValue();
     processingLatency = par("processingLatency").doubleValue();
     maxConcurrentOperations = par("maxConcurrentOperations").intValue();
+    aluBandwidth = par("aluBandwidth").doubleValue();
     bufferSize = par("bufferSize").intValue();
+    aggregationTimeout = par("aggregationTimeout").doubleValue();
+    if (maxConcurrentOperations < 1 || aluBandwidth <= 0) {
+        throw cRuntimeError("INCProcessor needs at least one ALU slot and a positive aluBandwidth");
+    }
     
     // Initialize statistics
     operationsProcessed = registerSignal("operationsProcessed");
     operationsDropped = registerSignal("operationsDropped");
     processingLatencySignal = registerSignal("processingLatency");
     bufferUtilization = registerSignal("bufferUtilization");
+    aggregationTime = registerSignal("aggregationTime");
+    activeOperationsSignal = registerSignal("activeOperations");
     
-    // Initialize processing timer
-    processingTimer = new cMessage("processingTimer");
+    // One completion timer per ALU slot, the slot index as its kind
+    slots.resize(maxConcurrentOperations);
+    for (int i = 0; i < maxConcurrentOperations; i++) {
+        slots[i].busy = false;
+        slots[i].timer = new cMessage("aluDone", i);
+    }
+    expiryTimer = new cMessage("aggregationExpiry");
+    
+    EV_INFO << "Reduction kernels: " << getKernelIsaName(getBestKernelIsa()) << endl;
 }
 
 void INCProcessor::handleMessage(cMessage *msg) {
     if (msg->isSelfMessage()) {
-        if (msg == processingTimer) {
-            processNextOperation();
+        if (msg == expiryTimer) {
+            expireAggregations();
+        } else {
+            completeOperation(slots[msg->getKind()]);
         }
     } else {
         // Incoming packet from switch fabric
@@ -63,7 +96,7 @@ void INCProcessor::processIncomingPacket(UETPacket *pkt) {
         if (canProcessOperation(incPkt)) {
             scheduleOperation(incPkt);
         } else {
-            // Drop packet if buffer is full or too many operations
+            // Drop packet if the buffer is full
             emit(operationsDropped, 1);
             delete incPkt;
         }
@@ -74,16 +107,9 @@ void INCProcessor::processIncomingPacket(UETPacket *pkt) {
 }
 
 bool INCProcessor::canProcessOperation(INCPacket *pkt) {
-    // Check if we can accept this operation
-    if (activeOperations >= maxConcurrentOperations) {
-        return false;
-    }
-    
-    if (currentBufferSize + pkt->getByteLength() > bufferSize) {
-        return false;
-    }
-    
-    return true;
+    // Busy slots only delay an operation; the buffer has to hold it while
+    // it waits and while its slot works on it
+    return currentBufferSize + pkt->getByteLength() <= bufferSize;
 }
 
 void INCProcessor::scheduleOperation(INCPacket *pkt) {
@@ -102,52 +128,183 @@ void INCProcessor::scheduleOperation(INCPacket *pkt) {
     // Update statistics
     emit(bufferUtilization, (double)currentBufferSize / bufferSize);
     
-    // Schedule processing if not already running
-    if (!processingTimer->isScheduled() && activeOperations < maxConcurrentOperations) {
-        scheduleAt(simTime() + processingLatency, processingTimer);
-    }
+    startOperations();
 }
 
-void INCProcessor::processNextOperation() {
-    if (operationQueue.empty()) {
-        return;
+void INCProcessor::startOperations() {
+    // Free slots take waiting operations in arrival order
+    for (AluSlot& slot : slots) {
+        if (operationQueue.empty()) {
+            break;
+        }
+        if (slot.busy) {
+            continue;
+        }
+        slot.op = operationQueue.front();
+        operationQueue.pop_front();
+        slot.busy = true;
+        activeOperations++;
+        
+        simtime_t serviceTime = processingLatency + slot.op.packet->getBitLength() / aluBandwidth;
+        scheduleAt(simTime() + serviceTime, slot.timer);
     }
-    
-    // Get next operation
-    INCOperation op = operationQueue.front();
-    operationQueue.pop_front();
-    
-    activeOperations++;
+    emit(activeOperationsSignal, activeOperations);
+}
+
+void INCProcessor::completeOperation(AluSlot& slot) {
+    INCOperation op = slot.op;
+    slot.busy = false;
+    slot.op.packet = nullptr;
+    activeOperations--;
     currentBufferSize -= op.packet->getByteLength();
+    processedBytes += op.packet->getByteLength();
     
-    // Process the operation based on type
-    INCPacket *result = processCollectiveOperation(op);
+    // Waiting for a slot included
+    emit(processingLatencySignal, simTime() - op.startTime);
     
-    if (result) {
-        // Send result back to fabric
-        send(result, "fabricOut");
-        
-        // Record statistics
-        simtime_t latency = simTime() - op.startTime;
-        emit(processingLatencySignal, latency);
-        emit(operationsProcessed, 1);
+    // AllReduce contributions are reduced in the aggregation table, which
+    // counts each chunk once; the other collectives still answer each
+    // packet on its own
+    if (op.collectiveType == ALLREDUCE && op.participantCount > 1) {
+        aggregate(op.packet);
     } else {
-        // Operation failed
-        emit(operationsDropped, 1);
+        INCPacket *result = processCollectiveOperation(op);
+        if (result) {
+            // Send result back to fabric
+            send(result, "fabricOut");
+            emit(operationsProcessed, 1);
+        } else {
+            // Operation failed
+            emit(operationsDropped, 1);
+        }
+        delete op.packet;
     }
     
-    activeOperations--;
-    
     // Update buffer utilization
     emit(bufferUtilization, (double)currentBufferSize / bufferSize);
     
-    // Schedule next operation if available
-    if (!operationQueue.empty() && activeOperations < maxConcurrentOperations) {
-        scheduleAt(simTime() + processingLatency, processingTimer);
+    startOperations();
+}
+
+void INCProcessor::aggregate(INCPacket *pkt) {
+    AggregationKey key = {pkt->getJobId(), pkt->getOperationTag(), pkt->getChunk()};
+    contributionBytes += pkt->getByteLength();
+    
+    auto it = aggregationTable.find(key);
+    if (it == aggregationTable.end()) {
+        // The first contribution keeps the buffer it was admitted with
+        // until the last arrives
+        AggregationEntry& entry = aggregationTable[key];
+        entry.accumulator = pkt;
+        entry.participants.assign(pkt->getParticipantCount() / 64 + 1, 0);
+        entry.participantHosts = 0;
+        addParticipant(entry, pkt->getSrcAddr());
+        entry.contributions = pkt->getContributions();
+        entry.bytesIn = pkt->getByteLength();
+        entry.firstArrival = simTime();
+        currentBufferSize += pkt->getByteLength();
+        
+        aggregationDeadlines.push_back(std::make_pair(simTime() + aggregationTimeout, key));
+        if (!expiryTimer->isScheduled()) {
+            scheduleAt(aggregationDeadlines.front().first, expiryTimer);
+        }
+    } else {
+        // A retransmitted contribution must not count twice
+        AggregationEntry& entry = it->second;
+        uint32_t src = pkt->getSrcAddr();
+        if (src / 64 < entry.participants.size() && (entry.participants[src / 64] >> (src % 64) & 1)) {
+            duplicateContributions++;
+            delete pkt;
+            return;
+        }
+        
+        // Data-carrying contributions are reduced element by element; all
+        // of a chunk's must agree in operation, type and length
+        const TensorPayload& in = pkt->getTensor();
+        TensorPayload& acc = entry.accumulator->getTensorForUpdate();
+        bool agree = pkt->getReductionOp() == entry.accumulator->getReductionOp() && pkt->getReductionOp() <= REDUCE_PROD &&
+                in.isEmpty() == acc.isEmpty() && in.getType() == acc.getType() && in.getCount() == acc.getCount();
+        if (!agree) {
+            payloadMismatches++;
+            emit(operationsDropped, 1);
+            delete pkt;
+            return;
+        }
+        if (!in.isEmpty()) {
+            reduceElements(in.getType(), (ReductionOperation)entry.accumulator->getReductionOp(),
+                    acc.getDataForUpdate(), in.getData(), in.getCount());
+            reducedBytes += in.getCount() * getElementSize(in.getType());
+        }
+        addParticipant(entry, src);
+        entry.contributions += pkt->getContributions();
+        entry.bytesIn += pkt->getByteLength();
+        delete pkt;
     }
     
-    // Clean up
-    delete op.packet;
+    if (aggregationTable[key].contributions >= aggregationTable[key].accumulator->getParticipantCount()) {
+        completeAggregation(key);
+    }
+}
+
+void INCProcessor::addParticipant(AggregationEntry& entry, uint32_t srcAddr) {
+    // Sized for hosts 0..participantCount-1; a job placed elsewhere grows it
+    if (srcAddr / 64 >= entry.participants.size()) {
+        entry.participants.resize(srcAddr / 64 + 1, 0);
+    }
+    entry.participants[srcAddr / 64] |= (uint64_t)1 << (srcAddr % 64);
+    entry.participantHosts++;
+}
+
+void INCProcessor::completeAggregation(const AggregationKey& key) {
+    auto it = aggregationTable.find(key);
+    AggregationEntry& entry = it->second;
+    INCPacket *result = entry.accumulator;
+    currentBufferSize -= result->getByteLength();
+    
+    // One reduced chunk goes back to every participant; the fabric
+    // replicates it
+    result->setName("INCResult");
+    result->setSrcAddr(result->getDestAddr());
+    result->setContributions(entry.contributions);
+    result->setIsIntermediate(false);
+    int remaining = entry.participantHosts;
+    for (size_t word = 0; word < entry.participants.size(); word++) {
+        for (uint64_t bits = entry.participants[word]; bits; bits &= bits - 1) {
+            INCPacket *copy = --remaining > 0 ? result->dup() : result;
+            copy->setDestAddr(word * 64 + __builtin_ctzll(bits));
+            resultBytes += copy->getByteLength();
+            send(copy, "fabricOut");
+        }
+    }
+    
+    emit(aggregationTime, simTime() - entry.firstArrival);
+    emit(operationsProcessed, 1);
+    chunksCompleted++;
+    aggregationTable.erase(it);
+}
+
+void INCProcessor::expireAggregations() {
+    // Deadlines of completed chunks are left behind and skipped here
+    simtime_t now = simTime();
+    while (!aggregationDeadlines.empty() && aggregationDeadlines.front().first <= now) {
+        simtime_t deadline = aggregationDeadlines.front().first;
+        auto it = aggregationTable.find(aggregationDeadlines.front().second);
+        aggregationDeadlines.pop_front();
+        if (it == aggregationTable.end() || it->second.firstArrival + aggregationTimeout != deadline) {
+            continue;
+        }
+        
+        // Participants that never hear back retry the collective themselves
+        currentBufferSize -= it->second.accumulator->getByteLength();
+        delete it->second.accumulator;
+        aggregationTable.erase(it);
+        emit(operationsDropped, 1);
+        chunksExpired++;
+    }
+    if (!aggregationDeadlines.empty()) {
+        scheduleAt(aggregationDeadlines.front().first, expiryTimer);
+    }
+    emit(bufferUtilization, (double)currentBufferSize / bufferSize);
 }
 
 INCPacket* INCProcessor::processCollectiveOperation(const INCOperation& op) {
@@ -173,7 +330,7 @@ INCPacket* INCProcessor::processCollectiveOperation(const INCOperation& op) {
             result = processAllGather(op, result);
             break;
         case BROADCAST:
-            result = processBroadcast(op, result);
+            result = processBroadcast(result);
             break;
         case REDUCE_SCATTER:
             result = processReduceScatter(op, result);
@@ -187,11 +344,9 @@ INCPacket* INCProcessor::processCollectiveOperation(const INCOperation& op) {
 }
 
 INCPacket* INCProcessor::processAllReduce(const INCOperation& op, INCPacket* result) {
-    // Simplified AllReduce processing
-    // In reality, this would perform actual reduction operations
-    
-    // Simulate reduction computation delay
-    // The result size is typically the same as input for AllReduce
+    // A single contribution reduces to itself; multi-participant chunks go
+    // through the aggregation table instead
+    result->setTensor(op.packet->getTensor());
     return result;
 }
 
@@ -204,7 +359,7 @@ INCPacket* INCProcessor::processAllGather(const INCOperation& op, INCPacket* res
     return result;
 }
 
-INCPacket* INCProcessor::processBroadcast(const INCOperation& op, INCPacket* result) {
+INCPacket* INCProcessor::processBroadcast(INCPacket* result) {
     // Simplified Broadcast processing
     // Result size is same as input
     return result;
@@ -220,5 +375,14 @@ INCPacket* INCProcessor::processReduceScatter(const INCOperation& op, INCPacket*
 }
 
 void INCProcessor::finish() {
-    // Record final statistics
+    // Bytes into the aggregation table against bytes of results sent back
+    recordScalar("incChunksCompleted", chunksCompleted);
+    recordScalar("incChunksExpired", chunksExpired);
+    recordScalar("incDuplicateContributions", duplicateContributions);
+    recordScalar("incContributionBytes", contributionBytes, "B");
+    recordScalar("incResultBytes", resultBytes, "B");
+    recordScalar("incOpenChunks", aggregationTable.size());
+    recordScalar("incProcessedBytes", processedBytes, "B");
+    recordScalar("incReducedBytes", reducedBytes, "B");
+    recordScalar("incPayloadMismatches", payloadMismatches);
 }
\ No newline at end of file
@@ -7,6 +7,9 @@
 
 #include <omnetpp.h>
 #include <deque>
+#include <unordered_map>
+#include <vector>
+#include "ReductionKernels.h"
 #include "UltraEthernetMsg_m.h"
 
 using namespace omnetpp;
@@ -18,13 +21,6 @@ enum CollectiveType {
     REDUCE_SCATTER = 3
 };
 
-enum ReductionOperation {
-    SUM = 0,
-    MAX = 1,
-    MIN = 2,
-    PROD = 3
-};
-
 struct INCOperation {
     INCPacket* packet;
     simtime_t startTime;
@@ -33,37 +29,107 @@ struct INCOperation {
     ReductionOperation reductionOp;
 };
 
+// One chunk of one collective of one job
+struct AggregationKey {
+    uint64_t jobId;
+    uint32_t operationTag;
+    uint32_t chunk;
+    
+    bool operator==(const AggregationKey& other) const {
+        return jobId == other.jobId && operationTag == other.operationTag && chunk == other.chunk;
+    }
+};
+
+struct AggregationKeyHash {
+    size_t operator()(const AggregationKey& key) const {
+        uint64_t h = key.jobId * 0x9e3779b97f4a7c15ULL ^ ((uint64_t)key.operationTag << 32 | key.chunk);
+        return h ^ h >> 29;
+    }
+};
+
+// Partial reduction of one chunk; the first contribution's packet holds the
+// running result and becomes the result packet
+struct AggregationEntry {
+    INCPacket *accumulator;
+    std::vector<uint64_t> participants; // bit a: host a contributed, the result goes back to it
+    int participantHosts;
+    uint32_t contributions;
+    int64_t bytesIn;
+    simtime_t firstArrival;
+};
+
+// One ALU of the engine and the operation it is working on
+struct AluSlot {
+    INCOperation op;
+    bool busy;
+    cMessage *timer;        // fires at the operation's completion
+};
+
+//
+// Pipelined engine: maxConcurrentOperations ALU slots work in parallel, and
+// an operation holds its slot for the pipeline depth, processingLatency,
+// plus its bytes at aluBandwidth. Operations wait in arrival order for a
+// free slot. Admitted packets hold buffer from arrival until their slot
+// finishes, and the first contribution of a chunk keeps holding it as the
+// accumulator; packets that do not fit bufferSize are dropped.
+//
 class INCProcessor : public cSimpleModule {
 private:
     // Configuration parameters
     bool enabled;
     simtime_t processingLatency;
     int maxConcurrentOperations;
-    int bufferSize;
+    double aluBandwidth;
+    int64_t bufferSize;
+    simtime_t aggregationTimeout;
     
     // Statistics
     simsignal_t operationsProcessed;
     simsignal_t operationsDropped;
     simsignal_t processingLatencySignal;
     simsignal_t bufferUtilization;
+    simsignal_t aggregationTime;
+    simsignal_t activeOperationsSignal;
     
     // Internal state
-    cMessage *processingTimer;
+    std::vector<AluSlot> slots;
     std::deque<INCOperation> operationQueue;
-    int currentBufferSize;
+    int64_t currentBufferSize;
     int activeOperations;
+    int64_t processedBytes;
+    
+    // AllReduce chunks being reduced, and their deadlines in arrival order;
+    // a chunk whose contributions stop coming is given up after
+    // aggregationTimeout
+    std::unordered_map<AggregationKey, AggregationEntry, AggregationKeyHash> aggregationTable;
+    std::deque<std::pair<simtime_t, AggregationKey>> aggregationDeadlines;
+    cMessage *expiryTimer;
+    long chunksCompleted;
+    long chunksExpired;
+    long duplicateContributions;
+    int64_t contributionBytes;
+    int64_t resultBytes;
+    int64_t reducedBytes;       // payload elements run through the kernels
+    long payloadMismatches;
     
     // Processing functions
     void processIncomingPacket(UETPacket *pkt);
     bool canProcessOperation(INCPacket *pkt);
     void scheduleOperation(INCPacket *pkt);
-    void processNextOperation();
+    void startOperations();
+    void completeOperation(AluSlot& slot);
+    
+    // In-network reduction
+    void aggregate(INCPacket *pkt);
+    void addParticipant(AggregationEntry& entry, uint32_t srcAddr);
+    void completeAggregation(const AggregationKey& key);
+    void expireAggregations();
     
     // Collective operation processing
     INCPacket* processCollectiveOperation(const INCOperation& op);
     INCPacket* processAllReduce(const INCOperation& op, INCPacket* result);
     INCPacket* processAllGather(const INCOperation& op, INCPacket* result);
-    INCPacket* processBroadcast(const INCOperation& op, INCPacket* result);
+    INCPacket* processBroadcast(INCPacket* result);
     INCPacket* processReduceScatter(const INCOperation& op, INCPacket* result);
     
 public:
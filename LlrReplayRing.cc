@@ -0,0 +1,72 @@
+//
+// LlrReplayRing.cc - Link-level retry state for one link direction
+//
+
+#include "LlrReplayRing.h"
+
+static int64_t recordBytes(const PacketRecord& record) {
+    return record.image ? record.image->getByteLength() : record.byteLength;
+}
+
+LlrReplayRing::LlrReplayRing() {
+    base = 0;
+    next = 0;
+    bytes = 0;
+    capacity = 1;
+}
+
+LlrReplayRing::~LlrReplayRing() {
+    clear();
+}
+
+void LlrReplayRing::setCapacity(int64_t bytes) {
+    capacity = bytes > 0 ? bytes : 1;
+}
+
+void LlrReplayRing::grow() {
+    // Slots keep their position modulo the new size
+    std::vector<PacketRecord> larger(ring.empty() ? 16 : ring.size() * 2);
+    for (uint32_t seq = base; seq != next; seq++) {
+        larger[seq & (larger.size() - 1)] = ring[seq & (ring.size() - 1)];
+    }
+    ring.swap(larger);
+}
+
+uint32_t LlrReplayRing::push(const UETPacket *pkt, bool& copied) {
+    if (next - base >= ring.size()) {
+        grow();
+    }
+    uint32_t seq = next++;
+    copied = !ring[seq & (ring.size() - 1)].capture(pkt);
+    bytes += pkt->getByteLength();
+    return seq;
+}
+
+int LlrReplayRing::acknowledge(uint32_t cumulative) {
+    if ((int32_t)(cumulative - base) <= 0) {
+        return 0;
+    }
+    if ((int32_t)(cumulative - next) > 0) {
+        cumulative = next;
+    }
+    int released = cumulative - base;
+    for (; base != cumulative; base++) {
+        PacketRecord& record = ring[base & (ring.size() - 1)];
+        bytes -= recordBytes(record);
+        record.release();
+    }
+    return released;
+}
+
+UETPacket *LlrReplayRing::rebuild(uint32_t seq) const {
+    UETPacket *pkt = ring[seq & (ring.size() - 1)].rebuild();
+    pkt->setLlrSequence(seq);
+    return pkt;
+}
+
+void LlrReplayRing::clear() {
+    for (; base != next; base++) {
+        ring[base & (ring.size() - 1)].release();
+    }
+    bytes = 0;
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+//
+// LlrReplayRing.h - Link-level retry state for one link direction
+//
+
+#ifndef __LLR_REPLAY_RING_H
+#define __LLR_REPLAY_RING_H
+
+#include <cstdint>
+#include <vector>
+#include "PacketRecord.h"
+
+//
+// Sender half of go-back-N link-level retry. Every frame on the link gets
+// the next sequence number and a PacketRecord in a power-of-two ring, from
+// the oldest unacknowledged frame (base) to the next number to assign. A
+// cumulative ACK releases the prefix below it, and a replay walks the ring
+// from the gap. Slots grow on demand, so idle ports hold only a few; the
+// ring is full once the outstanding bytes reach its capacity, which stops
+// the transmitter.
+//
+// Sequence numbers wrap; comparisons use serial arithmetic.
+//
+class LlrReplayRing {
+private:
+    std::vector<PacketRecord> ring;
+    uint32_t base;
+    uint32_t next;
+    int64_t bytes;
+    int64_t capacity;
+    
+    void grow();
+    
+public:
+    LlrReplayRing();
+    LlrReplayRing(const LlrReplayRing&) = delete;
+    LlrReplayRing& operator=(const LlrReplayRing&) = delete;
+    ~LlrReplayRing();
+    
+    void setCapacity(int64_t bytes);
+    int64_t getCapacity() const { return capacity; }
+    int64_t getOutstandingBytes() const { return bytes; }
+    
+    uint32_t getBase() const { return base; }
+    uint32_t getNext() const { return next; }
+    int getOutstanding() const { return next - base; }
+    bool isEmpty() const { return next == base; }
+    bool isFull() const { return bytes >= capacity; }
+    bool contains(uint32_t seq) const { return (int32_t)(seq - base) >= 0 && (int32_t)(next - seq) > 0; }
+    
+    // Records pkt under the next sequence number, which is returned; copied
+    // is set if the record needed a full image
+    uint32_t push(const UETPacket *pkt, bool& copied);
+    
+    // Releases every frame below cumulative; returns how many
+    int acknowledge(uint32_t cumulative);
+    
+    // Fresh frame for a replay, with its sequence number set
+    UETPacket *rebuild(uint32_t seq) const;
+    
+    // Forgets all outstanding frames, as when the sender gives up on them
+    void clear();
+};
+
+//
+// Receiver half: accepts frames strictly in order and tracks what the next
+// cumulative ACK has to cover. After a gap, one NACK is sent until the
+// sender's replay fills it.
+//
+struct LlrReceiver {
+    enum Verdict {
+        DELIVER,
+        DUPLICATE,
+        GAP
+    };
+    
+    uint32_t expected;
+    int unacknowledged;         // frames since the last ACK
+    bool nackSent;
+    
+    LlrReceiver() : expected(0), unacknowledged(0), nackSent(false) {}
+    
+    Verdict receive(uint32_t seq, bool resync) {
+        if (seq == expected || (resync && (int32_t)(seq - expected) > 0)) {
+            expected = seq + 1;
+            nackSent = false;
+            unacknowledged++;
+            return DELIVER;
+        }
+        if ((int32_t)(seq - expected) < 0) {
+            // The ACK for it was lost or is still on its way
+            unacknowledged++;
+            return DUPLICATE;
+        }
+        return GAP;
+    }
+};
+
+#endif
\ No newline at end of file
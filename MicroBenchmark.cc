@@ -0,0 +1,318 @@
+//
+// MicroBenchmark.cc - Wall-clock benchmarks of hot-path data structures
+//
+
+#include <omnetpp.h>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "ForwardingTable.h"
+#include "PacketRecord.h"
+#include "ReductionKernels.h"
+#include "ReorderWindow.h"
+
+using namespace omnetpp;
+
+class MicroBenchmark : public cSimpleModule {
+private:
+    int numDestinations;
+    int ecmpWidth;
+    long iterations;
+    int reductionBytes;
+    long reductionRepeats;
+    
+    // Deterministic pseudo-random sequence, kept out of the timed loops
+    std::vector<int> randomSequence(int count, int range, uint32_t seed);
+    
+    template<typename F>
+    double measureNs(F body) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    }
+    
+    void benchmarkForwardingTable();
+    void benchmarkRetransmissionRecord();
+    void benchmarkReorderWindow(int depth);
+    void benchmarkReductionKernels();
+    
+protected:
+    virtual void initialize() override;
+};
+
+Define_Module(MicroBenchmark);
+
+void MicroBenchmark::initialize() {
+    numDestinations = par("numDestinations").intValue();
+    ecmpWidth = par("ecmpWidth").intValue();
+    iterations = par("iterations").intValue();
+    reductionBytes = par("reductionBytes").intValue();
+    reductionRepeats = par("reductionRepeats").intValue();
+    
+    cStringTokenizer tokenizer(par("benchmarks").stringValue());
+    while (tokenizer.hasMoreTokens()) {
+        std::string name = tokenizer.nextToken();
+        if (name == "forwardingTable") {
+            benchmarkForwardingTable();
+        } else if (name == "retransmissionRecord") {
+            benchmarkRetransmissionRecord();
+        } else if (name == "reorderWindow") {
+            cStringTokenizer depths(par("reorderDepths").stringValue());
+            while (depths.hasMoreTokens()) {
+                benchmarkReorderWindow(atoi(depths.nextToken()));
+            }
+        } else if (name == "reductionKernels") {
+            benchmarkReductionKernels();
+        } else {
+            throw cRuntimeError("Unknown benchmark '%s'", name.c_str());
+        }
+    }
+}
+
+std::vector<int> MicroBenchmark::randomSequence(int count, int range, uint32_t seed) {
+    std::vector<int> values(count);
+    uint32_t x = seed;
+    for (int i = 0; i < count; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        values[i] = x % range;
+    }
+    return values;
+}
+
+void MicroBenchmark::benchmarkForwardingTable() {
+    // Layout of the former UltraEthernetIP routing table
+    struct MapRoutingEntry {
+        int destAddr;
+        std::vector<int> nextHops;
+        int metric;
+        int packetsForwarded;
+        simtime_t lastUsed;
+    };
+    
+    // Edge switch view of a fat tree: a few local ports, the rest via the
+    // ECMP set of up ports
+    std::vector<int> upPorts;
+    for (int i = 0; i < ecmpWidth; i++) {
+        upPorts.push_back(ecmpWidth + i);
+    }
+    
+    std::map<int, MapRoutingEntry> mapTable;
+    ForwardingTable flatTable;
+    for (int dest = 0; dest < numDestinations; dest++) {
+        std::vector<int> nextHops = dest < ecmpWidth ? std::vector<int>{dest} : upPorts;
+        mapTable[dest] = MapRoutingEntry{dest, nextHops, 1, 0, SIMTIME_ZERO};
+        flatTable.setRoute(dest, nextHops, 1);
+    }
+    
+    const int sequenceLength = 1 << 16;
+    std::vector<int> dests = randomSequence(sequenceLength, numDestinations, 2463534242u);
+    std::vector<int> flows = randomSequence(sequenceLength, 1 << 30, 88675123u);
+    
+    long sink = 0;
+    double mapNs = measureNs([&]() {
+        for (long i = 0; i < iterations; i++) {
+            int k = i & (sequenceLength - 1);
+            auto it = mapTable.find(dests[k]);
+            if (it != mapTable.end()) {
+                MapRoutingEntry& entry = it->second;
+                sink += entry.nextHops[flows[k] % entry.nextHops.size()];
+                entry.packetsForwarded++;
+                entry.lastUsed = simTime();
+            }
+        }
+    });
+    
+    double flatNs = measureNs([&]() {
+        for (long i = 0; i < iterations; i++) {
+            int k = i & (sequenceLength - 1);
+            const NextHopGroup *group = flatTable.lookup(dests[k]);
+            if (group) {
+                sink += group->hops[flows[k] % group->count];
+            }
+        }
+    });
+    
+    // Red-black tree node overhead is about four pointers plus the payload
+    double mapBytes = mapTable.size() * (4 * sizeof(void*) + sizeof(std::pair<const int, MapRoutingEntry>));
+    for (const auto& entry : mapTable) {
+        mapBytes += entry.second.nextHops.capacity() * sizeof(int);
+    }
+    
+    EV_INFO << "forwardingTable: " << numDestinations << " destinations, ECMP width " << ecmpWidth
+            << ": std::map " << mapNs << " ns/lookup, " << mapBytes << " B; flat "
+            << flatNs << " ns/lookup, " << flatTable.getMemoryUsage() << " B (checksum " << sink << ")" << endl;
+    
+    recordScalar("mapLookupTime", mapNs, "ns");
+    recordScalar("flatLookupTime", flatNs, "ns");
+    recordScalar("mapTableBytes", mapBytes, "B");
+    recordScalar("flatTableBytes", flatTable.getMemoryUsage(), "B");
+}
+
+void MicroBenchmark::benchmarkRetransmissionRecord() {
+    // Data packet as UETTransport sees it from the application
+    UETPacket *pkt = new UETPacket("ALLREDUCE");
+    pkt->setByteLength(4096);
+    pkt->setDestAddr(17);
+    pkt->setSrcAddr(3);
+    pkt->setSequenceNum(1);
+    pkt->setFlowId(30001);
+    pkt->setTimestamp(simTime().raw());
+    pkt->setSprayPath(2);
+    
+    // Per outstanding packet: a full dup() before, a PacketRecord now
+    long sink = 0;
+    double dupNs = measureNs([&]() {
+        for (long i = 0; i < iterations; i++) {
+            UETPacket *copy = pkt->dup();
+            sink += copy->getSequenceNum();
+            delete copy;
+        }
+    });
+    
+    double recordNs = measureNs([&]() {
+        for (long i = 0; i < iterations; i++) {
+            PacketRecord record;
+            record.capture(pkt);
+            sink += record.sequenceNum;
+            record.release();
+        }
+    });
+    delete pkt;
+    
+    EV_INFO << "retransmissionRecord: dup() " << dupNs << " ns, " << sizeof(UETPacket)
+            << " B object; PacketRecord " << recordNs << " ns, " << sizeof(PacketRecord)
+            << " B, no allocation (checksum " << sink << ")" << endl;
+    
+    recordScalar("dupTime", dupNs, "ns");
+    recordScalar("recordTime", recordNs, "ns");
+    recordScalar("packetObjectBytes", sizeof(UETPacket), "B");
+    recordScalar("packetRecordBytes", sizeof(PacketRecord), "B");
+}
+
+void MicroBenchmark::benchmarkReorderWindow(int depth) {
+    // Spraying delays each packet by up to depth positions: arrival order
+    // sorts sequence numbers by seq + uniform(0, depth)
+    const int sequenceLength = 1 << 16;
+    std::vector<int> delays = randomSequence(sequenceLength, depth, 3735928559u);
+    std::vector<std::pair<int, int>> keyed(sequenceLength);
+    for (int seq = 0; seq < sequenceLength; seq++) {
+        keyed[seq] = std::make_pair(seq + delays[seq], seq);
+    }
+    std::stable_sort(keyed.begin(), keyed.end(),
+            [](const std::pair<int, int>& a, const std::pair<int, int>& b) { return a.first < b.first; });
+    std::vector<int> arrivals(sequenceLength);
+    for (int i = 0; i < sequenceLength; i++) {
+        arrivals[i] = keyed[i].second;
+    }
+    
+    // Packets are only passed around, never dereferenced
+    UETPacket *dummy = reinterpret_cast<UETPacket*>(alignof(UETPacket));
+    long sink = 0;
+    
+    // Former UETTransport receive path: tree insert, then find() per successor
+    double mapNs = measureNs([&]() {
+        std::map<int, UETPacket*> reorderBuffer;
+        int expected = 0;
+        for (long i = 0; i < iterations; i++) {
+            int seq = (int)(i / sequenceLength) * sequenceLength + arrivals[i & (sequenceLength - 1)];
+            if (seq == expected) {
+                sink++;
+                expected++;
+                auto it = reorderBuffer.find(expected);
+                while (it != reorderBuffer.end()) {
+                    sink++;
+                    reorderBuffer.erase(it);
+                    expected++;
+                    it = reorderBuffer.find(expected);
+                }
+            } else {
+                reorderBuffer[seq] = dummy;
+            }
+        }
+    });
+    
+    double windowNs = measureNs([&]() {
+        ReorderWindow window;
+        window.setCapacity(depth);
+        for (long i = 0; i < iterations; i++) {
+            int seq = (int)(i / sequenceLength) * sequenceLength + arrivals[i & (sequenceLength - 1)];
+            if (seq == window.getBase()) {
+                sink++;
+                window.advance();
+                sink += window.drain([](UETPacket *) {});
+            } else if (!window.insert(seq, dummy)) {
+                throw cRuntimeError("reorderWindow: sequence %d outside a window of %d", seq, depth);
+            }
+        }
+    });
+    
+    int outOfOrder = 0;
+    for (int i = 0; i < sequenceLength; i++) {
+        outOfOrder += arrivals[i] != i;
+    }
+    
+    EV_INFO << "reorderWindow: depth " << depth << ", " << 100.0 * outOfOrder / sequenceLength
+            << "% out of order: std::map " << mapNs << " ns/packet; ring " << windowNs
+            << " ns/packet (checksum " << sink << ")" << endl;
+    
+    std::string prefix = "reorderDepth" + std::to_string(depth);
+    recordScalar((prefix + ":mapTime").c_str(), mapNs, "ns");
+    recordScalar((prefix + ":windowTime").c_str(), windowNs, "ns");
+}
+
+void MicroBenchmark::benchmarkReductionKernels() {
+    // One INC payload reduced into an accumulator over and over, as the
+    // switch folds in contributions. Products multiply by one so the
+    // accumulator never turns subnormal, which would time the FPU's slow path.
+    static const char *opNames[] = {"sum", "max", "min", "prod"};
+    // Enough for two arrays of the smallest element
+    std::vector<int> bits = randomSequence(reductionBytes, 1 << 30, 362436069u);
+    
+    for (int t = ELEMENT_FP32; t <= ELEMENT_INT32; t++) {
+        ElementType type = (ElementType)t;
+        size_t count = reductionBytes / getElementSize(type);
+        for (int op = REDUCE_SUM; op <= REDUCE_PROD; op++) {
+            TensorPayload initial, in;
+            initial.allocate(type, count);
+            in.allocate(type, count);
+            for (size_t i = 0; i < count; i++) {
+                double u = bits[i] / (double)(1 << 29) - 1;
+                double v = bits[count + i] / (double)(1 << 29) - 1;
+                initial.set(i, type == ELEMENT_INT32 ? bits[i] : u);
+                in.set(i, op == REDUCE_PROD ? 1 : type == ELEMENT_INT32 ? bits[i] ^ 0x55555555 : v);
+            }
+            
+            // Every implementation must match the scalar one bit for bit
+            std::vector<uint8_t> expected((const uint8_t*)initial.getData(), (const uint8_t*)initial.getData() + count * getElementSize(type));
+            reduceElementsWith(KERNEL_SCALAR, type, (ReductionOperation)op, expected.data(), in.getData(), count);
+            
+            for (int isa = KERNEL_SCALAR; isa <= getBestKernelIsa(); isa++) {
+                std::vector<uint8_t> acc((const uint8_t*)initial.getData(), (const uint8_t*)initial.getData() + expected.size());
+                reduceElementsWith((KernelIsa)isa, type, (ReductionOperation)op, acc.data(), in.getData(), count);
+                if (acc != expected) {
+                    throw cRuntimeError("reductionKernels: %s %s %s differs from scalar", getKernelIsaName((KernelIsa)isa),
+                            getElementTypeName(type), opNames[op]);
+                }
+                
+                auto start = std::chrono::steady_clock::now();
+                for (long r = 0; r < reductionRepeats; r++) {
+                    reduceElementsWith((KernelIsa)isa, type, (ReductionOperation)op, acc.data(), in.getData(), count);
+                }
+                double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / reductionRepeats;
+                
+                // Payload bytes folded in per nanosecond, i.e. GB/s
+                double bandwidth = reductionBytes / ns;
+                EV_INFO << "reductionKernels: " << getElementTypeName(type) << " " << opNames[op] << " "
+                        << getKernelIsaName((KernelIsa)isa) << " " << bandwidth << " GB/s, "
+                        << ns / count << " ns/element (checksum " << (int)acc[0] << ")" << endl;
+                
+                std::string name = std::string("reduction:") + getElementTypeName(type) + ":" + opNames[op] + ":" + getKernelIsaName((KernelIsa)isa);
+                recordScalar(name.c_str(), bandwidth * 1e9, "Bps");
+            }
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+//
+// PacketRecord.cc - Compact retransmission state for UETPacket
+//
+
+#include "PacketRecord.h"
+#include <string>
+#include <typeinfo>
+#include <unordered_set>
+
+// Packet names come from a handful of literals ("ALLREDUCE", "ACK", ...);
+// set nodes never move, so the pointers stay valid for the whole run
+static const char *internName(const char *name) {
+    static std::unordered_set<std::string> names;
+    return names.insert(name ? name : "").first->c_str();
+}
+
+static bool isDescribable(const UETPacket *pkt) {
+    return typeid(*pkt) == typeid(UETPacket) &&
+            pkt->getEncapsulatedPacket() == nullptr &&
+            pkt->getControlInfo() == nullptr &&
+            pkt->getPathVectorArraySize() == 0 &&
+            pkt->getSublayerType() == 0 &&
+            !pkt->getEncrypted() &&
+            pkt->getSecuritySequence() == 0 &&
+            pkt->getReliableDelivery() &&
+            !pkt->getAckRequired() &&
+            pkt->getRemoteAddress() == 0 &&
+            pkt->getLocalAddress() == 0 &&
+            !pkt->getDeferrable();
+}
+
+bool PacketRecord::capture(const UETPacket *pkt) {
+    if (!isDescribable(pkt)) {
+        name = nullptr;
+        image = pkt->dup();
+        return false;
+    }
+    
+    name = internName(pkt->getName());
+    image = nullptr;
+    byteLength = pkt->getByteLength();
+    timestamp = pkt->getTimestamp();
+    jobId = pkt->getJobId();
+    sackBitmap = pkt->getSackBitmap();
+    messageLength = pkt->getMessageLength();
+    congestionWindow = pkt->getCongestionWindow();
+    ackDelay = pkt->getAckDelay();
+    flowId = pkt->getFlowId();
+    sequenceNum = pkt->getSequenceNum();
+    destAddr = pkt->getDestAddr();
+    srcAddr = pkt->getSrcAddr();
+    ackSequence = pkt->getAckSequence();
+    operationTag = pkt->getOperationTag();
+    messageId = pkt->getMessageId();
+    messageSegments = pkt->getMessageSegments();
+    segmentIndex = pkt->getSegmentIndex();
+    congestionHint = pkt->getCongestionHint();
+    intermediateGroup = pkt->getIntermediateGroup();
+    pathId = pkt->getPathId();
+    sprayPath = pkt->getSprayPath();
+    trainLength = pkt->getTrainLength();
+    kind = pkt->getKind();
+    transportType = pkt->getTransportType();
+    operationType = pkt->getOperationType();
+    ecnMarked = pkt->getEcnMarked();
+    ecnEcho = pkt->getEcnEcho();
+    return true;
+}
+
+UETPacket *PacketRecord::rebuild() const {
+    if (image) {
+        return image->dup();
+    }
+    
+    UETPacket *pkt = new UETPacket(name, kind);
+    pkt->setByteLength(byteLength);
+    pkt->setTimestamp(timestamp);
+    pkt->setJobId(jobId);
+    pkt->setSackBitmap(sackBitmap);
+    pkt->setMessageLength(messageLength);
+    pkt->setCongestionWindow(congestionWindow);
+    pkt->setAckDelay(ackDelay);
+    pkt->setFlowId(flowId);
+    pkt->setSequenceNum(sequenceNum);
+    pkt->setDestAddr(destAddr);
+    pkt->setSrcAddr(srcAddr);
+    pkt->setAckSequence(ackSequence);
+    pkt->setOperationTag(operationTag);
+    pkt->setMessageId(messageId);
+    pkt->setMessageSegments(messageSegments);
+    pkt->setSegmentIndex(segmentIndex);
+    pkt->setCongestionHint(congestionHint);
+    pkt->setIntermediateGroup(intermediateGroup);
+    pkt->setPathId(pathId);
+    pkt->setSprayPath(sprayPath);
+    pkt->setTrainLength(trainLength);
+    pkt->setTransportType(transportType);
+    pkt->setOperationType(operationType);
+    pkt->setEcnMarked(ecnMarked);
+    pkt->setEcnEcho(ecnEcho);
+    return pkt;
+}
+
+void PacketRecord::release() {
+    delete image;
+    image = nullptr;
+}
\ No newline at end of file
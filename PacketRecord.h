@@ -0,0 +1,62 @@
+//
+// PacketRecord.h - Compact retransmission state for UETPacket
+//
+
+#ifndef __PACKET_RECORD_H
+#define __PACKET_RECORD_H
+
+#include <omnetpp.h>
+#include "UltraEthernetMsg_m.h"
+
+using namespace omnetpp;
+
+//
+// Header fields needed to rebuild a UETPacket for retransmission. The
+// simulated payload is only a length, so a rebuilt packet is equivalent to
+// a dup() while no packet object is kept per outstanding sequence number.
+// Segments, ACKs and packets marked by switches are covered, so link-level
+// replay of fabric traffic needs no copies either.
+// Packets using fields the record does not cover (subclasses, path vectors,
+// security or RDMA addressing) keep a full image instead.
+//
+struct PacketRecord {
+    const char *name;           // interned, see PacketRecord.cc
+    UETPacket *image;           // full copy for packets the fields cannot describe
+    int64_t byteLength;
+    uint64_t timestamp;
+    uint64_t jobId;
+    uint64_t sackBitmap;
+    uint64_t messageLength;
+    double congestionWindow;
+    simtime_t ackDelay;
+    uint32_t flowId;
+    uint32_t sequenceNum;
+    uint32_t destAddr;
+    uint32_t srcAddr;
+    uint32_t ackSequence;
+    uint32_t operationTag;
+    uint32_t messageId;
+    uint32_t messageSegments;
+    uint32_t segmentIndex;
+    uint32_t congestionHint;
+    int32_t intermediateGroup;
+    uint16_t pathId;
+    uint16_t sprayPath;
+    uint16_t trainLength;
+    short kind;
+    uint8_t transportType;
+    uint8_t operationType;
+    bool ecnMarked;
+    bool ecnEcho;
+    
+    // Records pkt without copying it when the fields suffice; returns false
+    // if a full image had to be taken
+    bool capture(const UETPacket *pkt);
+    
+    // Fresh packet for one retransmission; the record stays valid
+    UETPacket *rebuild() const;
+    
+    void release();
+};
+
+#endif
\ No newline at end of file
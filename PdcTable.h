@@ -0,0 +1,147 @@
+//
+// PdcTable.h - Per-peer packet delivery context table
+//
+
+#ifndef __PDC_TABLE_H
+#define __PDC_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+//
+// Open-addressing hash map from a 64-bit context key to transport state.
+// Probing walks 16-byte slots (key + index), so a lookup touches a single
+// cache line in the common case. Contexts themselves sit densely in a pool
+// and only live ones are constructed. Linear probing with backward-shift
+// deletion keeps the table free of tombstones under steady eviction.
+//
+// References returned by find() and insert() stay valid until the next
+// insert or eviction on the same table.
+//
+template <typename T>
+class PdcTable {
+public:
+    static constexpr uint64_t EMPTY_KEY = ~0ULL;
+    
+    static uint64_t makeKey(int addr, uint32_t flowId) {
+        return (uint64_t)(uint32_t)addr << 32 | flowId;
+    }
+    
+private:
+    struct Slot {
+        uint64_t key;
+        uint32_t index;         // into pool
+    };
+    
+    std::vector<Slot> slots;    // power-of-two size
+    std::vector<T> pool;
+    std::vector<uint64_t> poolKeys;
+    size_t mask;
+    
+    static size_t hash(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return (size_t)key;
+    }
+    
+    size_t findSlot(uint64_t key) const {
+        size_t i = hash(key) & mask;
+        while (slots[i].key != key && slots[i].key != EMPTY_KEY) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+    
+    void rehash(size_t capacity) {
+        slots.assign(capacity, Slot{EMPTY_KEY, 0});
+        mask = capacity - 1;
+        for (size_t p = 0; p < poolKeys.size(); p++) {
+            slots[findSlot(poolKeys[p])] = Slot{poolKeys[p], (uint32_t)p};
+        }
+    }
+    
+    void erase(size_t p) {
+        // Close the hole by pulling back later slots of the same cluster
+        size_t hole = findSlot(poolKeys[p]);
+        size_t i = hole;
+        while (true) {
+            i = (i + 1) & mask;
+            if (slots[i].key == EMPTY_KEY) break;
+            size_t home = hash(slots[i].key) & mask;
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                slots[hole] = slots[i];
+                hole = i;
+            }
+        }
+        slots[hole].key = EMPTY_KEY;
+        
+        // Keep the pool dense by moving its last context into the gap
+        size_t last = pool.size() - 1;
+        if (p != last) {
+            pool[p] = std::move(pool[last]);
+            poolKeys[p] = poolKeys[last];
+            slots[findSlot(poolKeys[p])].index = (uint32_t)p;
+        }
+        pool.pop_back();
+        poolKeys.pop_back();
+    }
+    
+public:
+    PdcTable() {
+        rehash(16);
+    }
+    
+    T *find(uint64_t key) {
+        const Slot& slot = slots[findSlot(key)];
+        return slot.key == key ? &pool[slot.index] : nullptr;
+    }
+    
+    // The key must not be present yet
+    T& insert(uint64_t key) {
+        if ((pool.size() + 1) * 4 > slots.size() * 3) {
+            rehash(slots.size() * 2);
+        }
+        slots[findSlot(key)] = Slot{key, (uint32_t)pool.size()};
+        pool.emplace_back();
+        poolKeys.push_back(key);
+        return pool.back();
+    }
+    
+    // Removes the context under key, if present
+    void remove(uint64_t key) {
+        const Slot& slot = slots[findSlot(key)];
+        if (slot.key == key) {
+            erase(slot.index);
+        }
+    }
+    
+    // Removes every context for which evict(context) is true
+    template <typename Predicate>
+    int evictIf(Predicate evict) {
+        int evicted = 0;
+        size_t p = 0;
+        while (p < pool.size()) {
+            if (evict(pool[p])) {
+                erase(p);
+                evicted++;
+            } else {
+                p++;
+            }
+        }
+        return evicted;
+    }
+    
+    typename std::vector<T>::iterator begin() { return pool.begin(); }
+    typename std::vector<T>::iterator end() { return pool.end(); }
+    size_t size() const { return pool.size(); }
+    bool empty() const { return pool.empty(); }
+    
+    size_t getMemoryUsage() const {
+        return slots.capacity() * sizeof(Slot) + pool.capacity() * (sizeof(T) + sizeof(uint64_t));
+    }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,221 @@
+//
+// PriCompression.cc - Per-flow header compression contexts for one link direction
+//
+
+#include "PriCompression.h"
+
+// Bytes each field takes when sent
+static const int FIELD_BYTES[PRI_NUM_FIELDS] = {
+    40,     // PRI_ADDRESSES: Ethernet 14, IPv4 20, UDP ports and length 6 less the source port
+    2,      // PRI_ENTROPY
+    2,      // PRI_PDS_TYPE
+    4,      // PRI_FLOW
+    4,      // PRI_PSN
+    4,      // PRI_ACK_PSN
+    8,      // PRI_SACK
+    2,      // PRI_PATH
+    4,      // PRI_JOB
+    2,      // PRI_OPCODE
+    4,      // PRI_TAG
+    4,      // PRI_MESSAGE
+    8,      // PRI_LENGTH
+    4,      // PRI_SEGMENT
+    8,      // PRI_BUFFER
+    8       // PRI_TIMESTAMP
+};
+
+static uint64_t flowKey(const UETPacket *pkt) {
+    return (uint64_t)pkt->getSrcAddr() << 32 | pkt->getFlowId();
+}
+
+void PriHeader::capture(const UETPacket *pkt, uint32_t segment) {
+    fields[PRI_ADDRESSES] = (uint64_t)pkt->getSrcAddr() << 32 | pkt->getDestAddr();
+    fields[PRI_ENTROPY] = pkt->getSprayPath();
+    fields[PRI_PDS_TYPE] = pkt->getTransportType() | pkt->getReliableDelivery() << 8 |
+            pkt->getAckRequired() << 9 | pkt->getEcnMarked() << 10 | pkt->getEcnEcho() << 11;
+    fields[PRI_FLOW] = pkt->getFlowId();
+    fields[PRI_PSN] = pkt->getSequenceNum() + segment;
+    fields[PRI_ACK_PSN] = pkt->getAckSequence();
+    fields[PRI_SACK] = pkt->getSackBitmap();
+    fields[PRI_PATH] = pkt->getPathId();
+    fields[PRI_JOB] = pkt->getJobId();
+    fields[PRI_OPCODE] = pkt->getOperationType() | pkt->getDeferrable() << 8;
+    fields[PRI_TAG] = pkt->getOperationTag();
+    fields[PRI_MESSAGE] = pkt->getMessageId();
+    fields[PRI_LENGTH] = pkt->getMessageLength();
+    fields[PRI_SEGMENT] = pkt->getSegmentIndex() + segment;
+    fields[PRI_BUFFER] = pkt->getRemoteAddress();
+    fields[PRI_TIMESTAMP] = pkt->getTimestamp();
+}
+
+int getFullHeaderBytes() {
+    int bytes = 0;
+    for (int f = 0; f < PRI_NUM_FIELDS; f++) {
+        bytes += FIELD_BYTES[f];
+    }
+    return bytes;
+}
+
+static int getChangedBytes(const PriHeader& from, const PriHeader& to) {
+    int bytes = 0;
+    for (int f = 0; f < PRI_NUM_FIELDS; f++) {
+        if (from.fields[f] != to.fields[f]) {
+            bytes += FIELD_BYTES[f];
+        }
+    }
+    return bytes;
+}
+
+PriCompressor::PriCompressor() {
+    used = 0;
+    head = -1;
+    tail = -1;
+    refreshPackets = 0;
+}
+
+void PriCompressor::init(int numContexts, int refresh) {
+    contexts.assign(numContexts > 0 ? numContexts : 1, Context());
+    refreshPackets = refresh;
+    flush();
+}
+
+void PriCompressor::flush() {
+    index.clear();
+    used = 0;
+    head = -1;
+    tail = -1;
+}
+
+void PriCompressor::unlink(int c) {
+    Context& ctx = contexts[c];
+    if (ctx.prev >= 0) contexts[ctx.prev].next = ctx.next; else head = ctx.next;
+    if (ctx.next >= 0) contexts[ctx.next].prev = ctx.prev; else tail = ctx.prev;
+}
+
+void PriCompressor::pushFront(int c) {
+    Context& ctx = contexts[c];
+    ctx.prev = -1;
+    ctx.next = head;
+    if (head >= 0) contexts[head].prev = c; else tail = c;
+    head = c;
+}
+
+PriCompressor::Result PriCompressor::compress(const UETPacket *pkt, bool forceFull) {
+    Result result = {0, false, 0, 0, 0, false};
+    uint64_t key = flowKey(pkt);
+    
+    int c;
+    auto found = index.find(key);
+    if (found != index.end()) {
+        c = found->second;
+        unlink(c);
+    } else if (used < (int)contexts.size()) {
+        c = used++;
+        index[key] = c;
+        result.full = true;
+    } else {
+        // Reassign the least recently used context
+        c = tail;
+        unlink(c);
+        index.erase(contexts[c].key);
+        index[key] = c;
+        result.full = true;
+        result.evicted = true;
+    }
+    pushFront(c);
+    
+    Context& ctx = contexts[c];
+    if (result.full) {
+        ctx.key = key;
+        ctx.msn = 0;
+        ctx.sinceFull = 0;
+    }
+    if (forceFull || (refreshPackets > 0 && ctx.sinceFull >= refreshPackets)) {
+        result.full = true;
+    }
+    
+    PriHeader header;
+    header.capture(pkt, 0);
+    if (result.full) {
+        result.headerBytes = PRI_CONTEXT_BYTES + getFullHeaderBytes();
+        ctx.sinceFull = 0;
+    } else {
+        result.headerBytes = PRI_CONTEXT_BYTES + PRI_BITMAP_BYTES + getChangedBytes(ctx.last, header);
+    }
+    ctx.sinceFull++;
+    
+    // Later segments of a train differ from the one before only in their
+    // sequence numbers
+    int segments = pkt->getTrainLength() > 0 ? pkt->getTrainLength() : 1;
+    result.fullBytes = segments * getFullHeaderBytes();
+    if (segments > 1) {
+        PriHeader lastSegment;
+        lastSegment.capture(pkt, segments - 1);
+        int perSegment = PRI_CONTEXT_BYTES + PRI_BITMAP_BYTES + FIELD_BYTES[PRI_PSN] + FIELD_BYTES[PRI_SEGMENT];
+        result.headerBytes += (segments - 1) * perSegment;
+        ctx.last = lastSegment;
+    } else {
+        ctx.last = header;
+    }
+    
+    // The peer follows the context frame by frame
+    ctx.msn++;
+    result.context = c;
+    result.msn = ctx.msn;
+    return result;
+}
+
+PriCompressor::Result addWireHeaders(UETPacket *pkt, HeaderMode mode, PriCompressor& compressor, bool forceFull) {
+    PriCompressor::Result result = {-1, false, 0, 0, 0, false};
+    if (mode == HEADERS_PRI) {
+        result = compressor.compress(pkt, forceFull);
+    } else if (mode == HEADERS_FULL) {
+        int segments = pkt->getTrainLength() > 0 ? pkt->getTrainLength() : 1;
+        result.fullBytes = result.headerBytes = segments * getFullHeaderBytes();
+    }
+    pkt->setPriContext(result.context);
+    pkt->setPriFull(result.full);
+    pkt->setPriMsn(result.msn);
+    pkt->setPriHeaderBytes(result.headerBytes);
+    pkt->addByteLength(result.headerBytes);
+    return result;
+}
+
+void removeWireHeaders(UETPacket *pkt) {
+    pkt->addByteLength(-(int64_t)pkt->getPriHeaderBytes());
+    pkt->setPriHeaderBytes(0);
+}
+
+void PriDecompressor::init(int numContexts) {
+    slots.assign(numContexts > 0 ? numContexts : 1, Slot{0, 0, false});
+}
+
+void PriDecompressor::flush() {
+    for (Slot& slot : slots) {
+        slot.valid = false;
+    }
+}
+
+bool PriDecompressor::decompress(const UETPacket *pkt) {
+    int c = pkt->getPriContext();
+    if (c < 0) {
+        return true;
+    }
+    if (c >= (int)slots.size()) {
+        return false;
+    }
+    
+    Slot& slot = slots[c];
+    if (pkt->getPriFull()) {
+        slot = Slot{flowKey(pkt), pkt->getPriMsn(), true};
+        return true;
+    }
+    
+    // A missed frame leaves the context behind the compressor's
+    if (!slot.valid || slot.key != flowKey(pkt) || (uint8_t)(slot.msn + 1) != pkt->getPriMsn()) {
+        slot.valid = false;
+        return false;
+    }
+    slot.msn++;
+    return true;
+}
\ No newline at end of file
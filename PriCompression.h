@@ -0,0 +1,146 @@
+//
+// PriCompression.h - Per-flow header compression contexts for one link direction
+//
+
+#ifndef __PRI_COMPRESSION_H
+#define __PRI_COMPRESSION_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "UltraEthernetMsg_m.h"
+
+using namespace omnetpp;
+
+// What frames carry on the wire besides their payload
+enum HeaderMode {
+    HEADERS_NONE,       // payload only, as the transport sizes packets
+    HEADERS_FULL,       // an uncompressed header per segment
+    HEADERS_PRI         // headers compressed against per-flow contexts
+};
+
+// UET header fields over IPv4/UDP as the model counts them on the wire.
+// Lengths and checksums are recomputed from the frame and never sent.
+enum PriField {
+    PRI_ADDRESSES,      // Ethernet, IPv4 and UDP destination port
+    PRI_ENTROPY,        // UDP source port, from sprayPath
+    PRI_PDS_TYPE,       // transport type and flags
+    PRI_FLOW,
+    PRI_PSN,
+    PRI_ACK_PSN,
+    PRI_SACK,
+    PRI_PATH,
+    PRI_JOB,
+    PRI_OPCODE,
+    PRI_TAG,
+    PRI_MESSAGE,
+    PRI_LENGTH,
+    PRI_SEGMENT,
+    PRI_BUFFER,
+    PRI_TIMESTAMP,
+    PRI_NUM_FIELDS
+};
+
+// Header of one segment as field values
+struct PriHeader {
+    uint64_t fields[PRI_NUM_FIELDS];
+    
+    void capture(const UETPacket *pkt, uint32_t segment);
+};
+
+// Wire size of a segment header sent in full, without PRI
+int getFullHeaderBytes();
+
+// Context id and sequence number in front of every PRI header
+static const int PRI_CONTEXT_BYTES = 2;
+
+// Bitmap of the fields a compressed header carries
+static const int PRI_BITMAP_BYTES = (PRI_NUM_FIELDS + 7) / 8;
+
+//
+// Compressor half of PRI. Each flow, a source and its flowId, gets one of
+// a fixed number of contexts holding the last header sent; the least
+// recently used context is reassigned when they run out. A compressed
+// header carries only the fields that differ from the context, so segments
+// of one message cost their sequence numbers. The first frame of a flow in
+// a context goes in full and installs it at the peer; so does every frame
+// sent with forceFull, such as LLR replays, and every refreshPackets-th
+// frame of a context when that is set.
+//
+// A frame stands for trainLength segments; the first is compared against
+// the context and the rest against the segment before.
+//
+class PriCompressor {
+public:
+    struct Result {
+        int context;
+        bool full;
+        uint8_t msn;
+        int headerBytes;        // all segments of the frame
+        int fullBytes;          // the same segments with uncompressed headers
+        bool evicted;           // the context belonged to another flow
+    };
+    
+private:
+    struct Context {
+        uint64_t key;
+        PriHeader last;
+        uint8_t msn;
+        int sinceFull;
+        int prev;               // LRU list, most recent at head
+        int next;
+    };
+    
+    std::vector<Context> contexts;
+    std::unordered_map<uint64_t, int> index;
+    int used;
+    int head;
+    int tail;
+    int refreshPackets;
+    
+    void unlink(int c);
+    void pushFront(int c);
+    
+public:
+    PriCompressor();
+    
+    void init(int numContexts, int refreshPackets);
+    Result compress(const UETPacket *pkt, bool forceFull);
+    
+    // Forgets every context, as when the peer can no longer be trusted to
+    // hold them
+    void flush();
+};
+
+// Adds the frame's headers under mode to its length and notes them for the
+// receiver. Only HEADERS_PRI uses the compressor; the result then says
+// what it did, else context is -1.
+PriCompressor::Result addWireHeaders(UETPacket *pkt, HeaderMode mode, PriCompressor& compressor, bool forceFull);
+
+// Takes the headers off a received frame again
+void removeWireHeaders(UETPacket *pkt);
+
+//
+// Decompressor half of PRI. Full headers install their context; compressed
+// ones need the context intact and the next sequence number, or the frame
+// cannot be rebuilt and the context stays damaged until a full header.
+//
+class PriDecompressor {
+private:
+    struct Slot {
+        uint64_t key;
+        uint8_t msn;
+        bool valid;
+    };
+    
+    std::vector<Slot> slots;
+    
+public:
+    void init(int numContexts);
+    
+    // False on a context miss
+    bool decompress(const UETPacket *pkt);
+    void flush();
+};
+
+#endif
\ No newline at end of file
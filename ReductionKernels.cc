@@ -0,0 +1,492 @@
+//
+// ReductionKernels.cc - Element-wise reductions over INC tensor payloads
+//
+
+#include "ReductionKernels.h"
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define REDUCTION_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+int getElementSize(ElementType type) {
+    return type == ELEMENT_FP16 || type == ELEMENT_BF16 ? 2 : 4;
+}
+
+const char *getElementTypeName(ElementType type) {
+    switch (type) {
+        case ELEMENT_FP32: return "fp32";
+        case ELEMENT_FP16: return "fp16";
+        case ELEMENT_BF16: return "bf16";
+        case ELEMENT_INT32: return "int32";
+    }
+    return "?";
+}
+
+static uint32_t floatBits(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static float bitsFloat(uint32_t u) {
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+float fp16ToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    if (exponent == 0x1f) {
+        // Infinity, or NaN made quiet as F16C does
+        return bitsFloat(sign | 0x7f800000 | (mantissa ? 0x400000 : 0) | mantissa << 13);
+    }
+    if (exponent == 0) {
+        // Subnormal halves are normal floats
+        float magnitude = mantissa * (1.0f / (1 << 24));
+        return sign ? -magnitude : magnitude;
+    }
+    return bitsFloat(sign | (exponent + 112) << 23 | mantissa << 13);
+}
+
+uint16_t floatToFp16(float f) {
+    uint32_t u = floatBits(f);
+    uint16_t sign = (u >> 16) & 0x8000;
+    uint32_t magnitude = u & 0x7fffffff;
+    if (magnitude > 0x7f800000) {
+        // Quiet NaN with the top of the payload, as F16C converts
+        return sign | 0x7e00 | (magnitude >> 13 & 0x3ff);
+    }
+    if (magnitude >= 0x477ff000) {
+        return sign | 0x7c00;   // rounds past the largest half
+    }
+    if (magnitude < 0x38800000) {
+        // Subnormal or zero: the implicit bit joins the mantissa, which is
+        // shifted right with round to nearest even
+        if (magnitude < 0x33000000) {
+            return sign;
+        }
+        uint32_t exponent = magnitude >> 23;
+        uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+        int shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) {
+            half++;
+        }
+        return sign | half;
+    }
+    uint32_t rounded = magnitude - 0x38000000 + 0xfff + ((magnitude >> 13) & 1);
+    return sign | (rounded >> 13);
+}
+
+float bf16ToFloat(uint16_t b) {
+    return bitsFloat((uint32_t)b << 16);
+}
+
+uint16_t floatToBf16(float f) {
+    uint32_t u = floatBits(f);
+    if ((u & 0x7fffffff) > 0x7f800000) {
+        return (u >> 16) | 0x40;
+    }
+    return (u + 0x7fff + ((u >> 16) & 1)) >> 16;
+}
+
+TensorPayload::TensorPayload() {
+    type = ELEMENT_FP32;
+}
+
+void TensorPayload::allocate(ElementType elementType, size_t count) {
+    type = elementType;
+    bytes = std::make_shared<std::vector<uint8_t>>(count * getElementSize(type));
+}
+
+void *TensorPayload::getDataForUpdate() {
+    if (!bytes) {
+        return nullptr;
+    }
+    if (bytes.use_count() > 1) {
+        bytes = std::make_shared<std::vector<uint8_t>>(*bytes);
+    }
+    return bytes->data();
+}
+
+double TensorPayload::get(size_t i) const {
+    const uint8_t *element = bytes->data() + i * getElementSize(type);
+    uint16_t h;
+    switch (type) {
+        case ELEMENT_FP32: {
+            float f;
+            memcpy(&f, element, sizeof(f));
+            return f;
+        }
+        case ELEMENT_FP16:
+            memcpy(&h, element, sizeof(h));
+            return fp16ToFloat(h);
+        case ELEMENT_BF16:
+            memcpy(&h, element, sizeof(h));
+            return bf16ToFloat(h);
+        case ELEMENT_INT32: {
+            int32_t v;
+            memcpy(&v, element, sizeof(v));
+            return v;
+        }
+    }
+    return 0;
+}
+
+void TensorPayload::set(size_t i, double value) {
+    uint8_t *element = static_cast<uint8_t*>(getDataForUpdate()) + i * getElementSize(type);
+    uint16_t h;
+    switch (type) {
+        case ELEMENT_FP32: {
+            float f = (float)value;
+            memcpy(element, &f, sizeof(f));
+            break;
+        }
+        case ELEMENT_FP16:
+            h = floatToFp16((float)value);
+            memcpy(element, &h, sizeof(h));
+            break;
+        case ELEMENT_BF16:
+            h = floatToBf16((float)value);
+            memcpy(element, &h, sizeof(h));
+            break;
+        case ELEMENT_INT32: {
+            int32_t v = (int32_t)value;
+            memcpy(element, &v, sizeof(v));
+            break;
+        }
+    }
+}
+
+std::string TensorPayload::str() const {
+    if (!bytes) {
+        return "";
+    }
+    return std::string(getElementTypeName(type)) + "[" + std::to_string(getCount()) + "]";
+}
+
+//
+// Scalar kernels, also the tails of the vector ones
+//
+
+template<int OP>
+static inline float applyFloat(float a, float b) {
+    switch (OP) {
+        case REDUCE_SUM: return a + b;
+        case REDUCE_MAX: return a > b ? a : b;
+        case REDUCE_MIN: return a < b ? a : b;
+        default: return a * b;
+    }
+}
+
+template<int OP>
+static inline int32_t applyInt(int32_t a, int32_t b) {
+    switch (OP) {
+        case REDUCE_SUM: return (int32_t)((uint32_t)a + (uint32_t)b);
+        case REDUCE_MAX: return a > b ? a : b;
+        case REDUCE_MIN: return a < b ? a : b;
+        default: return (int32_t)((uint32_t)a * (uint32_t)b);
+    }
+}
+
+template<int OP>
+static void reduceFp32Scalar(float *acc, const float *in, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        acc[i] = applyFloat<OP>(acc[i], in[i]);
+    }
+}
+
+template<int OP>
+static void reduceFp16Scalar(uint16_t *acc, const uint16_t *in, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        acc[i] = floatToFp16(applyFloat<OP>(fp16ToFloat(acc[i]), fp16ToFloat(in[i])));
+    }
+}
+
+template<int OP>
+static void reduceBf16Scalar(uint16_t *acc, const uint16_t *in, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        acc[i] = floatToBf16(applyFloat<OP>(bf16ToFloat(acc[i]), bf16ToFloat(in[i])));
+    }
+}
+
+template<int OP>
+static void reduceInt32Scalar(int32_t *acc, const int32_t *in, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        acc[i] = applyInt<OP>(acc[i], in[i]);
+    }
+}
+
+#ifdef REDUCTION_X86
+
+//
+// AVX2 kernels, 8 elements per step
+//
+
+#define AVX2_TARGET __attribute__((target("avx2,f16c")))
+
+template<int OP>
+AVX2_TARGET static inline __m256 applyPs256(__m256 a, __m256 b) {
+    switch (OP) {
+        case REDUCE_SUM: return _mm256_add_ps(a, b);
+        case REDUCE_MAX: return _mm256_max_ps(a, b);
+        case REDUCE_MIN: return _mm256_min_ps(a, b);
+        default: return _mm256_mul_ps(a, b);
+    }
+}
+
+template<int OP>
+AVX2_TARGET static inline __m256i applyEpi32x256(__m256i a, __m256i b) {
+    switch (OP) {
+        case REDUCE_SUM: return _mm256_add_epi32(a, b);
+        case REDUCE_MAX: return _mm256_max_epi32(a, b);
+        case REDUCE_MIN: return _mm256_min_epi32(a, b);
+        default: return _mm256_mullo_epi32(a, b);
+    }
+}
+
+AVX2_TARGET static inline __m256 loadBf16x8(const uint16_t *p) {
+    __m256i widened = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(widened, 16));
+}
+
+AVX2_TARGET static inline void storeBf16x8(uint16_t *p, __m256 x) {
+    __m256i u = _mm256_castps_si256(x);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(u, 16), _mm256_set1_epi32(1));
+    __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(u, _mm256_set1_epi32(0x7fff)), lsb), 16);
+    __m256i quieted = _mm256_or_si256(_mm256_srli_epi32(u, 16), _mm256_set1_epi32(0x40));
+    __m256 nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+    __m256i result = _mm256_blendv_epi8(rounded, quieted, _mm256_castps_si256(nan));
+    __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+    _mm_storeu_si128((__m128i*)p, packed);
+}
+
+template<int OP>
+AVX2_TARGET static void reduceFp32Avx2(float *acc, const float *in, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(acc + i, applyPs256<OP>(_mm256_loadu_ps(acc + i), _mm256_loadu_ps(in + i)));
+    }
+    reduceFp32Scalar<OP>(acc + i, in + i, count - i);
+}
+
+template<int OP>
+AVX2_TARGET static void reduceFp16Avx2(uint16_t *acc, const uint16_t *in, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 a = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(acc + i)));
+        __m256 b = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(in + i)));
+        __m128i result = _mm256_cvtps_ph(applyPs256<OP>(a, b), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(acc + i), result);
+    }
+    reduceFp16Scalar<OP>(acc + i, in + i, count - i);
+}
+
+template<int OP>
+AVX2_TARGET static void reduceBf16Avx2(uint16_t *acc, const uint16_t *in, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        storeBf16x8(acc + i, applyPs256<OP>(loadBf16x8(acc + i), loadBf16x8(in + i)));
+    }
+    reduceBf16Scalar<OP>(acc + i, in + i, count - i);
+}
+
+template<int OP>
+AVX2_TARGET static void reduceInt32Avx2(int32_t *acc, const int32_t *in, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(acc + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(in + i));
+        _mm256_storeu_si256((__m256i*)(acc + i), applyEpi32x256<OP>(a, b));
+    }
+    reduceInt32Scalar<OP>(acc + i, in + i, count - i);
+}
+
+//
+// AVX-512 kernels, 16 elements per step
+//
+
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+// GCC 12 implements the unmasked forms of many AVX-512 intrinsics with an
+// _mm512_undefined_*() pass-through and then warns about it under
+// -Wmaybe-uninitialized (GCC bug 105593). The zero-masking forms with every
+// lane selected compile to the same instructions without that.
+static const __mmask16 ALL_LANES = 0xffff;
+
+template<int OP>
+AVX512_TARGET static inline __m512 applyPs512(__m512 a, __m512 b) {
+    switch (OP) {
+        case REDUCE_SUM: return _mm512_add_ps(a, b);
+        case REDUCE_MAX: return _mm512_maskz_max_ps(ALL_LANES, a, b);
+        case REDUCE_MIN: return _mm512_maskz_min_ps(ALL_LANES, a, b);
+        default: return _mm512_mul_ps(a, b);
+    }
+}
+
+template<int OP>
+AVX512_TARGET static inline __m512i applyEpi32x512(__m512i a, __m512i b) {
+    switch (OP) {
+        case REDUCE_SUM: return _mm512_add_epi32(a, b);
+        case REDUCE_MAX: return _mm512_maskz_max_epi32(ALL_LANES, a, b);
+        case REDUCE_MIN: return _mm512_maskz_min_epi32(ALL_LANES, a, b);
+        default: return _mm512_mullo_epi32(a, b);
+    }
+}
+
+AVX512_TARGET static inline __m512 loadFp16x16(const uint16_t *p) {
+    return _mm512_maskz_cvtph_ps(ALL_LANES, _mm256_loadu_si256((const __m256i*)p));
+}
+
+AVX512_TARGET static inline void storeFp16x16(uint16_t *p, __m512 x) {
+    _mm256_storeu_si256((__m256i*)p, _mm512_maskz_cvtps_ph(ALL_LANES, x, _MM_FROUND_TO_NEAREST_INT));
+}
+
+AVX512_TARGET static inline __m512 loadBf16x16(const uint16_t *p) {
+    __m512i widened = _mm512_maskz_cvtepu16_epi32(ALL_LANES, _mm256_loadu_si256((const __m256i*)p));
+    return _mm512_castsi512_ps(_mm512_maskz_slli_epi32(ALL_LANES, widened, 16));
+}
+
+AVX512_TARGET static inline void storeBf16x16(uint16_t *p, __m512 x) {
+    __m512i u = _mm512_castps_si512(x);
+    __m512i high = _mm512_maskz_srli_epi32(ALL_LANES, u, 16);
+    __m512i lsb = _mm512_and_si512(high, _mm512_set1_epi32(1));
+    __m512i rounded = _mm512_maskz_srli_epi32(ALL_LANES, _mm512_add_epi32(_mm512_add_epi32(u, _mm512_set1_epi32(0x7fff)), lsb), 16);
+    __m512i quieted = _mm512_or_si512(high, _mm512_set1_epi32(0x40));
+    __mmask16 nan = _mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q);
+    __m512i result = _mm512_mask_blend_epi32(nan, rounded, quieted);
+    _mm256_storeu_si256((__m256i*)p, _mm512_maskz_cvtepi32_epi16(ALL_LANES, result));
+}
+
+// The 32-bit kernels finish with a masked step; 16-bit masked loads need
+// AVX-512BW, so the 16-bit ones finish in scalar code
+template<int OP>
+AVX512_TARGET static void reduceFp32Avx512(float *acc, const float *in, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        _mm512_storeu_ps(acc + i, applyPs512<OP>(_mm512_loadu_ps(acc + i), _mm512_loadu_ps(in + i)));
+    }
+    if (i < count) {
+        __mmask16 tail = (__mmask16)((1u << (count - i)) - 1);
+        __m512 a = _mm512_maskz_loadu_ps(tail, acc + i);
+        __m512 b = _mm512_maskz_loadu_ps(tail, in + i);
+        _mm512_mask_storeu_ps(acc + i, tail, applyPs512<OP>(a, b));
+    }
+}
+
+template<int OP>
+AVX512_TARGET static void reduceFp16Avx512(uint16_t *acc, const uint16_t *in, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        storeFp16x16(acc + i, applyPs512<OP>(loadFp16x16(acc + i), loadFp16x16(in + i)));
+    }
+    reduceFp16Scalar<OP>(acc + i, in + i, count - i);
+}
+
+template<int OP>
+AVX512_TARGET static void reduceBf16Avx512(uint16_t *acc, const uint16_t *in, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        storeBf16x16(acc + i, applyPs512<OP>(loadBf16x16(acc + i), loadBf16x16(in + i)));
+    }
+    reduceBf16Scalar<OP>(acc + i, in + i, count - i);
+}
+
+template<int OP>
+AVX512_TARGET static void reduceInt32Avx512(int32_t *acc, const int32_t *in, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i a = _mm512_loadu_si512(acc + i);
+        __m512i b = _mm512_loadu_si512(in + i);
+        _mm512_storeu_si512(acc + i, applyEpi32x512<OP>(a, b));
+    }
+    if (i < count) {
+        __mmask16 tail = (__mmask16)((1u << (count - i)) - 1);
+        __m512i a = _mm512_maskz_loadu_epi32(tail, acc + i);
+        __m512i b = _mm512_maskz_loadu_epi32(tail, in + i);
+        _mm512_mask_storeu_epi32(acc + i, tail, applyEpi32x512<OP>(a, b));
+    }
+}
+
+#endif
+
+//
+// Dispatch
+//
+
+typedef void (*ReduceKernel)(void *acc, const void *in, size_t count);
+
+template<typename T, void (*F)(T*, const T*, size_t)>
+static void untyped(void *acc, const void *in, size_t count) {
+    F(static_cast<T*>(acc), static_cast<const T*>(in), count);
+}
+
+#define KERNELS_FOR_TYPE(T, NAME) \
+    { untyped<T, NAME<REDUCE_SUM>>, untyped<T, NAME<REDUCE_MAX>>, untyped<T, NAME<REDUCE_MIN>>, untyped<T, NAME<REDUCE_PROD>> }
+
+#define KERNELS_FOR_ISA(SUFFIX) { \
+    KERNELS_FOR_TYPE(float, reduceFp32##SUFFIX), \
+    KERNELS_FOR_TYPE(uint16_t, reduceFp16##SUFFIX), \
+    KERNELS_FOR_TYPE(uint16_t, reduceBf16##SUFFIX), \
+    KERNELS_FOR_TYPE(int32_t, reduceInt32##SUFFIX) }
+
+// Indexed by isa, element type and operation
+static const ReduceKernel KERNELS[][4][4] = {
+    KERNELS_FOR_ISA(Scalar),
+#ifdef REDUCTION_X86
+    KERNELS_FOR_ISA(Avx2),
+    KERNELS_FOR_ISA(Avx512),
+#endif
+};
+
+static KernelIsa detectKernelIsa() {
+#ifdef REDUCTION_X86
+    unsigned int eax, ebx, ecx, edx;
+    bool f16c = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C);
+    __builtin_cpu_init();
+    if (f16c && __builtin_cpu_supports("avx512f")) {
+        return KERNEL_AVX512;
+    }
+    if (f16c && __builtin_cpu_supports("avx2")) {
+        return KERNEL_AVX2;
+    }
+#endif
+    return KERNEL_SCALAR;
+}
+
+KernelIsa getBestKernelIsa() {
+    static const KernelIsa best = detectKernelIsa();
+    return best;
+}
+
+bool isKernelIsaSupported(KernelIsa isa) {
+    return isa <= getBestKernelIsa();
+}
+
+const char *getKernelIsaName(KernelIsa isa) {
+    switch (isa) {
+        case KERNEL_SCALAR: return "scalar";
+        case KERNEL_AVX2: return "avx2";
+        case KERNEL_AVX512: return "avx512";
+    }
+    return "?";
+}
+
+void reduceElements(ElementType type, ReductionOperation op, void *acc, const void *in, size_t count) {
+    KERNELS[getBestKernelIsa()][type][op](acc, in, count);
+}
+
+void reduceElementsWith(KernelIsa isa, ElementType type, ReductionOperation op, void *acc, const void *in, size_t count) {
+    if (!isKernelIsaSupported(isa)) {
+        throw std::invalid_argument(std::string("Reduction kernels for ") + getKernelIsaName(isa) + " do not run on this CPU");
+    }
+    KERNELS[isa][type][op](acc, in, count);
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+//
+// ReductionKernels.h - Element-wise reductions over INC tensor payloads
+//
+
+#ifndef __REDUCTION_KERNELS_H
+#define __REDUCTION_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Element-wise operation of an INC reduction; prefixed, since the header
+// reaches every module through the message definitions
+enum ReductionOperation {
+    REDUCE_SUM = 0,
+    REDUCE_MAX = 1,
+    REDUCE_MIN = 2,
+    REDUCE_PROD = 3
+};
+
+// Element types of a data-carrying INC payload
+enum ElementType {
+    ELEMENT_FP32 = 0,
+    ELEMENT_FP16 = 1,
+    ELEMENT_BF16 = 2,
+    ELEMENT_INT32 = 3
+};
+
+// Kernel implementations, from slowest to fastest
+enum KernelIsa {
+    KERNEL_SCALAR,
+    KERNEL_AVX2,        // with F16C
+    KERNEL_AVX512       // AVX-512F
+};
+
+int getElementSize(ElementType type);
+const char *getElementTypeName(ElementType type);
+
+// Round to nearest even, as the vector conversions do
+float fp16ToFloat(uint16_t h);
+uint16_t floatToFp16(float f);
+float bf16ToFloat(uint16_t b);
+uint16_t floatToBf16(float f);
+
+//
+// Elements an INCPacket carries in data-carrying mode. Copies of a packet,
+// such as multicast results and LLR replay copies, share the elements;
+// the first write gives a copy its own.
+//
+class TensorPayload {
+private:
+    std::shared_ptr<std::vector<uint8_t>> bytes;
+    ElementType type;
+    
+public:
+    TensorPayload();
+    
+    // Replaces the payload with count zero elements
+    void allocate(ElementType type, size_t count);
+    
+    bool isEmpty() const { return !bytes; }
+    ElementType getType() const { return type; }
+    size_t getCount() const { return bytes ? bytes->size() / getElementSize(type) : 0; }
+    const void *getData() const { return bytes ? bytes->data() : nullptr; }
+    void *getDataForUpdate();
+    
+    // Element i widened to double, and set with the type's rounding
+    double get(size_t i) const;
+    void set(size_t i, double value);
+    
+    std::string str() const;
+};
+
+// The fastest implementation this CPU runs
+KernelIsa getBestKernelIsa();
+bool isKernelIsaSupported(KernelIsa isa);
+const char *getKernelIsaName(KernelIsa isa);
+
+// acc[i] = acc[i] op in[i] for count elements. 16-bit floats are widened
+// to fp32, combined and rounded back, so each step rounds like hardware
+// that accumulates in the wire format. Integer SUM and PROD wrap; floating
+// point MAX and MIN keep the incoming element when either is NaN. All
+// implementations give bit-identical results, except for which payload
+// survives when two NaNs are added or multiplied.
+void reduceElements(ElementType type, ReductionOperation op, void *acc, const void *in, size_t count);
+void reduceElementsWith(KernelIsa isa, ElementType type, ReductionOperation op, void *acc, const void *in, size_t count);
+
+#endif
\ No newline at end of file
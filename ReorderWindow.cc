@@ -0,0 +1,54 @@
+//
+// ReorderWindow.cc - Fixed-capacity receive reorder window
+//
+
+#include "ReorderWindow.h"
+
+ReorderWindow::ReorderWindow() {
+    capacity = 0;
+    base = 0;
+    count = 0;
+    mask = 0;
+}
+
+void ReorderWindow::allocate() {
+    // Runs never wrap inside a bitmap word, since the ring is a multiple of 64
+    int ringSize = 64;
+    while (ringSize < capacity) {
+        ringSize *= 2;
+    }
+    slots.assign(ringSize, nullptr);
+    occupied.assign(ringSize / 64, 0);
+    mask = ringSize - 1;
+}
+
+bool ReorderWindow::insert(int seq, UETPacket *pkt) {
+    int offset = seq - base;
+    if (offset <= 0 || offset >= capacity) {
+        return false;
+    }
+    if (slots.empty()) {
+        allocate();
+    }
+    
+    int slot = seq & mask;
+    uint64_t bit = 1ULL << (slot & 63);
+    if (occupied[slot >> 6] & bit) {
+        return false;
+    }
+    slots[slot] = pkt;
+    occupied[slot >> 6] |= bit;
+    count++;
+    return true;
+}
+
+void ReorderWindow::clear() {
+    for (int slot = 0; slot < (int)slots.size(); slot++) {
+        if (occupied[slot >> 6] & (1ULL << (slot & 63))) {
+            delete slots[slot];
+            slots[slot] = nullptr;
+        }
+    }
+    occupied.assign(occupied.size(), 0);
+    count = 0;
+}
\ No newline at end of file
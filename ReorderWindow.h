@@ -0,0 +1,77 @@
+//
+// ReorderWindow.h - Fixed-capacity receive reorder window
+//
+
+#ifndef __REORDER_WINDOW_H
+#define __REORDER_WINDOW_H
+
+#include <cstdint>
+#include <vector>
+#include "UltraEthernetMsg_m.h"
+
+//
+// Out-of-order packets held until the gap before them closes. Slot
+// seq & mask holds sequence number seq, and an occupancy bitmap tells
+// which slots are filled, so draining a contiguous run costs one bit scan
+// per 64 packets instead of one tree lookup per packet. The ring is only
+// allocated by the first out-of-order packet. Held packets are not owned;
+// clear() deletes them.
+//
+class ReorderWindow {
+private:
+    std::vector<UETPacket*> slots;  // power of two, at least 64
+    std::vector<uint64_t> occupied;
+    int capacity;                   // accepted distance from base
+    int base;                       // next sequence number to deliver
+    int count;
+    int mask;
+    
+    void allocate();
+    
+public:
+    ReorderWindow();
+    
+    void setCapacity(int capacity) { this->capacity = capacity; }
+    int getBase() const { return base; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    
+    // Holds pkt until everything before it is delivered; false if seq is
+    // at or beyond base + capacity, or not after base
+    bool insert(int seq, UETPacket *pkt);
+    
+    // The packet at base went up directly without being held
+    void advance() { base++; }
+    
+    // Hands the contiguous run starting at base to deliver, in order, and
+    // returns its length
+    template<typename F>
+    int drain(F deliver) {
+        int delivered = 0;
+        while (count > 0) {
+            int slot = base & mask;
+            int bit = slot & 63;
+            uint64_t& word = occupied[slot >> 6];
+            uint64_t holes = ~(word >> bit);
+            int run = holes ? __builtin_ctzll(holes) : 64;
+            if (run == 0) {
+                break;
+            }
+            
+            for (int i = 0; i < run; i++) {
+                deliver(slots[slot + i]);
+                slots[slot + i] = nullptr;
+            }
+            word &= run == 64 ? 0 : ~(((1ULL << run) - 1) << bit);
+            base += run;
+            count -= run;
+            delivered += run;
+        }
+        return delivered;
+    }
+    
+    // Deletes every held packet
+    void clear();
+};
+
+#endif
\ No newline at end of file
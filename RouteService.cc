@@ -0,0 +1,55 @@
+//
+// RouteService.cc - Cluster-wide route computation with shared tables
+//
+
+#include "RouteService.h"
+
+RouteService::RouteService(const TopologyPlan& plan) : plan(plan) {
+    numRequests = 0;
+}
+
+std::shared_ptr<const ForwardingTable> RouteService::share(ForwardingTable&& table) {
+    numRequests++;
+
+    size_t hash = table.contentHash();
+    auto range = tables.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (*it->second == table) {
+            return it->second;
+        }
+    }
+
+    auto shared = std::make_shared<const ForwardingTable>(std::move(table));
+    tables.emplace(hash, shared);
+    return shared;
+}
+
+std::shared_ptr<const ForwardingTable> RouteService::getHostTable() {
+    // Hosts reach every destination through their first-tier switch, so a
+    // default route across all NIC ports replaces a per-destination table
+    std::vector<int> nicPorts;
+    for (int port = 0; port < plan.getHostPorts(); port++) {
+        nicPorts.push_back(port);
+    }
+
+    ForwardingTable table;
+    table.setDefaultRoute(nicPorts, 1);
+    return share(std::move(table));
+}
+
+std::shared_ptr<const ForwardingTable> RouteService::getSwitchTable(int sw) {
+    SwitchRoutes routes;
+    plan.computeSwitchRoutes(sw, routes);
+
+    ForwardingTable table;
+    table.assign(routes.destGroup, routes.groups);
+    return share(std::move(table));
+}
+
+size_t RouteService::getMemoryUsage() const {
+    size_t bytes = 0;
+    for (const auto& entry : tables) {
+        bytes += entry.second->getMemoryUsage();
+    }
+    return bytes;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+//
+// RouteService.h - Cluster-wide route computation with shared tables
+//
+
+#ifndef __ROUTE_SERVICE_H
+#define __ROUTE_SERVICE_H
+
+#include <memory>
+#include <unordered_map>
+#include "ForwardingTable.h"
+#include "UltraEthernetTopology.h"
+
+//
+// Computes every node's forwarding table once from the TopologyPlan and
+// hands out read-only shared copies. Nodes with identical next-hop patterns
+// (all hosts, the aggregation switches of a pod, all core switches) end up
+// pointing at a single table; UltraEthernetIP copies on write.
+//
+class RouteService {
+private:
+    const TopologyPlan& plan;
+    std::unordered_multimap<size_t, std::shared_ptr<const ForwardingTable>> tables;
+    int numRequests;
+
+    std::shared_ptr<const ForwardingTable> share(ForwardingTable&& table);
+
+public:
+    explicit RouteService(const TopologyPlan& plan);
+
+    // The same default route for every host
+    std::shared_ptr<const ForwardingTable> getHostTable();
+    std::shared_ptr<const ForwardingTable> getSwitchTable(int sw);
+
+    int getNumTables() const { return tables.size(); }
+    int getNumRequests() const { return numRequests; }
+    size_t getMemoryUsage() const;
+};
+
+#endif
\ No newline at end of file
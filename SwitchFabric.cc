@@ -2,39 +2,469 @@
 // SwitchFabric.cc - Switch Fabric Implementation
 //
 
-#include <omnetpp.h>
-#include "UltraEthernetMsg_m.h"
+#include "SwitchFabric.h"
+#include <algorithm>
+#include "UltraEthernetPhy.h"
 
-using namespace omnetpp;
+Define_Module(SwitchFabric);
 
-class SwitchFabric : public cSimpleModule {
-private:
-    int numPorts;
-    simtime_t switchingLatency;
-    double bandwidth;
+// Weight of the newest backlog sample in the congestion level sent as a hint
+static const double HINT_GAIN = 0.125;
+
+// First bit set in both bitmaps at or after start, wrapping around; -1 if none
+static int findNextSet(const uint64_t *bits, const uint64_t *mask, int words, int start) {
+    int first = start / 64;
+    for (int k = 0; k <= words; k++) {
+        int w = (first + k) % words;
+        uint64_t v = bits[w] & mask[w];
+        if (k == 0) {
+            v &= ~0ULL << (start % 64);
+        } else if (k == words) {
+            v &= (1ULL << (start % 64)) - 1;
+        }
+        if (v) {
+            return w * 64 + __builtin_ctzll(v);
+        }
+    }
+    return -1;
+}
+
+SwitchFabric::SwitchFabric() {
+    congestionLevel = 0;
+    isDragonfly = false;
+    schedulerTimer = nullptr;
+    freeEntry = -1;
+    queuedPackets = 0;
+}
+
+SwitchFabric::~SwitchFabric() {
+    cancelAndDelete(schedulerTimer);
+    for (const VirtualOutputQueue& voq : voqs) {
+        for (int e = voq.head; e >= 0; e = voqEntries[e].next) {
+            delete voqEntries[e].pkt;
+        }
+    }
+}
+
+void SwitchFabric::initialize() {
+    numPorts = par("numPorts").intValue();
+    switchingLatency = par("switchingLatency").doubleValue();
+    bandwidth = par("bandwidth").doubleValue();
     
-protected:
-    virtual void initialize() override {
-        numPorts = par("numPorts").intValue();
-        switchingLatency = par("switchingLatency").doubleValue();
-        bandwidth = par("bandwidth").doubleValue();
+    cModule *parent = getParentModule();
+    ports.assign(numPorts, nullptr);
+    hostPorts.assign(numPorts, false);
+    for (int i = 0; i < numPorts; i++) {
+        ports[i] = dynamic_cast<SwitchPort*>(parent->getSubmodule("ports", i));
+        if (ports[i]) {
+            cModule *peer = ports[i]->gate("ethOut")->getPathEndGate()->getOwnerModule();
+            hostPorts[i] = dynamic_cast<UltraEthernetPhy*>(peer) != nullptr;
+        }
     }
     
-    virtual void handleMessage(cMessage *msg) override {
-        UETPacket *pkt = check_and_cast<UETPacket*>(msg);
-        
-        // Simple switching: forward to appropriate port
-        int arrivalPort = msg->getArrivalGate()->getIndex();
-        int destPort = pkt->getDestAddr() % numPorts;
+    std::string mode = par("routingMode").stdstringValue();
+    if (mode == "ecmp") routingMode = ROUTING_ECMP;
+    else if (mode == "adaptive") routingMode = ROUTING_ADAPTIVE;
+    else if (mode == "ugal") routingMode = ROUTING_UGAL;
+    else throw cRuntimeError("Unknown routingMode '%s' (expected ecmp, adaptive or ugal)", mode.c_str());
+    hashSalt = (parent->isVector() ? parent->getIndex() + 1 : 1) * 0x27d4eb2du;
+    
+    remoteHintWeight = par("remoteHintWeight").doubleValue();
+    hintLifetime = par("hintLifetime").doubleValue();
+    ugalThreshold = par("ugalThreshold").intValue();
+    portLoad.assign(numPorts, PortLoad{0, SIMTIME_ZERO});
+    
+    // Crossbar: cells cross at the per-port fabric bandwidth times the speedup
+    crossbarEnabled = par("crossbarEnabled").boolValue();
+    numInputs = numPorts + 1;
+    cellSize = par("cellSize").intValue();
+    cellTime = cellSize * 8.0 / (bandwidth * par("speedup").doubleValue());
+    if (cellTime <= SIMTIME_ZERO) {
+        throw cRuntimeError("Cell time of %d bytes rounds to zero", cellSize);
+    }
+    islipIterations = par("islipIterations").intValue();
+    inputBufferSize = par("inputBufferSize").intValue();
+    inputQueuedBytes.assign(numInputs, 0);
+    outputQueuedBytes.assign(numPorts, 0);
+    inputBusyUntil.assign(numInputs, SIMTIME_ZERO);
+    outputBusyUntil.assign(numPorts, SIMTIME_ZERO);
+    grantPointer.assign(numPorts, 0);
+    acceptPointer.assign(numInputs, 0);
+    outputWords = (numPorts + 63) / 64;
+    inputWords = (numInputs + 63) / 64;
+    requestRows.assign(numInputs * outputWords, 0);
+    requestCols.assign(numPorts * inputWords, 0);
+    inputFree.assign(inputWords, 0);
+    outputFree.assign(outputWords, 0);
+    grants.assign(numInputs * outputWords, 0);
+    schedulerTimer = new cMessage("crossbarScheduler");
+    
+    packetsDropped = registerSignal("packetsDropped");
+    nonMinimalRouted = registerSignal("nonMinimalRouted");
+    voqDelay = registerSignal("voqDelay");
+}
+
+void SwitchFabric::handleMessage(cMessage *msg) {
+    if (msg == schedulerTimer) {
+        runScheduler();
+        return;
+    }
+    
+    UETPacket *pkt = check_and_cast<UETPacket*>(msg);
+    
+    // The neighbour behind the ingress port stamped its own congestion level
+    int inPort = msg->arrivedOn("portIn") ? msg->getArrivalGate()->getIndex() : -1;
+    if (routingMode != ROUTING_ECMP && inPort >= 0) {
+        portLoad[inPort].remoteHint = pkt->getCongestionHint();
+        portLoad[inPort].hintTime = simTime();
+    }
+    
+    int destPort = selectOutputPort(pkt, inPort);
+    if (destPort < 0) {
+        // No route to destination
+        emit(packetsDropped, 1);
+        releaseIngress(inPort, pkt);
+        delete pkt;
+        return;
+    }
+    
+    // Contributions to an in-network collective converge on the switch
+    // their destination hangs off, which hands them to the INC processor.
+    // Results coming back from the processor are switched like any packet.
+    INCPacket *incPkt = dynamic_cast<INCPacket*>(pkt);
+    if (incPkt && inPort >= 0 && hostPorts[destPort] && incPkt->getContributions() < incPkt->getParticipantCount()) {
+        releaseIngress(inPort, pkt);
+        sendDelayed(pkt, switchingLatency, "incOut");
+        return;
+    }
+    
+    if (!crossbarEnabled) {
+        // Ideal fabric: unlimited internal capacity
+        if (routingMode != ROUTING_ECMP) {
+            stampCongestionHint(destPort, pkt);
+        }
+        releaseIngress(inPort, pkt);
+        sendDelayed(pkt, switchingLatency, "portOut", destPort);
+        return;
+    }
+    
+    // Packets from the INC processor use the extra input
+    int input = inPort >= 0 ? inPort : numPorts;
+    if (inputBufferSize > 0 && inputQueuedBytes[input] + pkt->getByteLength() > inputBufferSize) {
+        emit(packetsDropped, 1);
+        releaseIngress(inPort, pkt);
+        delete pkt;
+        return;
+    }
+    enqueueVoq(input, destPort, pkt);
+    
+    // Matching happens on cell boundaries; pull a far-off round forward if
+    // this packet could cross right away
+    int64_t cell = cellTime.raw();
+    simtime_t boundary = SimTime::fromRaw((simTime().raw() + cell - 1) / cell * cell);
+    if (!schedulerTimer->isScheduled()) {
+        scheduleAt(boundary, schedulerTimer);
+    } else if (schedulerTimer->getArrivalTime() > boundary && inputBusyUntil[input] <= boundary &&
+            outputBusyUntil[destPort] <= boundary) {
+        cancelEvent(schedulerTimer);
+        scheduleAt(boundary, schedulerTimer);
+    }
+}
+
+void SwitchFabric::wakeScheduler() {
+    Enter_Method_Silent();
+    
+    if (queuedPackets == 0) {
+        return;
+    }
+    int64_t cell = cellTime.raw();
+    simtime_t boundary = SimTime::fromRaw((simTime().raw() + cell - 1) / cell * cell);
+    if (schedulerTimer->isScheduled()) {
+        if (schedulerTimer->getArrivalTime() <= boundary) {
+            return;
+        }
+        cancelEvent(schedulerTimer);
+    }
+    scheduleAt(boundary, schedulerTimer);
+}
+
+void SwitchFabric::releaseIngress(int inPort, UETPacket *pkt) {
+    // Credit-based flow control on the ingress link counts until here
+    if (inPort >= 0 && ports[inPort]) {
+        ports[inPort]->releaseCredits(pkt);
+    }
+}
+
+void SwitchFabric::enqueueVoq(int input, int output, UETPacket *pkt) {
+    if (voqs.empty()) {
+        voqs.assign(numInputs * numPorts, VirtualOutputQueue{-1, -1});
+    }
+    
+    int e = freeEntry;
+    if (e >= 0) {
+        freeEntry = voqEntries[e].next;
+    } else {
+        e = voqEntries.size();
+        voqEntries.push_back(VoqEntry());
+    }
+    voqEntries[e] = VoqEntry{pkt, simTime(), -1};
+    
+    VirtualOutputQueue& voq = voqs[input * numPorts + output];
+    if (voq.tail >= 0) {
+        voqEntries[voq.tail].next = e;
+    } else {
+        voq.head = e;
+        requestRows[input * outputWords + output / 64] |= 1ULL << (output % 64);
+        requestCols[output * inputWords + input / 64] |= 1ULL << (input % 64);
+    }
+    voq.tail = e;
+    
+    queuedPackets++;
+    inputQueuedBytes[input] += pkt->getByteLength();
+    outputQueuedBytes[output] += pkt->getByteLength();
+    
+    // Ingress backlog drives PFC towards the link peer
+    if (input < numPorts && ports[input] && ports[input]->isPfcEnabled()) {
+        ports[input]->updateIngressOccupancy(inputQueuedBytes[input]);
+    }
+}
+
+UETPacket *SwitchFabric::dequeueVoq(int input, int output) {
+    VirtualOutputQueue& voq = voqs[input * numPorts + output];
+    int e = voq.head;
+    UETPacket *pkt = voqEntries[e].pkt;
+    emit(voqDelay, simTime() - voqEntries[e].arrival);
+    
+    voq.head = voqEntries[e].next;
+    if (voq.head < 0) {
+        voq.tail = -1;
+        requestRows[input * outputWords + output / 64] &= ~(1ULL << (output % 64));
+        requestCols[output * inputWords + input / 64] &= ~(1ULL << (input % 64));
+    }
+    voqEntries[e].pkt = nullptr;
+    voqEntries[e].next = freeEntry;
+    freeEntry = e;
+    
+    queuedPackets--;
+    inputQueuedBytes[input] -= pkt->getByteLength();
+    outputQueuedBytes[output] -= pkt->getByteLength();
+    if (input < numPorts && ports[input] && ports[input]->isPfcEnabled()) {
+        ports[input]->updateIngressOccupancy(inputQueuedBytes[input]);
+    }
+    releaseIngress(input < numPorts ? input : -1, pkt);
+    return pkt;
+}
+
+void SwitchFabric::runScheduler() {
+    simtime_t now = simTime();
+    
+    // Ports still moving a packet's cells sit this round out, as do outputs
+    // whose egress queue is above its PFC threshold
+    std::fill(inputFree.begin(), inputFree.end(), 0);
+    std::fill(outputFree.begin(), outputFree.end(), 0);
+    for (int i = 0; i < numInputs; i++) {
+        if (inputBusyUntil[i] <= now) inputFree[i / 64] |= 1ULL << (i % 64);
+    }
+    for (int j = 0; j < numPorts; j++) {
+        if (outputBusyUntil[j] <= now && (!ports[j] || ports[j]->canAccept())) {
+            outputFree[j / 64] |= 1ULL << (j % 64);
+        }
+    }
+    
+    // iSLIP: every round costs O(ports) bitmap scans, independent of queue depth
+    for (int iter = 0; iter < islipIterations; iter++) {
+        // Grant: each free output picks the next requesting free input
+        grantedInputs.clear();
+        for (int j = 0; j < numPorts; j++) {
+            if (!(outputFree[j / 64] >> (j % 64) & 1)) continue;
+            int i = findNextSet(&requestCols[j * inputWords], inputFree.data(), inputWords, grantPointer[j]);
+            if (i < 0) continue;
+            uint64_t *row = &grants[i * outputWords];
+            bool first = true;
+            for (int w = 0; w < outputWords; w++) {
+                if (row[w]) first = false;
+            }
+            if (first) grantedInputs.push_back(i);
+            row[j / 64] |= 1ULL << (j % 64);
+        }
+        if (grantedInputs.empty()) break;
         
-        // Check if this is an INC packet that should go to INC processor
-        INCPacket *incPkt = dynamic_cast<INCPacket*>(pkt);
-        if (incPkt) {
-            sendDelayed(pkt, switchingLatency, "incOut");
+        // Accept: each input takes the next granting output; pointers only
+        // move on first-iteration matches, which keeps iSLIP starvation free
+        for (int i : grantedInputs) {
+            uint64_t *row = &grants[i * outputWords];
+            int j = findNextSet(row, outputFree.data(), outputWords, acceptPointer[i]);
+            std::fill(row, row + outputWords, 0);
+            if (iter == 0) {
+                grantPointer[j] = (i + 1) % numInputs;
+                acceptPointer[i] = (j + 1) % numPorts;
+            }
+            inputFree[i / 64] &= ~(1ULL << (i % 64));
+            outputFree[j / 64] &= ~(1ULL << (j % 64));
+            
+            UETPacket *pkt = dequeueVoq(i, j);
+            int64_t cells = (pkt->getByteLength() + cellSize - 1) / cellSize;
+            simtime_t transfer = cellTime * (cells > 0 ? cells : 1);
+            inputBusyUntil[i] = now + transfer;
+            outputBusyUntil[j] = now + transfer;
+            if (routingMode != ROUTING_ECMP) {
+                stampCongestionHint(j, pkt);
+            }
+            sendDelayed(pkt, switchingLatency + transfer, "portOut", j);
+        }
+    }
+    
+    scheduleNextCell();
+}
+
+void SwitchFabric::scheduleNextCell() {
+    if (queuedPackets == 0) {
+        return;
+    }
+    simtime_t now = simTime();
+    
+    // A free input still requesting a free output lost to the iteration limit
+    for (int i = 0; i < numInputs; i++) {
+        if (!(inputFree[i / 64] >> (i % 64) & 1)) continue;
+        for (int w = 0; w < outputWords; w++) {
+            if (requestRows[i * outputWords + w] & outputFree[w]) {
+                scheduleAt(now + cellTime, schedulerTimer);
+                return;
+            }
+        }
+    }
+    
+    // Otherwise nothing changes until the next transfer completes; outputs
+    // blocked by their egress queue call wakeScheduler()
+    simtime_t next = SIMTIME_MAX;
+    for (int i = 0; i < numInputs; i++) {
+        if (inputBusyUntil[i] > now && inputBusyUntil[i] < next) next = inputBusyUntil[i];
+    }
+    for (int j = 0; j < numPorts; j++) {
+        if (outputBusyUntil[j] > now && outputBusyUntil[j] < next) next = outputBusyUntil[j];
+    }
+    if (next < SIMTIME_MAX) {
+        scheduleAt(next, schedulerTimer);
+    }
+}
+
+int SwitchFabric::selectOutputPort(UETPacket *pkt, int inPort) {
+    int dest = pkt->getDestAddr();
+    
+    // Standalone switch without installed routes
+    if (!forwardingTable) {
+        return dest % numPorts;
+    }
+    
+    // Packets on a non-minimal detour head for the intermediate group first;
+    // every host of that group is reached through the same ports
+    if (isDragonfly && pkt->getIntermediateGroup() >= 0) {
+        if (pkt->getIntermediateGroup() == dragonfly.group) {
+            pkt->setIntermediateGroup(-1);
         } else {
-            sendDelayed(pkt, switchingLatency, "portOut", destPort);
+            dest = pkt->getIntermediateGroup() * dragonfly.hostsPerGroup;
         }
     }
-};
+    
+    const NextHopGroup *group = forwardingTable->lookup(dest);
+    if (!group) {
+        return -1;
+    }
+    
+    // UGAL decides once, at the router the packet entered from its host
+    if (routingMode == ROUTING_UGAL && isDragonfly && inPort >= 0 && inPort < dragonfly.firstLocalPort &&
+            pkt->getIntermediateGroup() < 0 && dest / dragonfly.hostsPerGroup != dragonfly.group) {
+        return selectUgalPort(group, pkt);
+    }
+    
+    if (group->count == 1) {
+        return group->hops[0];
+    }
+    
+    // ECMP: hash the flow and its entropy onto one member of the group
+    if (routingMode == ROUTING_ECMP) {
+        return group->hops[selectEcmpMember(pkt->getFlowId(), pkt->getSprayPath(), hashSalt, group->count)];
+    }
+    double cost;
+    return selectLeastLoaded(group, pkt, cost);
+}
+
+int SwitchFabric::selectLeastLoaded(const NextHopGroup *group, UETPacket *pkt, double& cost) {
+    // Scan from the flow's ECMP member so ties keep the static hash choice
+    int start = selectEcmpMember(pkt->getFlowId(), pkt->getSprayPath(), hashSalt, group->count);
+    int best = group->hops[start];
+    cost = getPortCost(best);
+    for (int i = 1; i < group->count && cost > 0; i++) {
+        int port = group->hops[(start + i) % group->count];
+        double portCost = getPortCost(port);
+        if (portCost < cost) {
+            best = port;
+            cost = portCost;
+        }
+    }
+    return best;
+}
+
+int SwitchFabric::selectUgalPort(const NextHopGroup *minimal, UETPacket *pkt) {
+    double minCost;
+    int minPort = selectLeastLoaded(minimal, pkt, minCost);
+    if (dragonfly.numGroups < 3) {
+        return minPort;
+    }
+    
+    // Random intermediate group other than the source and destination groups
+    int destGroup = pkt->getDestAddr() / dragonfly.hostsPerGroup;
+    int via = intuniform(0, dragonfly.numGroups - 3);
+    if (via >= std::min(dragonfly.group, destGroup)) via++;
+    if (via >= std::max(dragonfly.group, destGroup)) via++;
+    
+    const NextHopGroup *detour = forwardingTable->lookup(via * dragonfly.hostsPerGroup);
+    if (!detour) {
+        return minPort;
+    }
+    double nonMinCost;
+    int nonMinPort = selectLeastLoaded(detour, pkt, nonMinCost);
+    
+    // UGAL-L: weigh local backlog by the hops still ahead. A global port
+    // leaves at most one local hop, a local port adds one in front of it;
+    // the detour then needs up to three more hops from the intermediate group.
+    int minHops = minPort >= dragonfly.firstGlobalPort ? 2 : 3;
+    int nonMinHops = (nonMinPort >= dragonfly.firstGlobalPort ? 1 : 2) + 3;
+    if (minCost * minHops <= nonMinCost * nonMinHops + ugalThreshold) {
+        return minPort;
+    }
+    
+    pkt->setIntermediateGroup(via);
+    emit(nonMinimalRouted, 1);
+    return nonMinPort;
+}
+
+double SwitchFabric::getPortCost(int port) {
+    double cost = getQueueOccupancy(port);
+    const PortLoad& load = portLoad[port];
+    if (remoteHintWeight > 0 && simTime() - load.hintTime < hintLifetime) {
+        cost += remoteHintWeight * load.remoteHint;
+    }
+    return cost;
+}
+
+double SwitchFabric::getQueueOccupancy(int port) {
+    // Bytes waiting in front of the crossbar plus the egress queue
+    double bytes = crossbarEnabled ? outputQueuedBytes[port] : 0;
+    return ports[port] ? bytes + ports[port]->getQueueBytes() : bytes;
+}
+
+void SwitchFabric::stampCongestionHint(int port, UETPacket *pkt) {
+    // Tell the next hop how congested this switch is
+    congestionLevel += HINT_GAIN * (getQueueOccupancy(port) - congestionLevel);
+    pkt->setCongestionHint((uint32_t)congestionLevel);
+}
+
+void SwitchFabric::setForwardingTable(std::shared_ptr<const ForwardingTable> table) {
+    forwardingTable = table;
+}
 
-Define_Module(SwitchFabric);
\ No newline at end of file
+void SwitchFabric::setDragonflyLayout(const DragonflyLayout& layout) {
+    dragonfly = layout;
+    isDragonfly = true;
+}
\ No newline at end of file
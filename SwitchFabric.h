@@ -0,0 +1,134 @@
+//
+// SwitchFabric.h - Switch Fabric Module
+//
+
+#ifndef __SWITCH_FABRIC_H
+#define __SWITCH_FABRIC_H
+
+#include <omnetpp.h>
+#include <memory>
+#include <vector>
+#include "ForwardingTable.h"
+#include "SwitchPort.h"
+#include "UltraEthernetTopology.h"
+#include "UltraEthernetMsg_m.h"
+
+using namespace omnetpp;
+
+enum RoutingMode {
+    ROUTING_ECMP,       // static flow hash over the next-hop group
+    ROUTING_ADAPTIVE,   // least-loaded member of the next-hop group
+    ROUTING_UGAL        // adaptive, plus Dragonfly minimal/non-minimal choice
+};
+
+// Congestion hint received from the neighbour behind one port
+struct PortLoad {
+    double remoteHint;       // backlog reported by the neighbour
+    simtime_t hintTime;
+};
+
+// Packet waiting in a virtual output queue
+struct VoqEntry {
+    UETPacket *pkt;
+    simtime_t arrival;
+    int next;                // next entry of the same queue, -1 at the tail
+};
+
+// One (input, output) queue, linked through the entry pool
+struct VirtualOutputQueue {
+    int head;
+    int tail;
+};
+
+class SwitchFabric : public cSimpleModule {
+private:
+    int numPorts;
+    simtime_t switchingLatency;
+    double bandwidth;
+    std::vector<SwitchPort*> ports;    // egress queues, null outside UltraEthernetSwitch
+    std::vector<bool> hostPorts;       // ports whose link peer is a host NIC
+    
+    // Input-queued crossbar with per-input virtual output queues. Inputs are
+    // the ports plus the INC processor; a matched pair stays connected until
+    // the packet's cells have crossed (packet-mode iSLIP).
+    bool crossbarEnabled;
+    int numInputs;
+    int cellSize;
+    simtime_t cellTime;
+    int islipIterations;
+    long inputBufferSize;
+    cMessage *schedulerTimer;
+    std::vector<VirtualOutputQueue> voqs;    // [input * numPorts + output], allocated on first use
+    std::vector<VoqEntry> voqEntries;
+    int freeEntry;
+    int queuedPackets;
+    std::vector<long> inputQueuedBytes;
+    std::vector<long> outputQueuedBytes;
+    std::vector<simtime_t> inputBusyUntil;
+    std::vector<simtime_t> outputBusyUntil;
+    std::vector<int> grantPointer;
+    std::vector<int> acceptPointer;
+    
+    // Request bitmaps: rows over outputs per input, columns over inputs per output
+    int outputWords;
+    int inputWords;
+    std::vector<uint64_t> requestRows;
+    std::vector<uint64_t> requestCols;
+    
+    // Scheduler scratch space
+    std::vector<uint64_t> inputFree;
+    std::vector<uint64_t> outputFree;
+    std::vector<uint64_t> grants;
+    std::vector<int> grantedInputs;
+    
+    // Adaptive routing
+    RoutingMode routingMode;
+    uint32_t hashSalt;           // per switch, decorrelates ECMP choices across tiers
+    std::vector<PortLoad> portLoad;
+    double congestionLevel;      // EWMA of output backlog, sent as a hint
+    double remoteHintWeight;
+    simtime_t hintLifetime;
+    double ugalThreshold;
+    bool isDragonfly;
+    DragonflyLayout dragonfly;
+    
+    // Statistics
+    simsignal_t packetsDropped;
+    simsignal_t nonMinimalRouted;
+    simsignal_t voqDelay;
+    
+    // Forwarding state installed by UltraEthernetTopology, possibly shared
+    // with other switches that have identical routes
+    std::shared_ptr<const ForwardingTable> forwardingTable;
+    
+    int selectOutputPort(UETPacket *pkt, int inPort);
+    int selectLeastLoaded(const NextHopGroup *group, UETPacket *pkt, double& cost);
+    int selectUgalPort(const NextHopGroup *minimal, UETPacket *pkt);
+    double getPortCost(int port);
+    double getQueueOccupancy(int port);
+    void stampCongestionHint(int port, UETPacket *pkt);
+    
+    void releaseIngress(int inPort, UETPacket *pkt);
+    void enqueueVoq(int input, int output, UETPacket *pkt);
+    UETPacket *dequeueVoq(int input, int output);
+    void runScheduler();
+    void scheduleNextCell();
+    
+public:
+    SwitchFabric();
+    virtual ~SwitchFabric();
+    
+    // Replaces the forwarding state; without a table packets leave on
+    // destAddr % numPorts
+    void setForwardingTable(std::shared_ptr<const ForwardingTable> table);
+    void setDragonflyLayout(const DragonflyLayout& layout);
+    
+    // Called by a SwitchPort whose egress queue has room again
+    void wakeScheduler();
+    
+protected:
+    virtual void initialize() override;
+    virtual void handleMessage(cMessage *msg) override;
+};
+
+#endif
\ No newline at end of file
@@ -2,29 +2,544 @@
 // SwitchPort.cc - Switch Port Implementation
 //
 
-#include <omnetpp.h>
-#include "UltraEthernetMsg_m.h"
+#include "SwitchPort.h"
+#include "SwitchFabric.h"
+#include "FluidNetwork.h"
 
-using namespace omnetpp;
+Define_Module(SwitchPort);
 
-class SwitchPort : public cSimpleModule {
-private:
-    simtime_t processingLatency;
+SwitchPort::SwitchPort() {
+    nextLane = 0;
+    queueLength = 0;
+    queueBytes = 0;
+    txTimer = nullptr;
+    pausingPeer = false;
+    pfcRefreshTimer = nullptr;
+    fabric = nullptr;
+    fluid = nullptr;
+    fluidLink = -1;
+    replayNext = 0;
+    replaysWithoutProgress = 0;
+    resyncPending = false;
+    resyncSeq = 0;
+    llrReplayTimer = nullptr;
+    llrAckTimer = nullptr;
+    creditRefreshes = 0;
+}
+
+SwitchPort::~SwitchPort() {
+    cancelAndDelete(txTimer);
+    cancelAndDelete(pfcRefreshTimer);
+    cancelAndDelete(llrReplayTimer);
+    cancelAndDelete(llrAckTimer);
+    for (EgressLane& lane : lanes) {
+        for (int i = 0; i < lane.length; i++) {
+            delete lane.ring[(lane.head + i) % lane.ring.size()];
+        }
+    }
+}
+
+void SwitchPort::initialize() {
+    processingLatency = par("processingLatency").doubleValue();
+    linkSpeed = par("linkSpeed").doubleValue();
+    queueCapacity = par("queueCapacity").intValue();
+    
+    ecnEnabled = par("ecnEnabled").boolValue();
+    ecnMinThreshold = par("ecnMinThreshold").intValue();
+    ecnMaxThreshold = par("ecnMaxThreshold").intValue();
+    ecnMaxProbability = par("ecnMaxProbability").doubleValue();
+    if (ecnMaxThreshold < ecnMinThreshold) {
+        throw cRuntimeError("ecnMaxThreshold must not be below ecnMinThreshold");
+    }
+    
+    pfcEnabled = par("pfcEnabled").boolValue();
+    pfcXoff = par("pfcXoff").intValue();
+    pfcXon = par("pfcXon").intValue();
+    pfcPauseTime = par("pfcPauseTime").doubleValue();
+    if (pfcEnabled && pfcXon >= pfcXoff) {
+        throw cRuntimeError("pfcXon must be below pfcXoff");
+    }
+    
+    llrEnabled = par("llrEnabled").boolValue();
+    llrTimeout = par("llrTimeout").doubleValue();
+    maxRetransmissions = par("maxRetransmissions").intValue();
+    llrAckCoalesceCount = par("llrAckCoalesceCount").intValue();
+    llrAckDelay = par("llrAckDelay").doubleValue();
+    creditsEnabled = par("creditsEnabled").boolValue();
+    if ((llrEnabled || creditsEnabled) && llrAckDelay >= llrTimeout) {
+        throw cRuntimeError("llrAckDelay must be below llrTimeout");
+    }
+    int64_t replayBytes = par("llrReplayBytes").intValue();
+    llrRing.setCapacity(replayBytes > 0 ? replayBytes : (int64_t)(linkSpeed * llrTimeout.dbl() / 8));
+    llrReplayTimer = new cMessage("llrReplay");
+    llrAckTimer = new cMessage("llrAck");
+    
+    creditEgressLimit = par("creditEgressLimit").intValue();
+    int numLanes = creditsEnabled ? par("numVirtualLanes").intValue() : 1;
+    credits.init(numLanes, par("creditBuffer").intValue(), par("creditSize").intValue());
+    lanes.assign(credits.getNumLanes(), EgressLane{std::vector<cPacket*>(), 0, 0, false, SIMTIME_ZERO});
+    
+    std::string mode = par("headerMode").stdstringValue();
+    if (mode == "none") headerMode = HEADERS_NONE;
+    else if (mode == "full") headerMode = HEADERS_FULL;
+    else if (mode == "pri") headerMode = HEADERS_PRI;
+    else throw cRuntimeError("Unknown headerMode '%s' (expected none, full or pri)", mode.c_str());
+    compressor.init(par("priContexts").intValue(), llrEnabled ? 0 : par("priRefreshPackets").intValue());
+    decompressor.init(par("priContexts").intValue());
+    
+    txTimer = new cMessage("txDone");
+    pfcRefreshTimer = new cMessage("pfcRefresh");
+    fabric = dynamic_cast<SwitchFabric*>(getParentModule()->getSubmodule("switchFabric"));
     
-protected:
-    virtual void initialize() override {
-        processingLatency = par("processingLatency").doubleValue();
+    cModule *network = getSimulation()->getSystemModule();
+    fluid = network ? dynamic_cast<FluidNetwork*>(network->getSubmodule("fluid")) : nullptr;
+    if (fluid && fluid->isEnabled() && getParentModule()->isVector()) {
+        fluidLink = fluid->findSwitchLink(getParentModule()->getIndex(), getIndex());
+    }
+    if (fluidLink < 0) {
+        fluid = nullptr;
     }
     
-    virtual void handleMessage(cMessage *msg) override {
-        if (msg->getArrivalGate()->isName("fabricIn")) {
-            // From fabric to ethernet
-            sendDelayed(msg, processingLatency, "ethOut");
-        } else if (msg->getArrivalGate()->isName("ethIn")) {
-            // From ethernet to fabric
+    queueLengthSignal = registerSignal("queueLength");
+    queueDrops = registerSignal("queueDrops");
+    ecnMarks = registerSignal("ecnMarks");
+    pauseFramesSent = registerSignal("pauseFramesSent");
+    llrRetransmissions = registerSignal("llrRetransmissions");
+    creditsConsumed = registerSignal("creditsConsumed");
+    backpressureStallTime = registerSignal("backpressureStallTime");
+    compressionRatio = registerSignal("compressionRatio");
+    priContextMisses = registerSignal("priContextMisses");
+    priEvictions = registerSignal("priEvictions");
+}
+
+void SwitchPort::handleMessage(cMessage *msg) {
+    if (msg == txTimer) {
+        startTransmission();
+    } else if (msg == pfcRefreshTimer) {
+        // Keep the peer paused until the ingress backlog drains to pfcXon
+        sendPause(pfcPauseTime);
+        scheduleAt(simTime() + pfcPauseTime / 2, pfcRefreshTimer);
+    } else if (msg == llrReplayTimer) {
+        handleLlrTimeout();
+    } else if (msg == llrAckTimer) {
+        sendLlrAck(true);
+    } else if (msg->getArrivalGate()->isName("fabricIn")) {
+        // From fabric to ethernet
+        enqueue(check_and_cast<cPacket*>(msg));
+    } else if (msg->getArrivalGate()->isName("ethIn")) {
+        // Link-level acknowledgments terminate at the port
+        if (LLRAck *ack = dynamic_cast<LLRAck*>(msg)) {
+            if (llrEnabled || creditsEnabled) {
+                processLlrAck(ack);
+            }
+            delete ack;
+            return;
+        }
+        
+        // PFC from the link peer pauses or resumes our transmitter
+        if (PfcFrame *pfc = dynamic_cast<PfcFrame*>(msg)) {
+            pausedUntil = simTime() + pfc->getPauseTime();
+            delete msg;
+            
+            // A frame already on the wire finishes; the next waits for the pause
+            if (queueLength > 0) {
+                cancelEvent(txTimer);
+                scheduleAt(pausedUntil > txFinishTime ? pausedUntil : txFinishTime, txTimer);
+            }
+            return;
+        }
+        
+        // From ethernet to fabric
+        UETPacket *frame = llrEnabled || creditsEnabled || headerMode != HEADERS_NONE ? dynamic_cast<UETPacket*>(msg) : nullptr;
+        if (frame) {
+            receiveFrame(frame);
+        } else {
             sendDelayed(msg, processingLatency, "fabricOut");
         }
     }
-};
+}
+
+int SwitchPort::getLane(cPacket *pkt) const {
+    UETPacket *frame = creditsEnabled ? dynamic_cast<UETPacket*>(pkt) : nullptr;
+    return frame ? credits.getLane(frame) : 0;
+}
+
+void SwitchPort::enqueue(cPacket *pkt) {
+    if (queueBytes + pkt->getByteLength() > queueCapacity) {
+        emit(queueDrops, 1);
+        delete pkt;
+        return;
+    }
+    
+    // Mark on arrival, against the depth this packet has to wait behind
+    UETPacket *uetPkt = dynamic_cast<UETPacket*>(pkt);
+    if (uetPkt && ecnEnabled && shouldMarkEcn()) {
+        uetPkt->setEcnMarked(true);
+        emit(ecnMarks, 1);
+    }
+    
+    EgressLane& lane = lanes[getLane(pkt)];
+    if (lane.length == (int)lane.ring.size()) {
+        // Grow and straighten the ring
+        std::vector<cPacket*> larger(lane.ring.empty() ? 16 : lane.ring.size() * 2);
+        for (int i = 0; i < lane.length; i++) {
+            larger[i] = lane.ring[(lane.head + i) % lane.ring.size()];
+        }
+        lane.ring.swap(larger);
+        lane.head = 0;
+    }
+    lane.ring[(lane.head + lane.length) % lane.ring.size()] = pkt;
+    lane.length++;
+    queueLength++;
+    queueBytes += pkt->getByteLength();
+    emit(queueLengthSignal, queueBytes);
+    
+    scheduleTransmission();
+}
+
+void SwitchPort::scheduleTransmission() {
+    if (!txTimer->isScheduled()) {
+        simtime_t start = simTime() > txFinishTime ? simTime() : txFinishTime;
+        scheduleAt(start > pausedUntil ? start : pausedUntil, txTimer);
+    }
+}
+
+void SwitchPort::startTransmission() {
+    bool replaying = llrEnabled && replayNext != llrRing.getNext();
+    if (queueLength == 0 && !replaying) {
+        return;
+    }
+    if (simTime() < pausedUntil) {
+        scheduleAt(pausedUntil, txTimer);
+        return;
+    }
+    
+    // A full replay ring or a lack of credits stalls the port until an ACK
+    // frees it
+    bool wasBlocked = !canAccept();
+    cPacket *pkt = nextFrame();
+    if (!pkt) {
+        return;
+    }
+    
+    // The peer sees the packet once its last bit is on the wire; the next
+    // one starts when the transmitter is free again
+    simtime_t txTime = pkt->getBitLength() / linkSpeed;
+    simtime_t delay = processingLatency + txTime;
+    if (fluid) {
+        FluidBackground background = fluid->getBackground(fluidLink);
+        txTime = txTime / (1 - background.utilization);
+        delay = processingLatency + background.queueingDelay + txTime;
+        if (simTime() + delay < lastDelivery) {
+            delay = lastDelivery - simTime();
+        }
+        lastDelivery = simTime() + delay;
+    }
+    sendDelayed(pkt, delay, "ethOut");
+    txFinishTime = simTime() + txTime;
+    scheduleAt(txFinishTime, txTimer);
+    
+    if (wasBlocked && canAccept() && fabric) {
+        fabric->wakeScheduler();
+    }
+}
+
+cPacket *SwitchPort::nextFrame() {
+    // Go-back-N replay comes before anything new
+    if (llrEnabled && replayNext != llrRing.getNext()) {
+        UETPacket *frame = llrRing.rebuild(replayNext);
+        frame->setLlrResync(resyncPending && replayNext == resyncSeq);
+        replayNext++;
+        emit(llrRetransmissions, 1);
+        
+        // Replays do not wait for credits; the peer's next advertisement
+        // returns the credits of the frames it discarded
+        if (creditsEnabled) {
+            consumeCredits(frame);
+        }
+        addHeaders(frame, true);
+        return frame;
+    }
+    
+    // Lanes take turns; a lane whose head lacks credits blocks only itself
+    int numLanes = lanes.size();
+    for (int k = 0; k < numLanes; k++) {
+        int index = (nextLane + k) % numLanes;
+        EgressLane& lane = lanes[index];
+        if (lane.length == 0) {
+            continue;
+        }
+        cPacket *pkt = lane.ring[lane.head];
+        UETPacket *frame = dynamic_cast<UETPacket*>(pkt);
+        if (frame && llrEnabled && llrRing.isFull()) {
+            continue;
+        }
+        if (frame && creditsEnabled && !credits.canSend(index, credits.getUnits(frame))) {
+            if (!lane.stalled) {
+                lane.stalled = true;
+                lane.stallStart = simTime();
+            }
+            continue;
+        }
+        
+        lane.ring[lane.head] = nullptr;
+        lane.head = (lane.head + 1) % lane.ring.size();
+        lane.length--;
+        nextLane = (index + 1) % numLanes;
+        queueLength--;
+        queueBytes -= pkt->getByteLength();
+        emit(queueLengthSignal, queueBytes);
+        
+        if (lane.stalled) {
+            lane.stalled = false;
+            emit(backpressureStallTime, simTime() - lane.stallStart);
+        }
+        if (frame && creditsEnabled) {
+            consumeCredits(frame);
+        }
+        if (frame && llrEnabled) {
+            bool copied;
+            uint32_t seq = llrRing.push(frame, copied);
+            frame->setLlrSequence(seq);
+            frame->setLlrResync(resyncPending && seq == resyncSeq);
+            replayNext = llrRing.getNext();
+            if (!llrReplayTimer->isScheduled()) {
+                llrLastProgress = simTime();
+                scheduleAt(simTime() + llrTimeout, llrReplayTimer);
+            }
+        }
+        if (frame) {
+            addHeaders(frame, false);
+        }
+        return pkt;
+    }
+    return nullptr;
+}
+
+void SwitchPort::consumeCredits(UETPacket *frame) {
+    int64_t units = credits.getUnits(frame);
+    frame->setCreditsSent(credits.consume(credits.getLane(frame), units));
+    emit(creditsConsumed, units);
+}
+
+void SwitchPort::addHeaders(UETPacket *frame, bool replay) {
+    // Replays go with full headers; the peer's contexts stopped at the gap
+    int64_t payload = frame->getByteLength();
+    PriCompressor::Result result = addWireHeaders(frame, headerMode, compressor, replay);
+    if (result.context >= 0) {
+        if (result.evicted) {
+            emit(priEvictions, 1);
+        }
+        emit(compressionRatio, (double)(result.fullBytes - result.headerBytes) / (payload + result.fullBytes));
+    }
+}
+
+void SwitchPort::receiveFrame(UETPacket *pkt) {
+    removeWireHeaders(pkt);
+    LlrReceiver::Verdict verdict = llrEnabled ?
+            llrReceiver.receive(pkt->getLlrSequence(), pkt->getLlrResync()) : LlrReceiver::DELIVER;
+    
+    // Contexts follow the frames in LLR order; a resynchronized peer starts
+    // them over. A frame whose context is damaged cannot be rebuilt.
+    bool delivered = verdict == LlrReceiver::DELIVER;
+    if (delivered) {
+        if (pkt->getLlrResync()) {
+            decompressor.flush();
+        }
+        if (!decompressor.decompress(pkt)) {
+            emit(priContextMisses, 1);
+            delivered = false;
+        }
+    }
+    
+    // Only delivered frames hold ingress buffer; the credits of discarded
+    // ones are returned by the next advertisement
+    if (creditsEnabled) {
+        credits.receive(credits.getLane(pkt), pkt->getCreditsSent(), credits.getUnits(pkt), delivered);
+        creditRefreshes = maxRetransmissions;
+    }
+    
+    switch (verdict) {
+        case LlrReceiver::DELIVER:
+            if (delivered) {
+                sendDelayed(pkt, processingLatency, "fabricOut");
+            } else {
+                delete pkt;
+            }
+            break;
+        case LlrReceiver::DUPLICATE:
+            delete pkt;
+            break;
+        case LlrReceiver::GAP:
+            // Everything after a lost frame is discarded until the peer
+            // replays from the gap
+            delete pkt;
+            if (!llrReceiver.nackSent) {
+                llrReceiver.nackSent = true;
+                sendLlrAck(false);
+            }
+            return;
+    }
+    scheduleLlrAck();
+}
+
+void SwitchPort::scheduleLlrAck() {
+    // One cumulative ACK per llrAckCoalesceCount frames or llrAckDelay; a
+    // link with neither LLR nor credits has nothing to say
+    if (!llrEnabled && !creditsEnabled) {
+        return;
+    }
+    if (llrEnabled && llrReceiver.unacknowledged >= llrAckCoalesceCount) {
+        sendLlrAck(true);
+    } else if (!llrAckTimer->isScheduled()) {
+        scheduleAt(simTime() + llrAckDelay, llrAckTimer);
+    } else if (llrAckTimer->getArrivalTime() > simTime() + llrAckDelay) {
+        // Only a credit refresh was pending
+        cancelEvent(llrAckTimer);
+        scheduleAt(simTime() + llrAckDelay, llrAckTimer);
+    }
+}
+
+void SwitchPort::releaseCredits(const UETPacket *pkt) {
+    Enter_Method_Silent();
+    
+    if (!creditsEnabled) {
+        return;
+    }
+    credits.release(credits.getLane(pkt), credits.getUnits(pkt));
+    creditRefreshes = maxRetransmissions;
+    scheduleLlrAck();
+}
+
+void SwitchPort::processLlrAck(LLRAck *ack) {
+    if (creditsEnabled && (int)ack->getCreditLimitArraySize() == credits.getNumLanes()) {
+        for (int lane = 0; lane < credits.getNumLanes(); lane++) {
+            credits.updateLimit(lane, ack->getCreditLimit(lane));
+        }
+    }
+    if (!llrEnabled) {
+        if (queueLength > 0) {
+            scheduleTransmission();
+        }
+        return;
+    }
+    
+    // Both ACK and NACK cover every frame below seq
+    uint32_t seq = ack->getAcknowledgedSeq();
+    if (llrRing.acknowledge(seq) > 0) {
+        llrLastProgress = simTime();
+        replaysWithoutProgress = 0;
+        if (resyncPending && (int32_t)(seq - resyncSeq) > 0) {
+            resyncPending = false;
+        }
+    }
+    if ((int32_t)(replayNext - llrRing.getBase()) < 0) {
+        replayNext = llrRing.getBase();
+    }
+    
+    if (ack->getAckType() != 0) {
+        if ((int32_t)(seq - llrRing.getBase()) < 0) {
+            // The peer waits for frames given up on; restart it at the base
+            resyncPending = true;
+            resyncSeq = llrRing.getBase();
+        }
+        if (!llrRing.isEmpty()) {
+            replayNext = llrRing.contains(seq) ? seq : llrRing.getBase();
+            llrLastProgress = simTime();
+        }
+    }
+    
+    // A replay or room in the ring restarts a stalled transmitter
+    if (queueLength > 0 || replayNext != llrRing.getNext()) {
+        scheduleTransmission();
+    }
+}
+
+void SwitchPort::sendLlrAck(bool positive) {
+    // Control frames bypass the egress queue
+    LLRAck *ack = new LLRAck(positive ? "LLRAck" : "LLRNack");
+    ack->setByteLength(64);
+    ack->setAcknowledgedSeq(llrReceiver.expected);
+    ack->setAckType(positive ? 0 : 1);
+    llrReceiver.unacknowledged = 0;
+    cancelEvent(llrAckTimer);
+    
+    // Credit limits ride on every acknowledgment and are repeated after the
+    // last change, as on the host link
+    if (creditsEnabled) {
+        ack->setCreditLimitArraySize(credits.getNumLanes());
+        for (int lane = 0; lane < credits.getNumLanes(); lane++) {
+            ack->setCreditLimit(lane, credits.advertise(lane));
+        }
+        if (creditRefreshes > 0) {
+            creditRefreshes--;
+            scheduleAt(simTime() + llrTimeout, llrAckTimer);
+        }
+    }
+    send(ack, "ethOut");
+}
+
+void SwitchPort::handleLlrTimeout() {
+    // Frames still being serialized cannot have been acknowledged yet, so the
+    // timeout counts from when the transmitter went quiet
+    if (llrRing.isEmpty()) {
+        return;
+    }
+    simtime_t quiet = llrLastProgress > txFinishTime ? llrLastProgress : txFinishTime;
+    if (simTime() - quiet < llrTimeout) {
+        scheduleAt(quiet + llrTimeout, llrReplayTimer);
+        return;
+    }
+    
+    if (++replaysWithoutProgress > maxRetransmissions) {
+        // Give up on the outstanding frames; the transport recovers them and
+        // the next frame tells the peer to restart its sequence there
+        llrRing.clear();
+        compressor.flush();
+        replaysWithoutProgress = 0;
+        replayNext = llrRing.getNext();
+        resyncPending = true;
+        resyncSeq = llrRing.getNext();
+    } else {
+        replayNext = llrRing.getBase();
+        llrLastProgress = simTime();
+        scheduleAt(simTime() + llrTimeout, llrReplayTimer);
+    }
+    if (queueLength > 0 || replayNext != llrRing.getNext()) {
+        scheduleTransmission();
+    }
+}
+
+bool SwitchPort::shouldMarkEcn() {
+    if (queueBytes <= ecnMinThreshold) {
+        return false;
+    }
+    if (queueBytes > ecnMaxThreshold) {
+        return true;
+    }
+    double fraction = (double)(queueBytes - ecnMinThreshold) / (ecnMaxThreshold - ecnMinThreshold);
+    return uniform(0, 1) < ecnMaxProbability * fraction;
+}
+
+void SwitchPort::updateIngressOccupancy(long bytes) {
+    Enter_Method_Silent();
+    
+    if (!pausingPeer && bytes >= pfcXoff) {
+        pausingPeer = true;
+        sendPause(pfcPauseTime);
+        scheduleAt(simTime() + pfcPauseTime / 2, pfcRefreshTimer);
+    } else if (pausingPeer && bytes <= pfcXon) {
+        pausingPeer = false;
+        cancelEvent(pfcRefreshTimer);
+        sendPause(SIMTIME_ZERO);
+    }
+}
 
-Define_Module(SwitchPort);
\ No newline at end of file
+void SwitchPort::sendPause(simtime_t duration) {
+    // Control frames bypass the egress queue
+    PfcFrame *pfc = new PfcFrame(duration > SIMTIME_ZERO ? "PFC-PAUSE" : "PFC-RESUME");
+    pfc->setByteLength(64);
+    pfc->setPauseTime(duration);
+    send(pfc, "ethOut");
+    emit(pauseFramesSent, 1);
+}
\ No newline at end of file
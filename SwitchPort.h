@@ -0,0 +1,151 @@
+//
+// SwitchPort.h - Switch Port Module
+//
+
+#ifndef __SWITCH_PORT_H
+#define __SWITCH_PORT_H
+
+#include <omnetpp.h>
+#include <vector>
+#include "CreditFlowControl.h"
+#include "LlrReplayRing.h"
+#include "PriCompression.h"
+#include "UltraEthernetMsg_m.h"
+
+using namespace omnetpp;
+
+class SwitchFabric;
+class FluidNetwork;
+
+class SwitchPort : public cSimpleModule {
+private:
+    simtime_t processingLatency;
+    double linkSpeed;
+    
+    // Egress queue: a circular buffer of packets waiting for the transmitter
+    // per virtual lane, served round robin; the totals cover all lanes
+    struct EgressLane {
+        std::vector<cPacket*> ring;
+        int head;
+        int length;
+        bool stalled;           // head waits for credits since stallStart
+        simtime_t stallStart;
+    };
+    std::vector<EgressLane> lanes;
+    int nextLane;
+    int queueLength;
+    long queueBytes;
+    long queueCapacity;
+    cMessage *txTimer;
+    simtime_t txFinishTime;
+    simtime_t pausedUntil;   // set by PFC frames from the link peer
+    
+    // ECN: RED between the thresholds, a step if they are equal
+    bool ecnEnabled;
+    long ecnMinThreshold;
+    long ecnMaxThreshold;
+    double ecnMaxProbability;
+    
+    // PFC: ingress occupancy reported by the fabric drives PAUSE frames to
+    // the link peer; the egress queue stops the crossbar at pfcXoff
+    bool pfcEnabled;
+    long pfcXoff;
+    long pfcXon;
+    simtime_t pfcPauseTime;
+    bool pausingPeer;
+    cMessage *pfcRefreshTimer;
+    SwitchFabric *fabric;
+    
+    // Hybrid mode: fluid flows on this port's link take capacity and add
+    // queueing; deliveries stay in order as that background changes
+    FluidNetwork *fluid;
+    int fluidLink;
+    simtime_t lastDelivery;
+    
+    // Link-level retry towards the link peer: frames leave through a replay
+    // ring, and a NACK or timeout rewinds the transmitter to the gap before
+    // any new frame. The ingress side acknowledges in order.
+    bool llrEnabled;
+    simtime_t llrTimeout;
+    int maxRetransmissions;
+    int llrAckCoalesceCount;
+    simtime_t llrAckDelay;
+    LlrReplayRing llrRing;
+    uint32_t replayNext;        // next frame to send, behind the ring's end while replaying
+    simtime_t llrLastProgress;
+    int replaysWithoutProgress;
+    bool resyncPending;
+    uint32_t resyncSeq;
+    cMessage *llrReplayTimer;
+    LlrReceiver llrReceiver;
+    cMessage *llrAckTimer;
+    
+    // Credit-based flow control with the link peer, carried on the LLR ACKs
+    // whether or not LLR itself is on. Ingress credits come back as the
+    // fabric takes packets out of its VOQs; the egress queue stops the
+    // crossbar at creditEgressLimit so back-pressure reaches the ingress.
+    bool creditsEnabled;
+    long creditEgressLimit;
+    CreditState credits;
+    int creditRefreshes;
+    
+    // Headers on the link: frames crossing the fabric are payload only, and
+    // each direction keeps its own PRI contexts
+    HeaderMode headerMode;
+    PriCompressor compressor;
+    PriDecompressor decompressor;
+    
+    // Statistics
+    simsignal_t queueLengthSignal;
+    simsignal_t queueDrops;
+    simsignal_t ecnMarks;
+    simsignal_t pauseFramesSent;
+    simsignal_t llrRetransmissions;
+    simsignal_t creditsConsumed;
+    simsignal_t backpressureStallTime;
+    simsignal_t compressionRatio;
+    simsignal_t priContextMisses;
+    simsignal_t priEvictions;
+    
+    int getLane(cPacket *pkt) const;
+    void enqueue(cPacket *pkt);
+    void scheduleTransmission();
+    void startTransmission();
+    cPacket *nextFrame();
+    void consumeCredits(UETPacket *frame);
+    void addHeaders(UETPacket *frame, bool replay);
+    void receiveFrame(UETPacket *pkt);
+    void scheduleLlrAck();
+    void processLlrAck(LLRAck *ack);
+    void sendLlrAck(bool positive);
+    void handleLlrTimeout();
+    bool shouldMarkEcn();
+    void sendPause(simtime_t duration);
+    
+public:
+    SwitchPort();
+    virtual ~SwitchPort();
+    
+    long getQueueBytes() const { return queueBytes; }
+    bool isPfcEnabled() const { return pfcEnabled; }
+    
+    // False while the egress queue is above pfcXoff or creditEgressLimit, so
+    // the crossbar holds packets for this port in its VOQs instead of
+    // overflowing the queue
+    bool canAccept() const {
+        return (!pfcEnabled || queueBytes < pfcXoff) && (!creditsEnabled || queueBytes < creditEgressLimit);
+    }
+    
+    // Called by the fabric when the bytes waiting from this port's ingress change
+    void updateIngressOccupancy(long bytes);
+    
+    // Called by the fabric once a packet from this port's ingress no longer
+    // holds ingress buffer; its credits go back to the link peer
+    void releaseCredits(const UETPacket *pkt);
+    
+protected:
+    virtual void initialize() override;
+    virtual void handleMessage(cMessage *msg) override;
+};
+
+#endif
\ No newline at end of file
@@ -8,18 +8,39 @@ Define_Module(UETTransport);
 
 UETTransport::UETTransport() {
     rdmaTimer = nullptr;
-    congestionWindow = 10;
-    nextSequenceNum = 0;
-    expectedSequenceNum = 0;
+    pacingTimer = nullptr;
+    ackTimer = nullptr;
+    pdcSweepTimer = nullptr;
+    contextsCreated = 0;
+    initialCongestionWindow = 10;
+    maxCongestionWindow = 64;
+    queuedPackets = 0;
+    retransmissionEntries = 0;
+    packetCopies = 0;
+    peakRetransmissionEntries = 0;
+    peakSendContexts = 0;
+    peakReceiveContexts = 0;
+    contextEvictions = 0;
 }
 
 UETTransport::~UETTransport() {
     cancelAndDelete(rdmaTimer);
-    for (auto& pkt : reorderBuffer) {
-        delete pkt.second;
+    cancelAndDelete(pacingTimer);
+    cancelAndDelete(ackTimer);
+    cancelAndDelete(pdcSweepTimer);
+    for (SendFlow& flow : sendFlows) {
+        for (UETPacket *pkt : flow.sendQueue) {
+            delete pkt;
+        }
+        for (OutgoingMessage& message : flow.messages) {
+            message.record.release();
+        }
     }
-    for (auto& entry : retransmissionBuffer) {
-        delete entry.second.packet;
+    for (ReceiveState& rx : receiveStates) {
+        for (Reassembly& partial : rx.reassembly) {
+            delete partial.message;
+        }
+        rx.reorderWindow.clear();
     }
 }
 
@@ -32,11 +53,38 @@ void UETTransport::initialize() {
     else profileType = AI_FULL;
     
     packetSprayingEnabled = par("packetSprayingEnabled").boolValue();
+    numSprayPaths = par("numSprayPaths").intValue();
+    pathRerouteLosses = par("pathRerouteLosses").intValue();
+    if (numSprayPaths < 1) {
+        throw cRuntimeError("numSprayPaths must be at least 1");
+    }
     reorderingEnabled = par("reorderingEnabled").boolValue();
     maxReorderBuffer = par("maxReorderBuffer").intValue();
-    congestionWindow = par("initialCongestionWindow").intValue();
+    if (maxReorderBuffer < 1 || maxReorderBuffer > SACK_WINDOW) {
+        // Trains beyond the SACK window are refused before reordering
+        throw cRuntimeError("maxReorderBuffer must be between 1 and %d", SACK_WINDOW);
+    }
+    initialCongestionWindow = par("initialCongestionWindow").intValue();
+    maxCongestionWindow = par("maxCongestionWindow").intValue();
+    pacingEnabled = par("pacingEnabled").boolValue();
+    if (initialCongestionWindow < 1 || maxCongestionWindow < initialCongestionWindow) {
+        throw cRuntimeError("Need 1 <= initialCongestionWindow <= maxCongestionWindow");
+    }
     rdmaTimeout = par("rdmaTimeout").doubleValue();
     maxRetransmissions = par("maxRetransmissions").intValue();
+    minRto = par("minRto").doubleValue();
+    maxRto = par("maxRto").doubleValue();
+    ackCoalesceCount = par("ackCoalesceCount").intValue();
+    ackCoalesceDelay = par("ackCoalesceDelay").doubleValue();
+    if (ackCoalesceCount < 1) {
+        throw cRuntimeError("ackCoalesceCount must be at least 1");
+    }
+    pdcIdleTimeout = par("pdcIdleTimeout").doubleValue();
+    mtu = par("mtu").intValue();
+    maxTrainLength = par("maxTrainLength").intValue();
+    if (mtu < 1 || maxTrainLength < 1) {
+        throw cRuntimeError("mtu and maxTrainLength must be positive");
+    }
     
     // Initialize statistics
     packetsTransmitted = registerSignal("packetsTransmitted");
@@ -44,15 +92,35 @@ void UETTransport::initialize() {
     retransmissions = registerSignal("retransmissions");
     congestionWindowSignal = registerSignal("congestionWindow");
     roundTripTime = registerSignal("roundTripTime");
+    retransmissionTimeout = registerSignal("retransmissionTimeout");
+    sendQueueLength = registerSignal("sendQueueLength");
+    sendQueueDelay = registerSignal("sendQueueDelay");
+    acksSent = registerSignal("acksSent");
+    nacksSent = registerSignal("nacksSent");
+    pathsAvoided = registerSignal("pathsAvoided");
+    pathsRerouted = registerSignal("pathsRerouted");
+    trainLengthSignal = registerSignal("trainLength");
+    messagesReassembled = registerSignal("messagesReassembled");
+    flowsFailed = registerSignal("flowsFailed");
+    messagesFailed = registerSignal("messagesFailed");
     
-    // Initialize timer
+    // Initialize timers
     rdmaTimer = new cMessage("rdmaTimer");
+    pacingTimer = new cMessage("pacingTimer");
+    ackTimer = new cMessage("ackTimer");
+    pdcSweepTimer = new cMessage("pdcSweep");
 }
 
 void UETTransport::handleMessage(cMessage *msg) {
     if (msg->isSelfMessage()) {
         if (msg == rdmaTimer) {
             handleRdmaTimeout();
+        } else if (msg == pacingTimer) {
+            handlePacingTimer();
+        } else if (msg == ackTimer) {
+            handleAckTimer();
+        } else if (msg == pdcSweepTimer) {
+            handlePdcSweep();
         }
     } else {
         if (msg->getArrivalGate()->isName("appIn")) {
@@ -68,190 +136,872 @@ void UETTransport::handleMessage(cMessage *msg) {
 }
 
 void UETTransport::processFromApplication(UETPacket *pkt) {
-    // Add transport header
-    pkt->setSequenceNum(nextSequenceNum++);
+    // In-network collective contributions are reduced on the way and never
+    // acknowledged end to end; the application sets their flow
+    if (dynamic_cast<INCPacket*>(pkt)) {
+        pkt->setTransportType(DATA);
+        pkt->setTrainLength(1);
+        send(pkt, "networkOut");
+        emit(packetsTransmitted, 1);
+        return;
+    }
+    
+    SendFlow& flow = getSendFlow(pkt->getDestAddr());
     pkt->setTransportType(DATA);
-    pkt->setFlowId(generateFlowId());
-    pkt->setTimestamp(simTime().raw());
+    pkt->setFlowId(flow.flowId);
     
-    // Apply packet spraying if enabled
-    if (packetSprayingEnabled && profileType == AI_FULL) {
-        applyPacketSpraying(pkt);
+    flow.sendQueue.push_back(pkt);
+    queuedPackets++;
+    releasePackets(flow);
+    emit(sendQueueLength, queuedPackets);
+}
+
+SendFlow& UETTransport::getSendFlow(int destAddr) {
+    uint64_t key = PdcTable<SendFlow>::makeKey(destAddr, 0);
+    SendFlow *existing = sendFlows.find(key);
+    if (existing) {
+        return *existing;
     }
     
-    // Store for potential retransmission
-    if (profileType != AI_BASE) {
-        RetransmissionEntry entry;
-        entry.packet = pkt->dup();
-        entry.timestamp = simTime();
-        entry.retransmissionCount = 0;
-        retransmissionBuffer[pkt->getSequenceNum()] = entry;
+    // Contexts are created on the first packet to a destination
+    SendFlow& flow = sendFlows.insert(key);
+    flow.destAddr = destAddr;
+    flow.flowId = generateFlowId();
+    flow.lastActivity = simTime();
+    flow.nextMessageId = 0;
+    flow.retransmissionBase = 0;
+    flow.nextSequenceNum = 0;
+    flow.inFlight = 0;
+    flow.congestionWindow = initialCongestionWindow;
+    flow.minRtt = SIMTIME_ZERO;
+    flow.srtt = SIMTIME_ZERO;
+    flow.rttVar = SIMTIME_ZERO;
+    flow.rto = rdmaTimeout;
+    flow.nextSendTime = SIMTIME_ZERO;
+    flow.pacingPending = false;
+    flow.nextPath = 0;
+    if (isSpraying()) {
+        // Entropy 0 is left to unsprayed traffic
+        flow.paths.resize(numSprayPaths);
+        for (PathState& path : flow.paths) {
+            path.entropy = intuniform(1, 0xffff);
+            path.srtt = SIMTIME_ZERO;
+            path.ecnRate = 0;
+            path.losses = 0;
+            path.avoidUntil = SIMTIME_ZERO;
+        }
+    }
+    peakSendContexts = std::max(peakSendContexts, sendFlows.size());
+    if (!pdcSweepTimer->isScheduled()) {
+        scheduleAt(simTime() + pdcIdleTimeout, pdcSweepTimer);
+    }
+    return flow;
+}
+
+SendFlow *UETTransport::findSendFlow(int destAddr, uint32_t flowId) {
+    // ACKs and deadlines of an evicted context must not touch its successor
+    SendFlow *flow = sendFlows.find(PdcTable<SendFlow>::makeKey(destAddr, 0));
+    return flow && flow->flowId == flowId ? flow : nullptr;
+}
+
+void UETTransport::failSendFlow(SendFlow& flow) {
+    // Like a connection going into error: every message of the context is
+    // reported lost and the context goes. The next message to this peer
+    // opens a fresh flowId, and the receiver's half-filled context idles out.
+    long failed = flow.sendQueue.size();
+    for (OutgoingMessage& message : flow.messages) {
+        message.record.release();
+        failed++;
+    }
+    for (UETPacket *pkt : flow.sendQueue) {
+        delete pkt;
+    }
+    queuedPackets -= flow.sendQueue.size();
+    for (RetransmissionEntry& entry : flow.retransmissionBuffer) {
+        if (!entry.acknowledged) {
+            retransmissionEntries--;
+        }
+    }
+    emit(sendQueueLength, queuedPackets);
+    emit(flowsFailed, 1);
+    emit(messagesFailed, failed);
+    
+    // Its deadlines and ACKs no longer match a context; a pacing wakeup
+    // still queued is skipped
+    sendFlows.remove(PdcTable<SendFlow>::makeKey(flow.destAddr, 0));
+}
+
+void UETTransport::releasePackets(SendFlow& flow) {
+    while (true) {
+        // Continue the message being segmented, or start the next one
+        bool sending = !flow.messages.empty() && flow.messages.back().sentSegments < flow.messages.back().numSegments;
+        int remaining;
+        if (sending) {
+            remaining = flow.messages.back().numSegments - flow.messages.back().sentSegments;
+        } else if (!flow.sendQueue.empty()) {
+            remaining = segmentCount(flow.sendQueue.front()->getByteLength());
+        } else {
+            return;
+        }
+        int count = std::min(remaining, maxTrainLength);
+        
+        // AI_BASE keeps no per-segment state, so nothing would ever open the
+        // window. Otherwise the unacknowledged range also has to fit the
+        // receiver's SACK bitmap.
+        if (profileType != AI_BASE) {
+            count = std::min(count, flow.congestionWindow - flow.inFlight);
+            count = std::min(count, SACK_WINDOW - (flow.nextSequenceNum - flow.retransmissionBase));
+            if (count <= 0) {
+                return;
+            }
+            if (simTime() < flow.nextSendTime) {
+                // Too early for the pacing rate; come back at nextSendTime
+                if (!flow.pacingPending) {
+                    flow.pacingPending = true;
+                    pacingQueue.push(FlowEvent{flow.nextSendTime, PdcTable<SendFlow>::makeKey(flow.destAddr, 0)});
+                    if (!pacingTimer->isScheduled() || pacingTimer->getArrivalTime() > flow.nextSendTime) {
+                        cancelEvent(pacingTimer);
+                        scheduleAt(flow.nextSendTime, pacingTimer);
+                    }
+                }
+                return;
+            }
+        }
         
-        // Schedule timeout
-        if (!rdmaTimer->isScheduled()) {
-            scheduleAt(simTime() + rdmaTimeout, rdmaTimer);
+        if (!sending) {
+            startMessage(flow);
+        }
+        transmitTrain(flow, flow.messages.back(), count);
+        
+        // Spread one window over one smoothed RTT, a train taking the gap
+        // of as many packets as it carries
+        if (pacingEnabled && flow.srtt > SIMTIME_ZERO) {
+            flow.nextSendTime = simTime() + flow.srtt * count / flow.congestionWindow;
+        }
+    }
+}
+
+void UETTransport::startMessage(SendFlow& flow) {
+    UETPacket *pkt = flow.sendQueue.front();
+    flow.sendQueue.pop_front();
+    queuedPackets--;
+    emit(sendQueueDelay, simTime() - pkt->getArrivalTime());
+    
+    // Only the header is kept; segments are built from it as they go out
+    flow.messages.emplace_back();
+    OutgoingMessage& message = flow.messages.back();
+    if (!message.record.capture(pkt)) {
+        packetCopies++;
+    }
+    message.messageId = flow.nextMessageId++;
+    message.length = pkt->getByteLength();
+    message.firstSeq = flow.nextSequenceNum;
+    message.numSegments = segmentCount(message.length);
+    message.sentSegments = 0;
+    delete pkt;
+}
+
+UETPacket *UETTransport::buildTrain(const OutgoingMessage& message, int seqNum, int count) const {
+    // The timestamp stays the application's, so the receiver can time the
+    // whole message
+    UETPacket *pkt = message.record.rebuild();
+    int index = seqNum - message.firstSeq;
+    int64_t begin = (int64_t)index * mtu;
+    int64_t end = std::min((int64_t)(index + count) * mtu, message.length);
+    pkt->setByteLength(end - begin);
+    pkt->setSequenceNum(seqNum);
+    pkt->setMessageId(message.messageId);
+    pkt->setMessageLength(message.length);
+    pkt->setMessageSegments(message.numSegments);
+    pkt->setSegmentIndex(index);
+    pkt->setTrainLength(count);
+    return pkt;
+}
+
+void UETTransport::transmitTrain(SendFlow& flow, OutgoingMessage& message, int count) {
+    // One packet stands for count back-to-back segments, each with its own
+    // sequence number
+    int seqNum = flow.nextSequenceNum;
+    flow.nextSequenceNum += count;
+    message.sentSegments += count;
+    flow.lastActivity = simTime();
+    
+    UETPacket *pkt = buildTrain(message, seqNum, count);
+    
+    // Apply packet spraying if enabled; a train stays on one path
+    int path = isSpraying() ? applyPacketSpraying(flow, pkt) : 0;
+    
+    if (profileType != AI_BASE) {
+        for (int i = 0; i < count; i++) {
+            flow.retransmissionBuffer.emplace_back();
+            RetransmissionEntry& entry = flow.retransmissionBuffer.back();
+            entry.timestamp = simTime();
+            entry.retransmissionCount = 0;
+            entry.acknowledged = false;
+            entry.path = path;
         }
+        flow.inFlight += count;
+        retransmissionEntries += count;
+        armRetransmissionTimer(flow, seqNum, count, flow.retransmissionBuffer.back());
+        peakRetransmissionEntries = std::max(peakRetransmissionEntries, (size_t)retransmissionEntries);
+    } else if (message.sentSegments == message.numSegments) {
+        // Nothing to retransmit from, so the header can go
+        message.record.release();
+        flow.messages.pop_back();
     }
     
     send(pkt, "networkOut");
     emit(packetsTransmitted, 1);
-    emit(congestionWindowSignal, congestionWindow);
+    emit(trainLengthSignal, count);
+}
+
+OutgoingMessage *UETTransport::findMessage(SendFlow& flow, int seqNum) {
+    auto it = std::upper_bound(flow.messages.begin(), flow.messages.end(), seqNum,
+            [](int seq, const OutgoingMessage& message) { return seq < message.firstSeq; });
+    return it == flow.messages.begin() ? nullptr : &*(it - 1);
+}
+
+void UETTransport::handlePacingTimer() {
+    simtime_t now = simTime();
+    while (!pacingQueue.empty() && pacingQueue.top().time <= now) {
+        SendFlow *flow = sendFlows.find(pacingQueue.top().key);
+        pacingQueue.pop();
+        if (!flow) {
+            continue;
+        }
+        
+        flow->pacingPending = false;
+        releasePackets(*flow);
+    }
+    
+    if (!pacingQueue.empty() && !pacingTimer->isScheduled()) {
+        scheduleAt(pacingQueue.top().time, pacingTimer);
+    }
+    emit(sendQueueLength, queuedPackets);
+}
+
+RetransmissionEntry *UETTransport::findUnacknowledged(SendFlow& flow, int seqNum) {
+    int index = seqNum - flow.retransmissionBase;
+    if (index < 0 || index >= (int)flow.retransmissionBuffer.size()) {
+        return nullptr;
+    }
+    RetransmissionEntry& entry = flow.retransmissionBuffer[index];
+    return entry.acknowledged ? nullptr : &entry;
+}
+
+void UETTransport::retireEntry(SendFlow& flow, RetransmissionEntry& entry) {
+    // The entry stays in place until the cumulative ACK passes it; its
+    // deadline goes stale and its window slot is free again
+    entry.acknowledged = true;
+    flow.inFlight--;
+    retransmissionEntries--;
 }
 
 void UETTransport::processFromNetwork(UETPacket *pkt) {
     emit(packetsReceived, 1);
     
-    if (pkt->getTransportType() == ACK) {
+    if (dynamic_cast<INCPacket*>(pkt)) {
+        send(pkt, "appOut");
+        return;
+    }
+    
+    if (pkt->getTransportType() == ACK || pkt->getTransportType() == NACK) {
         processAcknowledgment(pkt);
         delete pkt;
         return;
     }
     
-    // Handle reordering if enabled
-    if (reorderingEnabled && profileType == AI_FULL) {
-        if (pkt->getSequenceNum() == expectedSequenceNum) {
-            // In-order packet
-            processInOrderPacket(pkt);
-            expectedSequenceNum++;
-            
-            // Check reorder buffer for next packets
-            processReorderBuffer();
-        } else if (pkt->getSequenceNum() > expectedSequenceNum) {
-            // Out-of-order packet - buffer it
-            if (reorderBuffer.size() < maxReorderBuffer) {
-                reorderBuffer[pkt->getSequenceNum()] = pkt;
-            } else {
-                // Buffer full, drop packet
-                delete pkt;
-            }
-        } else {
-            // Duplicate packet, drop it
-            delete pkt;
+    ReceiveState& rx = getReceiveState(pkt->getSrcAddr(), pkt->getFlowId());
+    rx.lastActivity = simTime();
+    
+    // AI_BASE senders keep no retransmission state to acknowledge against
+    if (profileType == AI_BASE) {
+        reassemble(rx, pkt);
+        return;
+    }
+    
+    int first = pkt->getSequenceNum();
+    int last = first + pkt->getTrainLength() - 1;
+    bool ecnMarked = pkt->getEcnMarked();
+    
+    // Beyond what the SACK bitmap can describe; acknowledge at once in case
+    // our last ACK was lost
+    if (last - rx.cumulativeAck > SACK_WINDOW) {
+        delete pkt;
+        sendAcknowledgment(rx, ACK);
+        return;
+    }
+    
+    // With ordered delivery, trains starting too far ahead of the next
+    // expected segment are dropped without acknowledging so the sender
+    // retransmits
+    bool ordered = reorderingEnabled && profileType == AI_FULL;
+    if (ordered && first - rx.cumulativeAck >= maxReorderBuffer) {
+        delete pkt;
+        return;
+    }
+    
+    // Record the segments of the train that are new
+    bool gap = first > rx.highestReceived + 1;
+    int fresh = 0;
+    for (int seqNum = first; seqNum <= last; seqNum++) {
+        int offset = seqNum - rx.cumulativeAck;
+        if (offset >= 0 && (offset == 0 || !((rx.sackBits >> (offset - 1)) & 1))) {
+            recordReceived(rx, seqNum);
+            fresh++;
         }
-    } else {
-        // No reordering, process directly
-        processInOrderPacket(pkt);
     }
+    if (fresh == 0) {
+        // Already received; our ACK may have been lost
+        delete pkt;
+        sendAcknowledgment(rx, ACK);
+        return;
+    }
+    rx.lastEcnMarked = ecnMarked;
+    reassemble(rx, pkt);
     
-    // Send acknowledgment
-    sendAcknowledgment(pkt->getSequenceNum());
+    // A new gap or an ECN mark is reported at once, so the sender can tell
+    // which path it came from; everything else is coalesced
+    int pending = rx.pendingAcks;
+    rx.pendingAcks += fresh;
+    if (gap) {
+        sendAcknowledgment(rx, NACK);
+    } else if (ecnMarked || rx.pendingAcks >= ackCoalesceCount) {
+        sendAcknowledgment(rx, ACK);
+    } else if (pending == 0) {
+        rx.ackDeadline = simTime() + ackCoalesceDelay;
+        ackQueue.push(FlowEvent{rx.ackDeadline, PdcTable<ReceiveState>::makeKey(rx.srcAddr, rx.flowId)});
+        if (!ackTimer->isScheduled() || ackTimer->getArrivalTime() > rx.ackDeadline) {
+            cancelEvent(ackTimer);
+            scheduleAt(rx.ackDeadline, ackTimer);
+        }
+    }
 }
 
-void UETTransport::processInOrderPacket(UETPacket *pkt) {
-    // Calculate RTT if this is a response to our packet
-    auto it = retransmissionBuffer.find(pkt->getSequenceNum());
-    if (it != retransmissionBuffer.end()) {
-        simtime_t rtt = simTime() - it->second.timestamp;
-        emit(roundTripTime, rtt);
-        
-        // Update congestion window based on RTT
-        updateCongestionWindow(rtt);
-        
-        // Remove from retransmission buffer
-        delete it->second.packet;
-        retransmissionBuffer.erase(it);
+ReceiveState& UETTransport::getReceiveState(int srcAddr, uint32_t flowId) {
+    uint64_t key = PdcTable<ReceiveState>::makeKey(srcAddr, flowId);
+    ReceiveState *existing = receiveStates.find(key);
+    if (existing) {
+        return *existing;
     }
     
+    // A new flowId always starts a new sequence space at zero
+    ReceiveState& rx = receiveStates.insert(key);
+    rx.srcAddr = srcAddr;
+    rx.flowId = flowId;
+    rx.cumulativeAck = 0;
+    rx.sackBits = 0;
+    rx.highestReceived = -1;
+    rx.lastReceived = -1;
+    rx.lastReceivedTime = SIMTIME_ZERO;
+    rx.pendingAcks = 0;
+    rx.lastEcnMarked = false;
+    rx.ackDeadline = SIMTIME_ZERO;
+    rx.reorderWindow.setCapacity(SACK_WINDOW + 1);
+    peakReceiveContexts = std::max(peakReceiveContexts, receiveStates.size());
+    if (!pdcSweepTimer->isScheduled()) {
+        scheduleAt(simTime() + pdcIdleTimeout, pdcSweepTimer);
+    }
+    return rx;
+}
+
+void UETTransport::recordReceived(ReceiveState& rx, int seqNum) {
+    rx.highestReceived = std::max(rx.highestReceived, seqNum);
+    rx.lastReceived = seqNum;
+    rx.lastReceivedTime = simTime();
+    
+    if (seqNum == rx.cumulativeAck) {
+        // Advance over this packet and the run of packets already held
+        int held = rx.sackBits == ~0ULL ? 64 : __builtin_ctzll(~rx.sackBits);
+        rx.cumulativeAck += held + 1;
+        rx.sackBits = held + 1 >= 64 ? 0 : rx.sackBits >> (held + 1);
+    } else {
+        rx.sackBits |= 1ULL << (seqNum - rx.cumulativeAck - 1);
+    }
+}
+
+void UETTransport::processInOrderPacket(UETPacket *pkt) {
     send(pkt, "appOut");
 }
 
-void UETTransport::processReorderBuffer() {
-    auto it = reorderBuffer.find(expectedSequenceNum);
-    while (it != reorderBuffer.end()) {
-        processInOrderPacket(it->second);
-        reorderBuffer.erase(it);
-        expectedSequenceNum++;
-        it = reorderBuffer.find(expectedSequenceNum);
+void UETTransport::processReorderBuffer(ReceiveState& rx) {
+    rx.reorderWindow.drain([this](UETPacket *pkt) {
+        processInOrderPacket(pkt);
+    });
+}
+
+void UETTransport::reassemble(ReceiveState& rx, UETPacket *pkt) {
+    // A train holding the whole message needs no bookkeeping
+    if (pkt->getTrainLength() >= pkt->getMessageSegments()) {
+        completeMessage(rx, pkt);
+        return;
+    }
+    
+    // Few messages are partial at once, so a linear search does
+    uint32_t messageId = pkt->getMessageId();
+    size_t i = 0;
+    while (i < rx.reassembly.size() && rx.reassembly[i].messageId != messageId) {
+        i++;
+    }
+    if (i == rx.reassembly.size()) {
+        rx.reassembly.emplace_back();
+        Reassembly& partial = rx.reassembly.back();
+        partial.messageId = messageId;
+        partial.numSegments = pkt->getMessageSegments();
+        partial.received = 0;
+        partial.completed.assign((partial.numSegments + 63) / 64, 0);
+        partial.message = nullptr;
+    }
+    
+    Reassembly& partial = rx.reassembly[i];
+    int begin = pkt->getSegmentIndex();
+    int end = std::min(begin + (int)pkt->getTrainLength(), partial.numSegments);
+    for (int segment = begin; segment < end; segment++) {
+        uint64_t bit = 1ULL << (segment & 63);
+        if (!(partial.completed[segment >> 6] & bit)) {
+            partial.completed[segment >> 6] |= bit;
+            partial.received++;
+        }
+    }
+    if (partial.message) {
+        delete pkt;
+    } else {
+        partial.message = pkt;
+    }
+    
+    if (partial.received == partial.numSegments) {
+        UETPacket *message = partial.message;
+        if (i + 1 < rx.reassembly.size()) {
+            partial = std::move(rx.reassembly.back());
+        }
+        rx.reassembly.pop_back();
+        completeMessage(rx, message);
+    }
+}
+
+void UETTransport::completeMessage(ReceiveState& rx, UETPacket *message) {
+    // The application sees the message as it was sent
+    message->setByteLength(message->getMessageLength());
+    message->setSegmentIndex(0);
+    message->setTrainLength(message->getMessageSegments());
+    emit(messagesReassembled, 1);
+    
+    if (!reorderingEnabled || profileType != AI_FULL) {
+        processInOrderPacket(message);
+        return;
+    }
+    
+    // Messages go up in send order. The window never overflows: complete
+    // messages ahead of the first missing one all lie within the SACK span.
+    int messageId = message->getMessageId();
+    if (messageId == rx.reorderWindow.getBase()) {
+        processInOrderPacket(message);
+        rx.reorderWindow.advance();
+        processReorderBuffer(rx);
+    } else if (!rx.reorderWindow.insert(messageId, message)) {
+        throw cRuntimeError("Message %d outside the reorder window", messageId);
     }
 }
 
 void UETTransport::processAcknowledgment(UETPacket *ack) {
-    int seqNum = ack->getSequenceNum();
-    auto it = retransmissionBuffer.find(seqNum);
-    if (it != retransmissionBuffer.end()) {
-        // Calculate RTT
-        simtime_t rtt = simTime() - it->second.timestamp;
+    SendFlow *context = findSendFlow(ack->getSrcAddr(), ack->getFlowId());
+    if (!context) {
+        return;
+    }
+    SendFlow& flow = *context;
+    simtime_t now = simTime();
+    flow.lastActivity = now;
+    
+    // Calculate RTT from the packet that triggered the ACK, less the time
+    // the receiver held a coalesced ACK; retransmitted packets give
+    // ambiguous samples (Karn)
+    RetransmissionEntry *trigger = findUnacknowledged(flow, ack->getSequenceNum());
+    if (trigger) {
+        simtime_t rtt = now - trigger->timestamp - ack->getAckDelay();
+        if (rtt <= SIMTIME_ZERO) {
+            rtt = now - trigger->timestamp;
+        }
         emit(roundTripTime, rtt);
-        
-        // Update congestion window
-        updateCongestionWindow(rtt);
-        
-        // Remove from retransmission buffer
-        delete it->second.packet;
-        retransmissionBuffer.erase(it);
+        if (trigger->retransmissionCount == 0) {
+            updateRto(flow, rtt);
+            updateCongestionWindow(flow, rtt);
+        }
+        if (!flow.paths.empty()) {
+            updatePath(flow, trigger->path, trigger->retransmissionCount == 0 ? rtt : SIMTIME_ZERO, ack->getEcnEcho());
+        }
+    }
+    
+    // Retire everything below the cumulative point at once
+    int cumulativeAck = ack->getAckSequence();
+    while (flow.retransmissionBase < cumulativeAck && !flow.retransmissionBuffer.empty()) {
+        RetransmissionEntry& entry = flow.retransmissionBuffer.front();
+        if (!entry.acknowledged) {
+            retireEntry(flow, entry);
+        }
+        flow.retransmissionBuffer.pop_front();
+        flow.retransmissionBase++;
     }
+    while (!flow.messages.empty() && flow.messages.front().sentSegments == flow.messages.front().numSegments &&
+            flow.messages.front().firstSeq + flow.messages.front().numSegments <= flow.retransmissionBase) {
+        flow.messages.front().record.release();
+        flow.messages.pop_front();
+    }
+    
+    // Then the selectively acknowledged packets above it
+    uint64_t sack = ack->getSackBitmap();
+    for (uint64_t bits = sack; bits; bits &= bits - 1) {
+        RetransmissionEntry *entry = findUnacknowledged(flow, cumulativeAck + 1 + __builtin_ctzll(bits));
+        if (entry) {
+            retireEntry(flow, *entry);
+        }
+    }
+    
+    // A NACK reports holes below the highest received segment. Holes younger
+    // than the flow's minimum RTT may still be on a slower path.
+    if (ack->getTransportType() == NACK && sack && flow.minRtt > SIMTIME_ZERO) {
+        int highest = cumulativeAck + 1 + (63 - __builtin_clzll(sack));
+        if (retransmitRange(flow, cumulativeAck, highest, 0, flow.minRtt)) {
+            flow.congestionWindow = std::max(1, flow.congestionWindow / 2);
+            emit(congestionWindowSignal, flow.congestionWindow);
+        }
+    }
+    
+    releasePackets(flow);
 }
 
-void UETTransport::sendAcknowledgment(int seqNum) {
-    UETPacket *ack = new UETPacket("ACK");
-    ack->setTransportType(ACK);
-    ack->setSequenceNum(seqNum);
+void UETTransport::sendAcknowledgment(ReceiveState& rx, TransportType type) {
+    UETPacket *ack = new UETPacket(type == NACK ? "NACK" : "ACK");
+    ack->setTransportType(type);
+    ack->setSequenceNum(rx.lastReceived);
+    ack->setAckDelay(rx.lastReceived >= 0 ? simTime() - rx.lastReceivedTime : SIMTIME_ZERO);
+    ack->setAckSequence(rx.cumulativeAck);
+    ack->setSackBitmap(rx.sackBits);
+    ack->setEcnEcho(rx.lastEcnMarked);
+    ack->setFlowId(rx.flowId);
+    ack->setDestAddr(rx.srcAddr);
     ack->setTimestamp(simTime().raw());
+    rx.pendingAcks = 0;
     
     send(ack, "networkOut");
     emit(packetsTransmitted, 1);
+    emit(type == NACK ? nacksSent : acksSent, 1);
+}
+
+void UETTransport::handleAckTimer() {
+    // Flush coalesced ACKs whose delay ran out; entries for sources that
+    // were acknowledged meanwhile are stale
+    simtime_t now = simTime();
+    while (!ackQueue.empty() && ackQueue.top().time <= now) {
+        FlowEvent due = ackQueue.top();
+        ackQueue.pop();
+        
+        ReceiveState *rx = receiveStates.find(due.key);
+        if (rx && rx->pendingAcks > 0 && rx->ackDeadline == due.time) {
+            sendAcknowledgment(*rx, ACK);
+        }
+    }
+    
+    if (!ackQueue.empty()) {
+        scheduleAt(ackQueue.top().time, ackTimer);
+    }
 }
 
 void UETTransport::handleRdmaTimeout() {
-    // Handle retransmissions
-    auto it = retransmissionBuffer.begin();
-    while (it != retransmissionBuffer.end()) {
-        if (simTime() - it->second.timestamp > rdmaTimeout) {
-            if (it->second.retransmissionCount < maxRetransmissions) {
-                // Retransmit packet
-                UETPacket *retransmit = it->second.packet->dup();
-                send(retransmit, "networkOut");
-                
-                it->second.retransmissionCount++;
-                it->second.timestamp = simTime();
-                
-                emit(retransmissions, 1);
-                emit(packetsTransmitted, 1);
-                
-                // Reduce congestion window on timeout
-                congestionWindow = std::max(1, congestionWindow / 2);
-                emit(congestionWindowSignal, congestionWindow);
-                
-                ++it;
-            } else {
-                // Max retransmissions reached, drop packet
-                delete it->second.packet;
-                it = retransmissionBuffer.erase(it);
-            }
+    // Only deadlines that are due are touched, oldest first
+    simtime_t now = simTime();
+    while (!rtoQueue.empty() && rtoQueue.top().deadline <= now) {
+        RtoDeadline due = rtoQueue.top();
+        rtoQueue.pop();
+        
+        if (!isPending(due)) {
+            continue;
+        }
+        SendFlow& flow = *findSendFlow(due.destAddr, due.flowId);
+        
+        if (due.generation < maxRetransmissions) {
+            retransmitRange(flow, due.seqNum, due.seqNum + due.length, due.generation, SIMTIME_ZERO);
+            
+            // Reduce congestion window on timeout
+            flow.congestionWindow = std::max(1, flow.congestionWindow / 2);
+            emit(congestionWindowSignal, flow.congestionWindow);
         } else {
-            ++it;
+            // Max retransmissions reached, the receiver will never complete
+            // these messages
+            failSendFlow(flow);
+        }
+    }
+    
+    rescheduleRdmaTimer();
+}
+
+bool UETTransport::isPending(const RtoDeadline& due) {
+    SendFlow *flow = findSendFlow(due.destAddr, due.flowId);
+    if (!flow) {
+        return false;
+    }
+    for (int seqNum = due.seqNum; seqNum < due.seqNum + due.length; seqNum++) {
+        RetransmissionEntry *entry = findUnacknowledged(*flow, seqNum);
+        if (entry && entry->retransmissionCount == due.generation) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool UETTransport::retransmitRange(SendFlow& flow, int first, int end, int generation, simtime_t minAge) {
+    // Segments of [first, end) that are still missing, at the given
+    // generation and at least minAge old, go out again. Contiguous runs
+    // within one message stay a single train; a hole splits it.
+    simtime_t now = simTime();
+    auto due = [&](int seqNum) {
+        RetransmissionEntry *entry = findUnacknowledged(flow, seqNum);
+        return entry && entry->retransmissionCount == generation && now - entry->timestamp >= minAge;
+    };
+    
+    bool sent = false;
+    int seqNum = first;
+    while (seqNum < end) {
+        if (!due(seqNum)) {
+            seqNum++;
+            continue;
         }
+        const OutgoingMessage *message = findMessage(flow, seqNum);
+        int limit = std::min(end, message->firstSeq + message->numSegments);
+        int runEnd = seqNum + 1;
+        while (runEnd < limit && runEnd - seqNum < maxTrainLength && due(runEnd)) {
+            runEnd++;
+        }
+        retransmitTrain(flow, *message, seqNum, runEnd - seqNum);
+        seqNum = runEnd;
+        sent = true;
+    }
+    return sent;
+}
+
+void UETTransport::retransmitTrain(SendFlow& flow, const OutgoingMessage& message, int seqNum, int count) {
+    UETPacket *retransmit = buildTrain(message, seqNum, count);
+    packetCopies++;
+    
+    // The old path is suspect; the copy goes wherever the scoreboard says
+    RetransmissionEntry *head = findUnacknowledged(flow, seqNum);
+    int path = head->path;
+    if (!flow.paths.empty()) {
+        reportPathLoss(flow, head->path);
+        path = applyPacketSpraying(flow, retransmit);
     }
+    send(retransmit, "networkOut");
     
-    // Schedule next timeout check
-    if (!retransmissionBuffer.empty()) {
-        scheduleAt(simTime() + rdmaTimeout, rdmaTimer);
+    for (int i = 0; i < count; i++) {
+        RetransmissionEntry *entry = findUnacknowledged(flow, seqNum + i);
+        entry->retransmissionCount++;
+        entry->timestamp = simTime();
+        entry->path = path;
     }
+    armRetransmissionTimer(flow, seqNum, count, *head);
+    
+    emit(retransmissions, 1);
+    emit(packetsTransmitted, 1);
+    emit(trainLengthSignal, count);
 }
 
-void UETTransport::applyPacketSpraying(UETPacket *pkt) {
-    // Simple packet spraying: set spray path hint
-    pkt->setSprayPath(intuniform(0, 3));  // 4 possible paths
+void UETTransport::armRetransmissionTimer(const SendFlow& flow, int seqNum, int count, const RetransmissionEntry& entry) {
+    // Exponential backoff per retransmission of the same segments
+    simtime_t timeout = flow.rto;
+    for (int i = 0; i < entry.retransmissionCount && timeout < maxRto; i++) {
+        timeout *= 2;
+    }
+    if (timeout > maxRto) {
+        timeout = maxRto;
+    }
+    
+    simtime_t deadline = entry.timestamp + timeout;
+    rtoQueue.push(RtoDeadline{deadline, flow.destAddr, flow.flowId, seqNum, count, entry.retransmissionCount});
+    if (!rdmaTimer->isScheduled() || rdmaTimer->getArrivalTime() > deadline) {
+        rescheduleRdmaTimer();
+    }
 }
 
-void UETTransport::updateCongestionWindow(simtime_t rtt) {
-    // Simple congestion control based on RTT
-    static simtime_t baseRtt = 0.001;  // 1ms base RTT
+void UETTransport::rescheduleRdmaTimer() {
+    // Drop stale deadlines at the top so the timer only fires for live segments
+    while (!rtoQueue.empty() && !isPending(rtoQueue.top())) {
+        rtoQueue.pop();
+    }
     
-    if (rtt < baseRtt * 1.5) {
+    if (rtoQueue.empty()) {
+        cancelEvent(rdmaTimer);
+        return;
+    }
+    simtime_t next = rtoQueue.top().deadline;
+    if (rdmaTimer->isScheduled()) {
+        if (rdmaTimer->getArrivalTime() == next) {
+            return;
+        }
+        cancelEvent(rdmaTimer);
+    }
+    scheduleAt(next, rdmaTimer);
+}
+
+void UETTransport::updateRto(SendFlow& flow, simtime_t rtt) {
+    // Per peer, since peers one hop and five hops away share the module
+    if (flow.srtt == SIMTIME_ZERO) {
+        flow.srtt = rtt;
+        flow.rttVar = rtt / 2;
+    } else {
+        simtime_t delta = flow.srtt > rtt ? flow.srtt - rtt : rtt - flow.srtt;
+        flow.rttVar = flow.rttVar * 0.75 + delta * 0.25;
+        flow.srtt = flow.srtt * 0.875 + rtt * 0.125;
+    }
+    
+    flow.rto = flow.srtt + 4 * flow.rttVar;
+    if (flow.rto < minRto) flow.rto = minRto;
+    if (flow.rto > maxRto) flow.rto = maxRto;
+    emit(retransmissionTimeout, flow.rto);
+}
+
+int UETTransport::applyPacketSpraying(SendFlow& flow, UETPacket *pkt) {
+    // Round robin over the paths nobody has complained about lately
+    int numPaths = flow.paths.size();
+    simtime_t now = simTime();
+    int chosen = -1;
+    for (int i = 0; i < numPaths && chosen < 0; i++) {
+        int p = (flow.nextPath + i) % numPaths;
+        if (flow.paths[p].avoidUntil <= now) {
+            chosen = p;
+        }
+    }
+    
+    // All of them are flagged: take the one with the best record, scoring
+    // delay inflated by the ECN rate and recent losses
+    if (chosen < 0) {
+        double bestScore = 0;
+        for (int p = 0; p < numPaths; p++) {
+            const PathState& state = flow.paths[p];
+            simtime_t rtt = state.srtt > SIMTIME_ZERO ? state.srtt : flow.srtt;
+            double score = rtt.dbl() * (1 + state.ecnRate) * (1 + state.losses);
+            if (chosen < 0 || score < bestScore) {
+                chosen = p;
+                bestScore = score;
+            }
+        }
+    }
+    
+    flow.nextPath = (chosen + 1) % numPaths;
+    pkt->setSprayPath(flow.paths[chosen].entropy);
+    return chosen;
+}
+
+void UETTransport::updatePath(SendFlow& flow, int path, simtime_t rtt, bool ecnEcho) {
+    PathState& state = flow.paths[path];
+    state.losses = 0;
+    state.ecnRate = state.ecnRate * 0.875 + (ecnEcho ? 0.125 : 0);
+    if (rtt > SIMTIME_ZERO) {
+        state.srtt = state.srtt == SIMTIME_ZERO ? rtt : state.srtt * 0.875 + rtt * 0.125;
+    }
+    
+    // A mark or a sample well above the flow's floor moves traffic off the
+    // path for one RTT; the next clean sample after that lets it back in
+    bool congested = ecnEcho || (rtt > SIMTIME_ZERO && rtt > flow.minRtt * 2.0);
+    if (congested) {
+        state.avoidUntil = simTime() + flow.srtt;
+        emit(pathsAvoided, 1);
+    }
+}
+
+void UETTransport::reportPathLoss(SendFlow& flow, int path) {
+    PathState& state = flow.paths[path];
+    state.avoidUntil = simTime() + (flow.srtt > SIMTIME_ZERO ? flow.srtt : flow.rto);
+    emit(pathsAvoided, 1);
+    
+    // Repeated losses look like a failed route: draw a new entropy value so
+    // the switches hash this path somewhere else, and forget its history
+    if (++state.losses >= pathRerouteLosses) {
+        state.entropy = intuniform(1, 0xffff);
+        state.srtt = SIMTIME_ZERO;
+        state.ecnRate = 0;
+        state.losses = 0;
+        state.avoidUntil = SIMTIME_ZERO;
+        emit(pathsRerouted, 1);
+    }
+}
+
+void UETTransport::updateCongestionWindow(SendFlow& flow, simtime_t rtt) {
+    // Delay-based control against the lowest RTT seen on this flow, which
+    // stands in for the unloaded path delay
+    if (flow.minRtt == SIMTIME_ZERO || rtt < flow.minRtt) {
+        flow.minRtt = rtt;
+    }
+    
+    if (rtt < flow.minRtt * 1.5) {
         // Low RTT, increase window
-        congestionWindow = std::min(congestionWindow + 1, 64);
-    } else if (rtt > baseRtt * 2.0) {
+        flow.congestionWindow = std::min(flow.congestionWindow + 1, maxCongestionWindow);
+    } else if (rtt > flow.minRtt * 2.0) {
         // High RTT, decrease window
-        congestionWindow = std::max(congestionWindow - 1, 1);
+        flow.congestionWindow = std::max(flow.congestionWindow - 1, 1);
     }
+    emit(congestionWindowSignal, flow.congestionWindow);
 }
 
-int UETTransport::generateFlowId() {
-    // Simple flow ID generation
-    return (getParentModule()->isVector() ? getParentModule()->getIndex() : 0) * 10000 + intuniform(0, 9999);
+uint32_t UETTransport::generateFlowId() {
+    // A fresh id per context, so a receiver never mistakes a recreated
+    // context for the evicted one it may still hold
+    uint32_t node = getParentModule()->isVector() ? getParentModule()->getIndex() : 0;
+    return node * 10000 + contextsCreated++;
+}
+
+uint32_t UETTransport::getFlowId(int destAddr) {
+    Enter_Method_Silent();
+    SendFlow *existing = sendFlows.find(PdcTable<SendFlow>::makeKey(destAddr, 0));
+    if (existing) {
+        return existing->flowId;
+    }
+    auto reserved = fluidFlowIds.find(destAddr);
+    if (reserved == fluidFlowIds.end()) {
+        reserved = fluidFlowIds.emplace(destAddr, generateFlowId()).first;
+    }
+    return reserved->second;
+}
+
+void UETTransport::handlePdcSweep() {
+    simtime_t now = simTime();
+    
+    // A send context goes once it is idle with nothing queued or in flight
+    contextEvictions += sendFlows.evictIf([&](SendFlow& flow) {
+        bool sending = !flow.messages.empty() && flow.messages.back().sentSegments < flow.messages.back().numSegments;
+        if (!flow.sendQueue.empty() || sending || flow.inFlight > 0 || flow.pacingPending ||
+                now - flow.lastActivity < pdcIdleTimeout) {
+            return false;
+        }
+        // Messages left here had segments given up on
+        for (OutgoingMessage& message : flow.messages) {
+            message.record.release();
+        }
+        return true;
+    });
+    
+    // Receive contexts linger longer, so the sender always drops its side
+    // first and restarts with a new flowId
+    contextEvictions += receiveStates.evictIf([&](ReceiveState& rx) {
+        if (rx.pendingAcks > 0 || !rx.reorderWindow.empty() || now - rx.lastActivity < 4 * pdcIdleTimeout) {
+            return false;
+        }
+        // Partial messages left here lost segments for good
+        for (Reassembly& partial : rx.reassembly) {
+            delete partial.message;
+        }
+        return true;
+    });
+    
+    if (!sendFlows.empty() || !receiveStates.empty()) {
+        scheduleAt(now + pdcIdleTimeout, pdcSweepTimer);
+    }
 }
 
 void UETTransport::finish() {
     // Record final statistics
+    recordScalar("retransmissionPacketCopies", packetCopies);
+    recordScalar("retransmissionBufferPeak", peakRetransmissionEntries);
+    recordScalar("pdcPeakSendContexts", peakSendContexts);
+    recordScalar("pdcPeakReceiveContexts", peakReceiveContexts);
+    recordScalar("pdcEvictions", contextEvictions);
+    recordScalar("pdcTableBytes", sendFlows.getMemoryUsage() + receiveStates.getMemoryUsage());
 }
\ No newline at end of file
@@ -6,8 +6,15 @@
 #define __UET_TRANSPORT_H
 
 #include <omnetpp.h>
+#include <algorithm>
+#include <functional>
+#include <deque>
 #include <map>
 #include <queue>
+#include <vector>
+#include "PacketRecord.h"
+#include "PdcTable.h"
+#include "ReorderWindow.h"
 #include "UltraEthernetMsg_m.h"
 
 using namespace omnetpp;
@@ -24,10 +31,115 @@ enum TransportType {
     NACK = 2
 };
 
+// Sender state of one sequence number, i.e. one MTU segment
 struct RetransmissionEntry {
-    UETPacket* packet;
     simtime_t timestamp;
     int retransmissionCount;
+    bool acknowledged;          // selectively acknowledged or given up
+    int path;                   // index into SendFlow::paths of the last send
+};
+
+// Sender view of one spray path: the entropy value switches hash on and
+// what recent feedback says about the route it selects
+struct PathState {
+    uint16_t entropy;
+    simtime_t srtt;             // zero until the first sample
+    double ecnRate;             // EWMA of ECN echoes per RTT sample
+    int losses;                 // since the last acknowledged packet on it
+    simtime_t avoidUntil;
+};
+
+// Application message being segmented or waiting for acknowledgment.
+// Segments are rebuilt from the record whenever they are sent, so no
+// packet object is kept per segment.
+struct OutgoingMessage {
+    PacketRecord record;
+    uint32_t messageId;
+    int64_t length;             // bytes
+    int firstSeq;               // sequence number of segment 0
+    int numSegments;
+    int sentSegments;
+};
+
+// Width of the SACK bitmap carried in every ACK. A sender keeps its
+// unacknowledged sequence range within this span.
+static const int SACK_WINDOW = 64;
+
+// Sender context towards one destination, with its own sequence space.
+// Messages wait in sendQueue, then go out in trains of segments whenever
+// the window has room and the pacing gap since the last train is over.
+// retransmissionBuffer holds every segment from retransmissionBase on, so
+// a cumulative ACK retires a prefix.
+struct SendFlow {
+    int destAddr;
+    uint32_t flowId;            // fresh per context, see generateFlowId()
+    simtime_t lastActivity;
+    std::deque<UETPacket*> sendQueue;
+    std::deque<OutgoingMessage> messages;   // the last one may still be sending
+    uint32_t nextMessageId;
+    std::deque<RetransmissionEntry> retransmissionBuffer;
+    int retransmissionBase;
+    int nextSequenceNum;
+    int inFlight;
+    int congestionWindow;
+    simtime_t minRtt;           // zero until the first sample
+    simtime_t srtt;             // RFC 6298 estimate towards this peer, zero until the first sample
+    simtime_t rttVar;
+    simtime_t rto;              // rdmaTimeout until the first sample
+    simtime_t nextSendTime;
+    bool pacingPending;         // an entry for this flow is in pacingQueue
+    std::vector<PathState> paths;   // empty unless spraying
+    int nextPath;
+};
+
+// Message with some of its segments received; bit i of completed stands
+// for segment i
+struct Reassembly {
+    uint32_t messageId;
+    int numSegments;
+    int received;
+    std::vector<uint64_t> completed;
+    UETPacket *message;         // first packet to arrive, delivered once complete
+};
+
+// Receiver context for one (source, flowId). Everything below
+// cumulativeAck has arrived; bit i of sackBits stands for cumulativeAck + 1 + i.
+struct ReceiveState {
+    int srcAddr;
+    uint32_t flowId;
+    simtime_t lastActivity;
+    int cumulativeAck;
+    uint64_t sackBits;
+    int highestReceived;
+    int lastReceived;
+    simtime_t lastReceivedTime;     // arrival of lastReceived, to report how long its ACK was held
+    int pendingAcks;            // packets received since the last ACK
+    bool lastEcnMarked;
+    simtime_t ackDeadline;
+    std::vector<Reassembly> reassembly;
+    ReorderWindow reorderWindow;    // complete messages by messageId, when ordered
+};
+
+// Wakeup for one context; stale when the context moved on or is gone
+struct FlowEvent {
+    simtime_t time;
+    uint64_t key;
+    
+    bool operator>(const FlowEvent& other) const { return time > other.time; }
+};
+
+// Retransmission deadline of one train of segments. Acknowledged or re-armed
+// segments leave stale deadlines behind, recognized by retired entries or an
+// older generation (retransmissionCount at arming time).
+struct RtoDeadline {
+    simtime_t deadline;
+    int destAddr;
+    uint32_t flowId;
+    int seqNum;
+    int length;
+    int generation;
+    
+    bool operator>(const RtoDeadline& other) const { return deadline > other.deadline; }
 };
 
 class UETTransport : public cSimpleModule {
@@ -35,11 +147,22 @@ private:
     // Configuration parameters
     TransportProfileType profileType;
     bool packetSprayingEnabled;
+    int numSprayPaths;
+    int pathRerouteLosses;
     bool reorderingEnabled;
     int maxReorderBuffer;
-    int congestionWindow;
-    simtime_t rdmaTimeout;
+    int initialCongestionWindow;
+    int maxCongestionWindow;
+    bool pacingEnabled;
+    simtime_t rdmaTimeout;      // RTO of a flow until its first RTT sample
     int maxRetransmissions;
+    simtime_t minRto;
+    simtime_t maxRto;
+    int ackCoalesceCount;
+    simtime_t ackCoalesceDelay;
+    simtime_t pdcIdleTimeout;
+    int mtu;
+    int maxTrainLength;
     
     // Statistics
     simsignal_t packetsTransmitted;
@@ -47,36 +170,101 @@ private:
     simsignal_t retransmissions;
     simsignal_t congestionWindowSignal;
     simsignal_t roundTripTime;
+    simsignal_t retransmissionTimeout;
+    simsignal_t sendQueueLength;
+    simsignal_t sendQueueDelay;
+    simsignal_t acksSent;
+    simsignal_t nacksSent;
+    simsignal_t pathsAvoided;
+    simsignal_t pathsRerouted;
+    simsignal_t trainLengthSignal;
+    simsignal_t messagesReassembled;
+    simsignal_t flowsFailed;
+    simsignal_t messagesFailed;
+    long packetCopies;          // packet objects created for retransmission state
+    size_t peakRetransmissionEntries;
+    size_t peakSendContexts;
+    size_t peakReceiveContexts;
+    long contextEvictions;
     
     // Internal state
     cMessage *rdmaTimer;
-    int nextSequenceNum;
-    int expectedSequenceNum;
+    cMessage *pacingTimer;
+    cMessage *ackTimer;
+    cMessage *pdcSweepTimer;
+    uint32_t contextsCreated;
     
     // Buffers
-    std::map<int, UETPacket*> reorderBuffer;
-    std::map<int, RetransmissionEntry> retransmissionBuffer;
+    std::priority_queue<RtoDeadline, std::vector<RtoDeadline>, std::greater<RtoDeadline>> rtoQueue;
+    long retransmissionEntries;
+    
+    // Send path
+    PdcTable<SendFlow> sendFlows;       // keyed by (destAddr, 0)
+    std::map<int, uint32_t> fluidFlowIds;   // by destAddr, for flows that never open a context
+    std::priority_queue<FlowEvent, std::vector<FlowEvent>, std::greater<FlowEvent>> pacingQueue;
+    long queuedPackets;
+    
+    // Receive path
+    PdcTable<ReceiveState> receiveStates;   // keyed by (srcAddr, flowId)
+    std::priority_queue<FlowEvent, std::vector<FlowEvent>, std::greater<FlowEvent>> ackQueue;
     
     // Message processing
     void processFromApplication(UETPacket *pkt);
     void processFromNetwork(UETPacket *pkt);
     void processInOrderPacket(UETPacket *pkt);
-    void processReorderBuffer();
+    void processReorderBuffer(ReceiveState& rx);
+    void reassemble(ReceiveState& rx, UETPacket *pkt);
+    void completeMessage(ReceiveState& rx, UETPacket *message);
     void processAcknowledgment(UETPacket *ack);
     
+    // Receive path
+    ReceiveState& getReceiveState(int srcAddr, uint32_t flowId);
+    void recordReceived(ReceiveState& rx, int seqNum);
+    void handleAckTimer();
+    
+    // Send path
+    SendFlow& getSendFlow(int destAddr);
+    SendFlow *findSendFlow(int destAddr, uint32_t flowId);
+    void releasePackets(SendFlow& flow);
+    void failSendFlow(SendFlow& flow);
+    void startMessage(SendFlow& flow);
+    void transmitTrain(SendFlow& flow, OutgoingMessage& message, int count);
+    UETPacket *buildTrain(const OutgoingMessage& message, int seqNum, int count) const;
+    int segmentCount(int64_t length) const { return length > mtu ? (int)((length + mtu - 1) / mtu) : 1; }
+    void handlePacingTimer();
+    OutgoingMessage *findMessage(SendFlow& flow, int seqNum);
+    RetransmissionEntry *findUnacknowledged(SendFlow& flow, int seqNum);
+    void retireEntry(SendFlow& flow, RetransmissionEntry& entry);
+    void handlePdcSweep();
+    
     // RDMA operations
     void handleRdmaTimeout();
-    void sendAcknowledgment(int seqNum);
+    bool retransmitRange(SendFlow& flow, int first, int end, int generation, simtime_t minAge);
+    void retransmitTrain(SendFlow& flow, const OutgoingMessage& message, int seqNum, int count);
+    void armRetransmissionTimer(const SendFlow& flow, int seqNum, int count, const RetransmissionEntry& entry);
+    bool isPending(const RtoDeadline& due);
+    void rescheduleRdmaTimer();
+    void updateRto(SendFlow& flow, simtime_t rtt);
+    void sendAcknowledgment(ReceiveState& rx, TransportType type);
+    
+    // Multipath
+    bool isSpraying() const { return packetSprayingEnabled && profileType == AI_FULL; }
+    int applyPacketSpraying(SendFlow& flow, UETPacket *pkt);
+    void updatePath(SendFlow& flow, int path, simtime_t rtt, bool ecnEcho);
+    void reportPathLoss(SendFlow& flow, int path);
     
     // Advanced features
-    void applyPacketSpraying(UETPacket *pkt);
-    void updateCongestionWindow(simtime_t rtt);
-    int generateFlowId();
+    void updateCongestionWindow(SendFlow& flow, simtime_t rtt);
+    uint32_t generateFlowId();
     
 public:
     UETTransport();
     virtual ~UETTransport();
     
+    // flowId of the traffic to destAddr: the open context's, else one
+    // reserved for destAddr, so every destination hashes on its own id
+    uint32_t getFlowId(int destAddr);
+    
 protected:
     virtual void initialize() override;
     virtual void handleMessage(cMessage *msg) override;
@@ -8,6 +8,7 @@ Define_Module(UltraEthernetIP);
 
 UltraEthernetIP::UltraEthernetIP() {
     routingTimer = nullptr;
+    routeStatsEnabled = false;
 }
 
 UltraEthernetIP::~UltraEthernetIP() {
@@ -20,6 +21,7 @@ void UltraEthernetIP::initialize() {
     loadBalancingEnabled = par("loadBalancingEnabled").boolValue();
     routingTableSize = par("routingTableSize").intValue();
     routingUpdateInterval = par("routingUpdateInterval").doubleValue();
+    routeStatsEnabled = par("routeStatsEnabled").boolValue();
     
     // Initialize statistics
     packetsForwarded = registerSignal("packetsForwarded");
@@ -107,62 +109,74 @@ void UltraEthernetIP::processFromLink(UETPacket *pkt) {
 bool UltraEthernetIP::routePacket(UETPacket *pkt) {
     int dest = pkt->getDestAddr();
     
-    // Look up routing table
-    auto it = routingTable.find(dest);
-    if (it != routingTable.end()) {
-        RoutingEntry &entry = it->second;
-        
-        // Apply load balancing if enabled
-        if (loadBalancingEnabled && entry.nextHops.size() > 1) {
-            // Select next hop based on flow hash
-            int hopIndex = pkt->getFlowId() % entry.nextHops.size();
-            pkt->setPathId(entry.nextHops[hopIndex]);
-        } else if (!entry.nextHops.empty()) {
-            pkt->setPathId(entry.nextHops[0]);
-        }
-        
-        // Update routing statistics
-        entry.packetsForwarded++;
-        entry.lastUsed = simTime();
-        
-        return true;
+    // Look up routing table, falling back to the default route
+    const NextHopGroup *group = routingTable->lookup(dest);
+    if (!group) {
+        return false;
+    }
+    
+    // Apply load balancing if enabled
+    if (loadBalancingEnabled && group->count > 1) {
+        // Select next hop based on flow hash and per-packet entropy
+        int hopIndex = selectEcmpMember(pkt->getFlowId(), pkt->getSprayPath(), 0, group->count);
+        pkt->setPathId(group->hops[hopIndex]);
+    } else {
+        pkt->setPathId(group->hops[0]);
+    }
+    
+    // Update routing statistics
+    if (routeStatsEnabled) {
+        RouteStats& stats = getRouteStats(dest);
+        stats.packetsForwarded++;
+        stats.lastUsed = simTime();
     }
     
-    return false;
+    return true;
+}
+
+ForwardingTable& UltraEthernetIP::getWritableRoutingTable() {
+    // Copy on write: the first override detaches this node from the shared table
+    if (!privateRoutingTable) {
+        privateRoutingTable = routingTable ? std::make_shared<ForwardingTable>(*routingTable)
+                                           : std::make_shared<ForwardingTable>();
+        routingTable = privateRoutingTable;
+    }
+    return *privateRoutingTable;
+}
+
+RouteStats& UltraEthernetIP::getRouteStats(int destAddr) {
+    if ((unsigned)destAddr >= routeStats.size()) {
+        routeStats.resize(destAddr + 1, RouteStats{0, simTime()});
+    }
+    return routeStats[destAddr];
 }
 
 void UltraEthernetIP::initializeRoutingTable() {
     // Initialize basic routing table
     // In a real implementation, this would be populated by a routing protocol
     
+    // Topology-managed nodes already share a table computed by RouteService;
+    // local delivery is decided before routing, so no self entry is needed
+    if (routingTable) {
+        emit(routingTableSizeSignal, routingTable->size());
+        return;
+    }
+    
     int nodeIndex = getParentModule()->isVector() ? getParentModule()->getIndex() : 0;
+    ForwardingTable& table = getWritableRoutingTable();
     
     // Add entry for self
-    RoutingEntry selfEntry;
-    selfEntry.destAddr = nodeIndex;
-    selfEntry.nextHops.push_back(0);  // Local delivery
-    selfEntry.metric = 0;
-    selfEntry.packetsForwarded = 0;
-    selfEntry.lastUsed = simTime();
-    
-    routingTable[nodeIndex] = selfEntry;
+    table.setRoute(nodeIndex, {0}, 0);  // Local delivery
     
     // Add default entries for demonstration
     // In practice, these would be learned via routing protocols
     for (int i = 0; i < 10; i++) {
         if (i != nodeIndex) {
-            RoutingEntry entry;
-            entry.destAddr = i;
-            entry.nextHops.push_back(i % 4);  // Simple hash-based routing
-            entry.metric = 1;
-            entry.packetsForwarded = 0;
-            entry.lastUsed = simTime();
-            
-            routingTable[i] = entry;
+            table.setRoute(i, {i % 4}, 1);  // Simple hash-based routing
         }
     }
     
-    emit(routingTableSizeSignal, (int)routingTable.size());
+    emit(routingTableSizeSignal, table.size());
 }
 
 void UltraEthernetIP::updateRoutingTable() {
@@ -173,39 +187,41 @@ void UltraEthernetIP::updateRoutingTable() {
     // - Metric updates
     
     // For now, just update statistics
-    emit(routingTableSizeSignal, (int)routingTable.size());
+    emit(routingTableSizeSignal, routingTable->size());
     
-    // Age out old entries
-    auto it = routingTable.begin();
-    while (it != routingTable.end()) {
-        if (simTime() - it->second.lastUsed > 10.0) {  // 10 second timeout
-            it = routingTable.erase(it);
-        } else {
-            ++it;
+    // Age out old entries; usage is only known with route statistics on
+    if (!routeStatsEnabled) {
+        return;
+    }
+    for (int dest = 0; dest < routingTable->getCapacity(); dest++) {
+        if (routingTable->hasEntry(dest) && simTime() - getRouteStats(dest).lastUsed > 10.0) {  // 10 second timeout
+            getWritableRoutingTable().removeRoute(dest);
         }
     }
 }
 
 void UltraEthernetIP::addRoutingEntry(int destAddr, int nextHop, int metric) {
-    RoutingEntry entry;
-    entry.destAddr = destAddr;
-    entry.nextHops.push_back(nextHop);
-    entry.metric = metric;
-    entry.packetsForwarded = 0;
-    entry.lastUsed = simTime();
-    
-    routingTable[destAddr] = entry;
-    emit(routingTableSizeSignal, (int)routingTable.size());
+    ForwardingTable& table = getWritableRoutingTable();
+    table.setRoute(destAddr, {nextHop}, metric);
+    if (routeStatsEnabled) {
+        getRouteStats(destAddr) = RouteStats{0, simTime()};
+    }
+    emit(routingTableSizeSignal, table.size());
 }
 
 void UltraEthernetIP::removeRoutingEntry(int destAddr) {
-    auto it = routingTable.find(destAddr);
-    if (it != routingTable.end()) {
-        routingTable.erase(it);
-        emit(routingTableSizeSignal, (int)routingTable.size());
+    if (routingTable && routingTable->hasEntry(destAddr)) {
+        ForwardingTable& table = getWritableRoutingTable();
+        table.removeRoute(destAddr);
+        emit(routingTableSizeSignal, table.size());
     }
 }
 
+void UltraEthernetIP::setRoutingTable(std::shared_ptr<const ForwardingTable> table) {
+    routingTable = table;
+    privateRoutingTable = nullptr;
+}
+
 void UltraEthernetIP::finish() {
     // Record final statistics
 }
\ No newline at end of file
@@ -6,16 +6,15 @@
 #define __ULTRAETHERNET_IP_H
 
 #include <omnetpp.h>
-#include <map>
+#include <memory>
 #include <vector>
+#include "ForwardingTable.h"
 #include "UltraEthernetMsg_m.h"
 
 using namespace omnetpp;
 
-struct RoutingEntry {
-    int destAddr;
-    std::vector<int> nextHops;
-    int metric;
+// Per-destination usage, kept apart from the forwarding data
+struct RouteStats {
     int packetsForwarded;
     simtime_t lastUsed;
 };
@@ -27,6 +26,7 @@ private:
     bool loadBalancingEnabled;
     int routingTableSize;
     simtime_t routingUpdateInterval;
+    bool routeStatsEnabled;
     
     // Statistics
     simsignal_t packetsForwarded;
@@ -36,12 +36,18 @@ private:
     
     // Internal state
     cMessage *routingTimer;
-    std::map<int, RoutingEntry> routingTable;
+    // Read-only table shared through RouteService, or this node's private
+    // copy once a per-node override has been written
+    std::shared_ptr<const ForwardingTable> routingTable;
+    std::shared_ptr<ForwardingTable> privateRoutingTable;
+    std::vector<RouteStats> routeStats;  // indexed by destAddr, only if routeStatsEnabled
     
     // Routing functions
     void initializeRoutingTable();
     void updateRoutingTable();
     bool routePacket(UETPacket *pkt);
+    RouteStats& getRouteStats(int destAddr);
+    ForwardingTable& getWritableRoutingTable();
     
     // Message processing
     void processFromTransport(UETPacket *pkt);
@@ -55,6 +61,10 @@ public:
     void addRoutingEntry(int destAddr, int nextHop, int metric);
     void removeRoutingEntry(int destAddr);
     
+    // Shared table installed by UltraEthernetTopology during network setup,
+    // so it must not emit signals
+    void setRoutingTable(std::shared_ptr<const ForwardingTable> table);
+    
 protected:
     virtual void initialize() override;
     virtual void handleMessage(cMessage *msg) override;
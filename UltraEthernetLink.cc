@@ -3,19 +3,29 @@
 //
 
 #include "UltraEthernetLink.h"
+#include "UltraEthernetPhy.h"
 
 Define_Module(UltraEthernetLink);
 
 UltraEthernetLink::UltraEthernetLink() {
-    llrTimer = nullptr;
-    nextLlrSequence = 0;
-    expectedLlrSequence = 0;
+    phy = nullptr;
+    packetCopies = 0;
+    peakRetransmissionEntries = 0;
+    acksSent = 0;
+    nacksSent = 0;
+    llrGiveUps = 0;
+    backpressureStalls = 0;
 }
 
 UltraEthernetLink::~UltraEthernetLink() {
-    cancelAndDelete(llrTimer);
-    for (auto& entry : llrRetransmissionBuffer) {
-        delete entry.second.packet;
+    for (PortChannel& channel : channels) {
+        cancelAndDelete(channel.replayTimer);
+        cancelAndDelete(channel.ackTimer);
+        for (std::deque<UETPacket*>& lane : channel.waiting) {
+            for (UETPacket *pkt : lane) {
+                delete pkt;
+            }
+        }
     }
 }
 
@@ -24,8 +34,18 @@ void UltraEthernetLink::initialize() {
     llrEnabled = par("llrEnabled").boolValue();
     llrTimeout = par("llrTimeout").doubleValue();
     maxRetransmissions = par("maxRetransmissions").intValue();
-    priCompressionRatio = par("priCompressionRatio").doubleValue();
+    llrAckCoalesceCount = par("llrAckCoalesceCount").intValue();
+    llrAckDelay = par("llrAckDelay").doubleValue();
+    creditsEnabled = par("creditsEnabled").boolValue();
+    std::string mode = par("headerMode").stdstringValue();
+    if (mode == "none") headerMode = HEADERS_NONE;
+    else if (mode == "full") headerMode = HEADERS_FULL;
+    else if (mode == "pri") headerMode = HEADERS_PRI;
+    else throw cRuntimeError("Unknown headerMode '%s' (expected none, full or pri)", mode.c_str());
     linkLatency = par("linkLatency").doubleValue();
+    if ((llrEnabled || creditsEnabled) && llrAckDelay >= llrTimeout) {
+        throw cRuntimeError("llrAckDelay must be below llrTimeout");
+    }
     
     // Initialize statistics
     packetsTransmitted = registerSignal("packetsTransmitted");
@@ -33,15 +53,51 @@ void UltraEthernetLink::initialize() {
     llrRetransmissions = registerSignal("llrRetransmissions");
     compressionRatio = registerSignal("compressionRatio");
     linkUtilization = registerSignal("linkUtilization");
+    creditsConsumed = registerSignal("creditsConsumed");
+    backpressureStallTime = registerSignal("backpressureStallTime");
+    priContextMisses = registerSignal("priContextMisses");
+    priEvictions = registerSignal("priEvictions");
+    
+    phy = dynamic_cast<UltraEthernetPhy*>(getParentModule()->getSubmodule("phy"));
+    if (!llrEnabled && !creditsEnabled && headerMode == HEADERS_NONE) {
+        return;
+    }
     
-    // Initialize timer
-    llrTimer = new cMessage("llrTimer");
+    // The ring holds what the port sends in one timeout; an ACK that takes
+    // longer triggers a replay anyway
+    int64_t capacity = par("llrReplayBytes").intValue();
+    if (capacity <= 0) {
+        double speed = phy ? phy->par("linkSpeed").doubleValue() : 800e9;
+        capacity = (int64_t)(speed * llrTimeout.dbl() / 8);
+    }
+    int numLanes = creditsEnabled ? par("numVirtualLanes").intValue() : 1;
+    int numPorts = phy && phy->getNumPorts() > 1 ? phy->getNumPorts() : 1;
+    channels = std::vector<PortChannel>(numPorts);
+    for (int i = 0; i < numPorts; i++) {
+        PortChannel& channel = channels[i];
+        channel.replay.setCapacity(llrEnabled ? capacity : INT64_MAX);
+        channel.credits.init(numLanes, par("creditBuffer").intValue(), par("creditSize").intValue());
+        channel.waiting.resize(numLanes);
+        channel.stallStart.resize(numLanes);
+        channel.replaysWithoutProgress = 0;
+        channel.resyncPending = false;
+        channel.resyncSeq = 0;
+        channel.creditRefreshes = 0;
+        channel.compressor.init(par("priContexts").intValue(), llrEnabled ? 0 : par("priRefreshPackets").intValue());
+        channel.decompressor.init(par("priContexts").intValue());
+        channel.replayTimer = new cMessage("llrReplay", i);
+        channel.ackTimer = new cMessage("llrAck", i);
+    }
 }
 
 void UltraEthernetLink::handleMessage(cMessage *msg) {
     if (msg->isSelfMessage()) {
-        if (msg == llrTimer) {
-            handleLlrTimeout();
+        // Timers carry their port as the kind
+        PortChannel& channel = channels[msg->getKind()];
+        if (msg == channel.replayTimer) {
+            handleLlrTimeout(msg->getKind());
+        } else if (msg == channel.ackTimer) {
+            sendLlrAck(msg->getKind(), true);
         }
     } else {
         if (msg->getArrivalGate()->isName("networkIn")) {
@@ -57,29 +113,66 @@ void UltraEthernetLink::handleMessage(cMessage *msg) {
 }
 
 void UltraEthernetLink::processFromNetwork(UETPacket *pkt) {
-    // Apply PRI compression if enabled
-    if (priCompressionRatio > 0) {
-        applyPriCompression(pkt);
+    if (channels.empty()) {
+        sendToPhy(-1, pkt);
+        return;
     }
     
-    // Add LLR sequence number if enabled
-    if (llrEnabled) {
-        pkt->setAckSequence(nextLlrSequence++);
-        
-        // Store for potential retransmission
-        LlrRetransmissionEntry entry;
-        entry.packet = pkt->dup();
-        entry.timestamp = simTime();
-        entry.retransmissionCount = 0;
-        llrRetransmissionBuffer[pkt->getAckSequence()] = entry;
-        
-        // Schedule timeout if not already scheduled
-        if (!llrTimer->isScheduled()) {
-            scheduleAt(simTime() + llrTimeout, llrTimer);
+    // Sequence numbers and credits belong to one link, so the port is
+    // fixed up front
+    int port = channels.size() > 1 ? phy->selectPort(pkt) : 0;
+    PortChannel& channel = channels[port];
+    int lane = channel.credits.getLane(pkt);
+    if (!channel.waiting[lane].empty() || !canTransmit(channel, lane, pkt)) {
+        if (channel.waiting[lane].empty()) {
+            channel.stallStart[lane] = simTime();
         }
+        channel.waiting[lane].push_back(pkt);
+        return;
+    }
+    transmitFrame(port, pkt);
+}
+
+bool UltraEthernetLink::canTransmit(PortChannel& channel, int lane, UETPacket *pkt) {
+    return !channel.replay.isFull() &&
+            (!creditsEnabled || channel.credits.canSend(lane, channel.credits.getUnits(pkt)));
+}
+
+void UltraEthernetLink::transmitFrame(int port, UETPacket *pkt) {
+    PortChannel& channel = channels[port];
+    if (creditsEnabled) {
+        int64_t units = channel.credits.getUnits(pkt);
+        pkt->setCreditsSent(channel.credits.consume(channel.credits.getLane(pkt), units));
+        emit(creditsConsumed, units);
+    }
+    if (!llrEnabled) {
+        addHeaders(channel, pkt, false);
+        sendToPhy(port, pkt);
+        return;
+    }
+    
+    // Store for replay without copying the packet
+    bool copied;
+    uint32_t seq = channel.replay.push(pkt, copied);
+    if (copied) {
+        packetCopies++;
     }
+    pkt->setLlrSequence(seq);
+    pkt->setLlrResync(channel.resyncPending && seq == channel.resyncSeq);
+    peakRetransmissionEntries = std::max(peakRetransmissionEntries, channel.replay.getOutstanding());
     
-    // Send to physical layer
+    if (!channel.replayTimer->isScheduled()) {
+        channel.lastProgress = simTime();
+        scheduleAt(simTime() + llrTimeout, channel.replayTimer);
+    }
+    addHeaders(channel, pkt, false);
+    sendToPhy(port, pkt);
+}
+
+void UltraEthernetLink::sendToPhy(int port, cPacket *pkt) {
+    if (port >= 0 && channels.size() > 1) {
+        pkt->setControlInfo(new PhyPortTag(port));
+    }
     if (linkLatency > 0) {
         sendDelayed(pkt, linkLatency, "phyOut");
     } else {
@@ -93,143 +186,269 @@ void UltraEthernetLink::processFromNetwork(UETPacket *pkt) {
 void UltraEthernetLink::processFromPhy(cPacket *pkt) {
     emit(packetsReceived, 1);
     
+    int port = 0;
+    if (cObject *info = pkt->removeControlInfo()) {
+        port = check_and_cast<PhyPortTag*>(info)->port;
+        delete info;
+    }
+    
     // Check if this is an LLR acknowledgment
     LLRAck *llrAck = dynamic_cast<LLRAck*>(pkt);
     if (llrAck) {
-        processLlrAck(llrAck);
+        if (port < (int)channels.size()) {
+            processLlrAck(port, llrAck);
+        }
         delete llrAck;
         return;
     }
     
-    // Regular data packet
+    // Regular data packet; everything above sees the payload only
     UETPacket *uetPkt = check_and_cast<UETPacket*>(pkt);
-    
-    // Handle LLR if enabled
-    if (llrEnabled) {
-        if (uetPkt->getAckSequence() == expectedLlrSequence) {
-            // In-order packet
-            expectedLlrSequence++;
-            sendLlrAck(uetPkt->getAckSequence(), true);
-            
-            // Decompress if needed
-            if (priCompressionRatio > 0) {
-                applyPriDecompression(uetPkt);
-            }
-            
-            send(uetPkt, "networkOut");
-        } else if (uetPkt->getAckSequence() > expectedLlrSequence) {
-            // Out-of-order packet - request retransmission
-            sendLlrAck(expectedLlrSequence, false);
-            delete uetPkt;
-        } else {
-            // Duplicate packet - ack but drop
-            sendLlrAck(uetPkt->getAckSequence(), true);
-            delete uetPkt;
+    removeWireHeaders(uetPkt);
+    if (port < (int)channels.size()) {
+        PortChannel& channel = channels[port];
+        
+        // The host hands frames up at once, so credits come back with the
+        // next acknowledgment whatever happens to the frame
+        if (creditsEnabled) {
+            int lane = channel.credits.getLane(uetPkt);
+            channel.credits.receive(lane, uetPkt->getCreditsSent(), channel.credits.getUnits(uetPkt), false);
+            channel.creditRefreshes = maxRetransmissions;
         }
-    } else {
-        // No LLR, forward directly
-        if (priCompressionRatio > 0) {
-            applyPriDecompression(uetPkt);
+        
+        LlrReceiver::Verdict verdict = llrEnabled ?
+                channel.receiver.receive(uetPkt->getLlrSequence(), uetPkt->getLlrResync()) : LlrReceiver::DELIVER;
+        switch (verdict) {
+            case LlrReceiver::DELIVER:
+                scheduleLlrAck(port);
+                break;
+            case LlrReceiver::DUPLICATE:
+                // Ack again in case the peer missed it, but drop
+                scheduleLlrAck(port);
+                delete uetPkt;
+                return;
+            case LlrReceiver::GAP:
+                // Everything after a lost frame is discarded until the
+                // peer replays from the gap
+                if (!channel.receiver.nackSent) {
+                    channel.receiver.nackSent = true;
+                    sendLlrAck(port, false);
+                }
+                delete uetPkt;
+                return;
+        }
+        
+        // Contexts follow the frames in LLR order; a resynchronized peer
+        // starts them over
+        if (uetPkt->getLlrResync()) {
+            channel.decompressor.flush();
+        }
+        if (!channel.decompressor.decompress(uetPkt)) {
+            emit(priContextMisses, 1);
+            delete uetPkt;
+            return;
         }
-        send(uetPkt, "networkOut");
     }
+    send(uetPkt, "networkOut");
 }
 
-void UltraEthernetLink::processLlrAck(LLRAck *ack) {
-    int seqNum = ack->getAcknowledgedSeq();
+void UltraEthernetLink::processLlrAck(int port, LLRAck *ack) {
+    PortChannel& channel = channels[port];
+    if (creditsEnabled && (int)ack->getCreditLimitArraySize() == channel.credits.getNumLanes()) {
+        for (int lane = 0; lane < channel.credits.getNumLanes(); lane++) {
+            channel.credits.updateLimit(lane, ack->getCreditLimit(lane));
+        }
+    }
+    if (!llrEnabled) {
+        drainWaiting(port);
+        return;
+    }
     
-    if (ack->getAckType() == 0) {  // Positive ACK
-        // Remove from retransmission buffer
-        auto it = llrRetransmissionBuffer.find(seqNum);
-        if (it != llrRetransmissionBuffer.end()) {
-            delete it->second.packet;
-            llrRetransmissionBuffer.erase(it);
-        }
-    } else {  // Negative ACK (NACK)
-        // Retransmit immediately
-        auto it = llrRetransmissionBuffer.find(seqNum);
-        if (it != llrRetransmissionBuffer.end()) {
-            UETPacket *retransmit = it->second.packet->dup();
-            send(retransmit, "phyOut");
-            
-            it->second.retransmissionCount++;
-            it->second.timestamp = simTime();
-            
-            emit(llrRetransmissions, 1);
-            emit(packetsTransmitted, 1);
-        }
-    }
-}
-
-void UltraEthernetLink::sendLlrAck(int seqNum, bool positive) {
-    LLRAck *ack = new LLRAck("LLRAck");
-    ack->setAcknowledgedSeq(seqNum);
-    ack->setAckType(positive ? 0 : 1);
-    ack->setPathId(0);
+    // Both ACK and NACK cover every frame below seq
+    uint32_t seq = ack->getAcknowledgedSeq();
+    if (channel.replay.acknowledge(seq) > 0) {
+        channel.lastProgress = simTime();
+        channel.replaysWithoutProgress = 0;
+        if (channel.resyncPending && (int32_t)(seq - channel.resyncSeq) > 0) {
+            channel.resyncPending = false;
+        }
+    }
     
-    send(ack, "phyOut");
-    emit(packetsTransmitted, 1);
+    if (ack->getAckType() != 0) {
+        if ((int32_t)(seq - channel.replay.getBase()) < 0) {
+            // The peer waits for frames given up on; restart it at the base
+            channel.resyncPending = true;
+            channel.resyncSeq = channel.replay.getBase();
+        }
+        if (!channel.replay.isEmpty()) {
+            replayFrom(port, channel.replay.contains(seq) ? seq : channel.replay.getBase());
+        }
+    }
+    drainWaiting(port);
 }
 
-void UltraEthernetLink::handleLlrTimeout() {
-    // Check for timed-out packets
-    auto it = llrRetransmissionBuffer.begin();
-    while (it != llrRetransmissionBuffer.end()) {
-        if (simTime() - it->second.timestamp > llrTimeout) {
-            if (it->second.retransmissionCount < maxRetransmissions) {
-                // Retransmit packet
-                UETPacket *retransmit = it->second.packet->dup();
-                send(retransmit, "phyOut");
-                
-                it->second.retransmissionCount++;
-                it->second.timestamp = simTime();
-                
-                emit(llrRetransmissions, 1);
-                emit(packetsTransmitted, 1);
-                
-                ++it;
-            } else {
-                // Max retransmissions reached, drop packet
-                delete it->second.packet;
-                it = llrRetransmissionBuffer.erase(it);
+void UltraEthernetLink::replayFrom(int port, uint32_t seq) {
+    // Go-back-N: the peer dropped everything after the gap. Replays do not
+    // wait for credits; the peer's next advertisement returns the credits
+    // of the frames it discarded.
+    PortChannel& channel = channels[port];
+    for (; seq != channel.replay.getNext(); seq++) {
+        UETPacket *retransmit = channel.replay.rebuild(seq);
+        retransmit->setLlrResync(channel.resyncPending && seq == channel.resyncSeq);
+        addHeaders(channel, retransmit, true);
+        if (creditsEnabled) {
+            int64_t units = channel.credits.getUnits(retransmit);
+            retransmit->setCreditsSent(channel.credits.consume(channel.credits.getLane(retransmit), units));
+            emit(creditsConsumed, units);
+        }
+        packetCopies++;
+        sendToPhy(port, retransmit);
+        emit(llrRetransmissions, 1);
+    }
+    channel.lastProgress = simTime();
+}
+
+void UltraEthernetLink::drainWaiting(int port) {
+    // Lanes take turns one frame at a time, so none starves the others of
+    // room in the shared replay ring
+    PortChannel& channel = channels[port];
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (int lane = 0; lane < (int)channel.waiting.size(); lane++) {
+            std::deque<UETPacket*>& waiting = channel.waiting[lane];
+            if (waiting.empty() || !canTransmit(channel, lane, waiting.front())) {
+                continue;
+            }
+            UETPacket *pkt = waiting.front();
+            waiting.pop_front();
+            transmitFrame(port, pkt);
+            progress = true;
+            if (waiting.empty() && simTime() > channel.stallStart[lane]) {
+                emit(backpressureStallTime, simTime() - channel.stallStart[lane]);
+                backpressureStalls++;
             }
-        } else {
-            ++it;
         }
     }
-    
-    // Schedule next timeout check
-    if (!llrRetransmissionBuffer.empty()) {
-        scheduleAt(simTime() + llrTimeout, llrTimer);
+}
+
+void UltraEthernetLink::scheduleLlrAck(int port) {
+    // One cumulative ACK per llrAckCoalesceCount frames or llrAckDelay; a
+    // link with neither LLR nor credits has nothing to say
+    if (!llrEnabled && !creditsEnabled) {
+        return;
+    }
+    PortChannel& channel = channels[port];
+    if (llrEnabled && channel.receiver.unacknowledged >= llrAckCoalesceCount) {
+        sendLlrAck(port, true);
+    } else if (!channel.ackTimer->isScheduled()) {
+        scheduleAt(simTime() + llrAckDelay, channel.ackTimer);
+    } else if (channel.ackTimer->getArrivalTime() > simTime() + llrAckDelay) {
+        // Only a credit refresh was pending
+        cancelEvent(channel.ackTimer);
+        scheduleAt(simTime() + llrAckDelay, channel.ackTimer);
     }
 }
 
-void UltraEthernetLink::applyPriCompression(UETPacket *pkt) {
-    // Simulate PRI compression
-    int originalSize = pkt->getByteLength();
-    int compressedSize = (int)(originalSize * (1.0 - priCompressionRatio));
+void UltraEthernetLink::sendLlrAck(int port, bool positive) {
+    PortChannel& channel = channels[port];
+    LLRAck *ack = new LLRAck(positive ? "LLRAck" : "LLRNack");
+    ack->setByteLength(64);
+    ack->setAcknowledgedSeq(channel.receiver.expected);
+    ack->setAckType(positive ? 0 : 1);
+    ack->setPathId(port);
+    channel.receiver.unacknowledged = 0;
+    cancelEvent(channel.ackTimer);
     
-    pkt->setByteLength(compressedSize);
+    // Credit limits ride on every acknowledgment. A peer stalled on credits
+    // sends nothing that would prompt another one, so after the last frame
+    // the limit is repeated every llrTimeout, maxRetransmissions times.
+    if (creditsEnabled) {
+        ack->setCreditLimitArraySize(channel.credits.getNumLanes());
+        for (int lane = 0; lane < channel.credits.getNumLanes(); lane++) {
+            ack->setCreditLimit(lane, channel.credits.advertise(lane));
+        }
+        if (channel.creditRefreshes > 0) {
+            channel.creditRefreshes--;
+            scheduleAt(simTime() + llrTimeout, channel.ackTimer);
+        }
+    }
     
-    // Record compression statistics
-    double actualRatio = (double)(originalSize - compressedSize) / originalSize;
-    emit(compressionRatio, actualRatio);
+    sendToPhy(port, ack);
+    if (positive) {
+        acksSent++;
+    } else {
+        nacksSent++;
+    }
 }
 
-void UltraEthernetLink::applyPriDecompression(UETPacket *pkt) {
-    // Simulate PRI decompression
-    int compressedSize = pkt->getByteLength();
-    int originalSize = (int)(compressedSize / (1.0 - priCompressionRatio));
+void UltraEthernetLink::handleLlrTimeout(int port) {
+    // Armed while frames are outstanding; progress only moves the deadline.
+    // Frames still being serialized cannot have been acknowledged yet, so the
+    // timeout counts from when the port went quiet
+    PortChannel& channel = channels[port];
+    if (channel.replay.isEmpty()) {
+        return;
+    }
+    simtime_t quiet = channel.lastProgress;
+    if (phy && phy->getNumPorts() > 0) {
+        quiet = std::max(quiet, phy->getTransmitterFreeTime(port));
+    }
+    if (simTime() - quiet < llrTimeout) {
+        scheduleAt(quiet + llrTimeout, channel.replayTimer);
+        return;
+    }
     
-    pkt->setByteLength(originalSize);
+    if (++channel.replaysWithoutProgress > maxRetransmissions) {
+        // Give up on the outstanding frames; the transport recovers them and
+        // the next frame tells the peer to restart its sequence there
+        channel.replay.clear();
+        channel.replaysWithoutProgress = 0;
+        channel.resyncPending = true;
+        channel.resyncSeq = channel.replay.getNext();
+        channel.compressor.flush();
+        llrGiveUps++;
+        drainWaiting(port);
+        return;
+    }
+    replayFrom(port, channel.replay.getBase());
+    scheduleAt(simTime() + llrTimeout, channel.replayTimer);
+}
+
+void UltraEthernetLink::addHeaders(PortChannel& channel, UETPacket *pkt, bool replay) {
+    // The transport hands down payload only. Replays go with full headers,
+    // since the peer dropped the frames after the gap and its contexts are
+    // behind ours.
+    int64_t payload = pkt->getByteLength();
+    PriCompressor::Result result = addWireHeaders(pkt, headerMode, channel.compressor, replay);
+    if (result.context >= 0) {
+        if (result.evicted) {
+            emit(priEvictions, 1);
+        }
+        
+        // Share of the uncompressed frame saved
+        emit(compressionRatio, (double)(result.fullBytes - result.headerBytes) / (payload + result.fullBytes));
+    }
 }
 
 void UltraEthernetLink::updateLinkUtilization() {
-    // Calculate link utilization based on transmission queue size
-    double utilization = (double)llrRetransmissionBuffer.size() / 100.0;  // Normalized
+    // Calculate link utilization based on frames awaiting acknowledgment
+    int outstanding = 0;
+    for (const PortChannel& channel : channels) {
+        outstanding += channel.replay.getOutstanding();
+    }
+    double utilization = (double)outstanding / 100.0;  // Normalized
     emit(linkUtilization, utilization);
 }
 
 void UltraEthernetLink::finish() {
     // Record final statistics
+    recordScalar("llrPacketCopies", packetCopies);
+    recordScalar("llrBufferPeak", peakRetransmissionEntries);
+    recordScalar("llrAcksSent", acksSent);
+    recordScalar("llrNacksSent", nacksSent);
+    recordScalar("llrGiveUps", llrGiveUps);
+    if (creditsEnabled) {
+        recordScalar("backpressureStalls", backpressureStalls);
+    }
 }
\ No newline at end of file
@@ -6,24 +6,48 @@
 #define __ULTRAETHERNET_LINK_H
 
 #include <omnetpp.h>
-#include <map>
+#include <deque>
+#include <vector>
+#include "CreditFlowControl.h"
+#include "LlrReplayRing.h"
+#include "PriCompression.h"
 #include "UltraEthernetMsg_m.h"
 
 using namespace omnetpp;
 
-struct LlrRetransmissionEntry {
-    UETPacket* packet;
-    simtime_t timestamp;
-    int retransmissionCount;
-};
+class UltraEthernetPhy;
 
 class UltraEthernetLink : public cSimpleModule {
 private:
+    // Link-level retry, credits and header contexts per PHY port; each port is a link of its
+    // own with its own peer
+    struct PortChannel {
+        LlrReplayRing replay;
+        std::vector<std::deque<UETPacket*>> waiting;  // per lane, frames held for the ring or credits
+        std::vector<simtime_t> stallStart;
+        simtime_t lastProgress;             // last ACK progress or replay
+        int replaysWithoutProgress;
+        bool resyncPending;                 // gave up on frames the peer still expects
+        uint32_t resyncSeq;
+        cMessage *replayTimer;
+        
+        LlrReceiver receiver;
+        CreditState credits;
+        int creditRefreshes;                // repeats left for an advertisement that may be lost
+        cMessage *ackTimer;
+        
+        PriCompressor compressor;
+        PriDecompressor decompressor;
+    };
+    
     // Configuration parameters
     bool llrEnabled;
     simtime_t llrTimeout;
     int maxRetransmissions;
-    double priCompressionRatio;
+    int llrAckCoalesceCount;
+    simtime_t llrAckDelay;
+    bool creditsEnabled;
+    HeaderMode headerMode;
     simtime_t linkLatency;
     
     // Statistics
@@ -32,25 +56,38 @@ private:
     simsignal_t llrRetransmissions;
     simsignal_t compressionRatio;
     simsignal_t linkUtilization;
+    simsignal_t creditsConsumed;
+    simsignal_t backpressureStallTime;
+    simsignal_t priContextMisses;
+    simsignal_t priEvictions;
     
     // Internal state
-    cMessage *llrTimer;
-    int nextLlrSequence;
-    int expectedLlrSequence;
-    std::map<int, LlrRetransmissionEntry> llrRetransmissionBuffer;
+    UltraEthernetPhy *phy;
+    std::vector<PortChannel> channels;
+    long packetCopies;          // packet objects created for replay state
+    int peakRetransmissionEntries;
+    long acksSent;
+    long nacksSent;
+    long llrGiveUps;
+    long backpressureStalls;
     
     // Message processing
     void processFromNetwork(UETPacket *pkt);
     void processFromPhy(cPacket *pkt);
-    void processLlrAck(LLRAck *ack);
+    void processLlrAck(int port, LLRAck *ack);
     
-    // LLR operations
-    void sendLlrAck(int seqNum, bool positive);
-    void handleLlrTimeout();
+    // LLR and credit operations
+    bool canTransmit(PortChannel& channel, int lane, UETPacket *pkt);
+    void transmitFrame(int port, UETPacket *pkt);
+    void sendToPhy(int port, cPacket *pkt);
+    void replayFrom(int port, uint32_t seq);
+    void drainWaiting(int port);
+    void scheduleLlrAck(int port);
+    void sendLlrAck(int port, bool positive);
+    void handleLlrTimeout(int port);
     
-    // PRI compression
-    void applyPriCompression(UETPacket *pkt);
-    void applyPriDecompression(UETPacket *pkt);
+    // Wire headers and PRI compression
+    void addHeaders(PortChannel& channel, UETPacket *pkt, bool replay);
     
     // Statistics
     void updateLinkUtilization();
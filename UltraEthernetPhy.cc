@@ -3,15 +3,27 @@
 //
 
 #include "UltraEthernetPhy.h"
+#include "FluidNetwork.h"
+#include "ForwardingTable.h"
 
 Define_Module(UltraEthernetPhy);
 
 UltraEthernetPhy::UltraEthernetPhy() {
-    transmissionTimer = nullptr;
+    nextStripe = 0;
+    packetsSent = 0;
+    timerEvents = 0;
+    burstPackets = 0;
+    fluid = nullptr;
 }
 
 UltraEthernetPhy::~UltraEthernetPhy() {
-    cancelAndDelete(transmissionTimer);
+    for (Port& port : ports) {
+        cancelAndDelete(port.resumeTimer);
+        while (!port.pausedQueue.empty()) {
+            delete port.pausedQueue.front();
+            port.pausedQueue.pop();
+        }
+    }
 }
 
 void UltraEthernetPhy::initialize() {
@@ -19,23 +31,72 @@ void UltraEthernetPhy::initialize() {
     linkSpeed = par("linkSpeed").doubleValue();
     fecOverhead = par("fecOverhead").doubleValue();
     errorRate = par("errorRate").doubleValue();
-    fecCorrectionBits = par("fecCorrectionBits").intValue();
+    fecCorrectableSymbols = par("fecCorrectableSymbols").intValue();
     fecEnabled = par("fecEnabled").boolValue();
+    burstErrorsEnabled = par("burstErrorsEnabled").boolValue();
+    burstErrorRate = par("burstErrorRate").doubleValue();
+    meanGoodTime = par("meanGoodTime").doubleValue();
+    meanBurstTime = par("meanBurstTime").doubleValue();
+    if (burstErrorsEnabled && (meanGoodTime <= 0 || meanBurstTime <= 0)) {
+        throw cRuntimeError("meanGoodTime and meanBurstTime must be positive");
+    }
+    
+    int maxCorrectable = (ChannelErrorModel::CODEWORD_SYMBOLS - ChannelErrorModel::DATA_SYMBOLS) / 2;
+    if (fecCorrectableSymbols < 0 || fecCorrectableSymbols > maxCorrectable) {
+        throw cRuntimeError("fecCorrectableSymbols must be between 0 and %d symbols for RS(544,514)", maxCorrectable);
+    }
+    
+    // Error probabilities per packet length, so a received packet costs one
+    // draw and one lookup; longer trains extend the tables on first use
+    int64_t maxBits = par("errorTableMaxBytes").intValue() * 8;
+    channel.build(errorRate, fecCorrectableSymbols, fecEnabled, maxBits);
+    if (burstErrorsEnabled) {
+        burstChannel.build(burstErrorRate, fecCorrectableSymbols, fecEnabled, maxBits);
+    }
+    
+    std::string selection = par("portSelection").stdstringValue();
+    if (selection == "stripe") {
+        portSelection = PORT_STRIPE;
+    } else if (selection == "flowHash") {
+        portSelection = PORT_FLOW_HASH;
+    } else if (selection == "pathId") {
+        portSelection = PORT_PATH_ID;
+    } else {
+        throw cRuntimeError("Unknown portSelection '%s'", selection.c_str());
+    }
     
     // Initialize statistics
     fecCorrections = registerSignal("fecCorrections");
     uncorrectableErrors = registerSignal("uncorrectableErrors");
     linkUtilization = registerSignal("linkUtilization");
+    portSelected = registerSignal("portSelected");
+    
+    cModule *network = getSimulation()->getSystemModule();
+    fluid = network ? dynamic_cast<FluidNetwork*>(network->getSubmodule("fluid")) : nullptr;
+    if (fluid && !(fluid->isEnabled() && getParentModule()->isVector())) {
+        fluid = nullptr;
+    }
     
-    // Initialize transmission timer
-    transmissionTimer = new cMessage("transmissionTimer");
+    // Resume timers are only needed while PFC holds packets back
+    ports.resize(gateSize("ethOut"));
+    for (int i = 0; i < (int)ports.size(); i++) {
+        Port& port = ports[i];
+        port.packetsSent = 0;
+        port.resumeTimer = new cMessage("pfcResume", i);
+        port.fluidLink = fluid ? fluid->findHostLink(getParentModule()->getIndex(), i) : -1;
+        port.inBurst = false;
+        port.burstStateEnd = burstErrorsEnabled ? exponential(meanGoodTime) : SIMTIME_ZERO;
+        if (gate("ethOut", i)->isConnected()) {
+            connectedPorts.push_back(i);
+        }
+    }
 }
 
 void UltraEthernetPhy::handleMessage(cMessage *msg) {
     if (msg->isSelfMessage()) {
-        if (msg == transmissionTimer) {
-            scheduleNextTransmission();
-        }
+        // Resume timers carry their port as the kind
+        timerEvents++;
+        resumeTransmission(msg->getKind());
     } else {
         cPacket *pkt = check_and_cast<cPacket*>(msg);
         
@@ -43,8 +104,24 @@ void UltraEthernetPhy::handleMessage(cMessage *msg) {
             // Packet from link layer - transmit
             processTransmission(pkt);
         } else if (msg->getArrivalGate()->isName("ethIn")) {
+            // PFC frames pause or resume the port they arrive on
+            if (PfcFrame *pfc = dynamic_cast<PfcFrame*>(pkt)) {
+                Port& port = ports[msg->getArrivalGate()->getIndex()];
+                port.pausedUntil = simTime() + pfc->getPauseTime();
+                delete pfc;
+                if (!port.pausedQueue.empty()) {
+                    cancelEvent(port.resumeTimer);
+                    scheduleAt(port.pausedUntil, port.resumeTimer);
+                }
+                return;
+            }
+            
             // Packet from network - receive
-            if (simulateChannelErrors(pkt)) {
+            int index = msg->getArrivalGate()->getIndex();
+            if (simulateChannelErrors(index, pkt)) {
+                if (ports.size() > 1) {
+                    pkt->setControlInfo(new PhyPortTag(index));
+                }
                 send(pkt, "linkOut");
             } else {
                 // Packet dropped due to uncorrectable errors
@@ -59,80 +136,203 @@ void UltraEthernetPhy::handleMessage(cMessage *msg) {
 }
 
 void UltraEthernetPhy::processTransmission(cPacket *pkt) {
-    // Apply FEC encoding if enabled
-    if (fecEnabled) {
-        applyFEC(pkt);
+    if (connectedPorts.empty()) {
+        delete pkt;
+        return;
+    }
+    int index;
+    if (PhyPortTag *tag = dynamic_cast<PhyPortTag*>(pkt->getControlInfo())) {
+        index = tag->port;
+        delete pkt->removeControlInfo();
+    } else {
+        index = selectPort(pkt);
     }
+    emit(portSelected, index);
     
-    // Calculate transmission delay
-    double bits = pkt->getBitLength() * (1.0 + fecOverhead);
-    simtime_t txDelay = bits / linkSpeed;
+    // Behind a pause, or behind packets already waiting for it to end
+    Port& port = ports[index];
+    if (simTime() < port.pausedUntil || !port.pausedQueue.empty()) {
+        port.pausedQueue.push(pkt);
+        if (!port.resumeTimer->isScheduled()) {
+            scheduleAt(port.pausedUntil, port.resumeTimer);
+        }
+        return;
+    }
+    serialize(index, pkt);
+}
+
+int UltraEthernetPhy::selectPort(cPacket *pkt) {
+    Enter_Method_Silent();
+    int count = connectedPorts.size();
+    if (count == 0) {
+        return 0;
+    }
+    if (count == 1) {
+        return connectedPorts[0];
+    }
     
-    // Schedule transmission
-    transmissionQueue.push(pkt);
-    if (!transmissionTimer->isScheduled()) {
-        scheduleAt(simTime() + txDelay, transmissionTimer);
+    // Link-level frames carry no flow and are striped like any packet
+    UETPacket *uet = dynamic_cast<UETPacket*>(pkt);
+    if (uet && portSelection == PORT_FLOW_HASH) {
+        return connectedPorts[selectEcmpMember(uet->getFlowId(), 0, 0, count)];
+    }
+    if (uet && portSelection == PORT_PATH_ID) {
+        // The network layer hashed flowId and sprayPath over the NIC ports
+        int port = uet->getPathId();
+        if (port < (int)ports.size() && gate("ethOut", port)->isConnected()) {
+            return port;
+        }
+        return connectedPorts[port % count];
     }
     
-    // Update utilization statistics
-    updateLinkUtilization();
+    // The port that can start soonest; ties rotate so idle ports share load
+    int best = -1;
+    simtime_t bestStart;
+    for (int i = 0; i < count; i++) {
+        int index = connectedPorts[(nextStripe + i) % count];
+        const Port& port = ports[index];
+        simtime_t start = std::max(port.txFinishTime, port.pausedUntil);
+        if (best < 0 || start < bestStart) {
+            best = index;
+            bestStart = start;
+        }
+    }
+    nextStripe = (nextStripe + 1) % count;
+    return best;
 }
 
-bool UltraEthernetPhy::simulateChannelErrors(cPacket *pkt) {
-    if (!fecEnabled) return true;
-    
-    // Simulate bit errors based on packet size and error rate
-    double packetErrorProb = 1.0 - pow(1.0 - errorRate, pkt->getBitLength());
+void UltraEthernetPhy::serialize(int index, cPacket *pkt) {
+    Port& port = ports[index];
+    simtime_t now = simTime();
+    simtime_t start = port.txFinishTime > now ? port.txFinishTime : now;
     
-    if (uniform(0, 1) < packetErrorProb) {
-        // Simulate FEC correction
-        int errorBits = geometric(errorRate);
-        if (errorBits <= fecCorrectionBits) {
-            emit(fecCorrections, errorBits);
-            return true;  // Correctable
-        } else {
-            return false; // Uncorrectable
+    // Fluid flows leave packets only what they do not use of the link, and
+    // a packet first waits behind the fluid packets already queued
+    double rate = linkSpeed;
+    if (port.fluidLink >= 0) {
+        FluidBackground background = fluid->getBackground(port.fluidLink);
+        rate *= 1 - background.utilization;
+        if (now + background.queueingDelay > start) {
+            start = now + background.queueingDelay;
         }
     }
     
-    return true;  // No errors
+    // The peer sees the packet once its last coded bit is on the wire
+    simtime_t duration = codedBits(pkt) / rate;
+    port.txFinishTime = start + duration;
+    port.busyTime += duration;
+    port.packetsSent++;
+    packetsSent++;
+    
+    sendDelayed(pkt, port.txFinishTime - now, "ethOut", index);
+    updateLinkUtilization(now);
 }
 
-void UltraEthernetPhy::applyFEC(cPacket *pkt) {
-    // Add FEC overhead to packet
-    int originalBits = pkt->getBitLength();
-    int fecBits = (int)(originalBits * fecOverhead);
-    pkt->setBitLength(originalBits + fecBits);
+void UltraEthernetPhy::resumeTransmission(int index) {
+    // A pause refreshed meanwhile keeps the packets waiting
+    Port& port = ports[index];
+    if (simTime() < port.pausedUntil) {
+        scheduleAt(port.pausedUntil, port.resumeTimer);
+        return;
+    }
+    while (!port.pausedQueue.empty()) {
+        cPacket *pkt = port.pausedQueue.front();
+        port.pausedQueue.pop();
+        serialize(index, pkt);
+    }
 }
 
-void UltraEthernetPhy::scheduleNextTransmission() {
-    if (!transmissionQueue.empty()) {
-        cPacket *pkt = transmissionQueue.front();
-        transmissionQueue.pop();
-        
-        // Send on first ethernet port if available, otherwise drop
-        if (gateSize("ethOut") > 0) {
-            send(pkt, "ethOut", 0);
-        } else {
-            // No external connections, drop packet
-            delete pkt;
+simtime_t UltraEthernetPhy::getTransmitterFreeTime(int index) const {
+    const Port& port = ports[index];
+    if (!port.pausedQueue.empty() && port.pausedUntil > port.txFinishTime) {
+        return port.pausedUntil;
+    }
+    return port.txFinishTime;
+}
+
+simtime_t UltraEthernetPhy::getBacklog() {
+    // Serialization time handed to the ports that is not on the wire yet
+    simtime_t now = simTime();
+    simtime_t backlog = SIMTIME_ZERO;
+    for (Port& port : ports) {
+        if (port.txFinishTime > now) {
+            backlog += port.txFinishTime - now;
         }
-        
-        if (!transmissionQueue.empty()) {
-            cPacket *nextPkt = transmissionQueue.front();
-            double bits = nextPkt->getBitLength();
-            simtime_t txDelay = bits / linkSpeed;
-            scheduleAt(simTime() + txDelay, transmissionTimer);
+    }
+    return backlog;
+}
+
+int UltraEthernetPhy::getPausedPackets() {
+    int paused = 0;
+    for (Port& port : ports) {
+        paused += port.pausedQueue.size();
+    }
+    return paused;
+}
+
+bool UltraEthernetPhy::simulateChannelErrors(int index, cPacket *pkt) {
+    ChannelErrorModel *model = &channel;
+    if (burstErrorsEnabled) {
+        // Alternate exponential good and burst periods up to now
+        Port& port = ports[index];
+        simtime_t now = simTime();
+        while (port.burstStateEnd <= now) {
+            port.inBurst = !port.inBurst;
+            port.burstStateEnd += exponential(port.inBurst ? meanBurstTime : meanGoodTime);
+        }
+        if (port.inBurst) {
+            model = &burstChannel;
+            burstPackets++;
         }
     }
+    
+    switch (model->classify(pkt->getBitLength(), uniform(0, 1))) {
+        case ChannelErrorModel::UNCORRECTABLE:
+            return false;
+        case ChannelErrorModel::CORRECTED:
+            emit(fecCorrections, 1);
+            return true;
+        default:
+            return true;
+    }
+}
+
+double UltraEthernetPhy::codedBits(const cPacket *pkt) const {
+    // FEC parity costs wire time; the packet itself keeps its length
+    return pkt->getBitLength() * (fecEnabled ? 1.0 + fecOverhead : 1.0);
 }
 
-void UltraEthernetPhy::updateLinkUtilization() {
-    // Calculate and emit link utilization
-    double utilization = (double)transmissionQueue.size() / 100.0;  // Normalized
-    emit(linkUtilization, utilization);
+void UltraEthernetPhy::updateLinkUtilization(simtime_t now) {
+    // Share of the time since the start the connected ports were serializing
+    if (now > SIMTIME_ZERO) {
+        simtime_t busy = SIMTIME_ZERO;
+        for (int index : connectedPorts) {
+            busy += ports[index].busyTime;
+        }
+        emit(linkUtilization, std::min(1.0, busy / (now * (double)connectedPorts.size())));
+    }
 }
 
 void UltraEthernetPhy::finish() {
-    // Record final statistics
+    // Everything the transmitter does shows up as packet arrivals from the
+    // link layer plus the resume events of PFC pauses
+    recordScalar("phyPacketsSent", packetsSent);
+    recordScalar("phyTimerEvents", timerEvents);
+    if (packetsSent > 0) {
+        recordScalar("phyEventsPerPacket", (double)(packetsSent + timerEvents) / packetsSent);
+    }
+    recordScalar("phyBacklogTime", getBacklog());
+    recordScalar("phyPausedPackets", getPausedPackets());
+    recordScalar("phyConnectedPorts", connectedPorts.size());
+    recordScalar("phyCodewordFailure", channel.getCodewordFailure());
+    if (burstErrorsEnabled) {
+        recordScalar("phyBurstPackets", burstPackets);
+    }
+    if (connectedPorts.size() > 1) {
+        for (int index : connectedPorts) {
+            char name[32];
+            snprintf(name, sizeof(name), "phyPort%dPacketsSent", index);
+            recordScalar(name, ports[index].packetsSent);
+        }
+    }
 }
\ No newline at end of file
@@ -7,32 +7,99 @@
 
 #include <omnetpp.h>
 #include <queue>
+#include <vector>
+#include "ChannelErrorModel.h"
 #include "UltraEthernetMsg_m.h"
 
 using namespace omnetpp;
 
+class FluidNetwork;
+
+// How the NIC picks one of its ports for a packet
+enum PortSelection {
+    PORT_STRIPE,        // per packet, the port that frees up first
+    PORT_FLOW_HASH,     // per flow, hashed over the connected ports
+    PORT_PATH_ID        // the port the network layer chose (pathId)
+};
+
+// Port of a frame between the link layer and the PHY, as control info: the
+// link layer pins frames under link-level retry to a port, and received
+// frames report the port they arrived on
+class PhyPortTag : public cObject {
+public:
+    int port;
+    explicit PhyPortTag(int port) : port(port) {}
+};
+
 class UltraEthernetPhy : public cSimpleModule {
 private:
+    // Analytic serializer of one port: every packet leaves with the delay to
+    // the end of its own serialization, so the transmitter costs no events
+    // and keeps no per-packet state.
+    struct Port {
+        simtime_t txFinishTime;
+        simtime_t busyTime;
+        long packetsSent;
+        
+        // Packets arriving during a PFC pause wait for one resume event;
+        // frames already handed to the serializer are not recalled
+        simtime_t pausedUntil;
+        std::queue<cPacket*> pausedQueue;
+        cMessage *resumeTimer;
+        
+        int fluidLink;
+        
+        // Gilbert-Elliott state of the receive direction, switched lazily
+        // when a packet arrives after the state's end
+        bool inBurst;
+        simtime_t burstStateEnd;
+    };
+    
     // Configuration parameters
-    double linkSpeed;           // 800G/1600G
+    double linkSpeed;           // 800G/1600G, per port
     double fecOverhead;         // FEC coding overhead  
     double errorRate;           // Base bit error rate
-    int fecCorrectionBits;      // FEC correction capability
+    int fecCorrectableSymbols;  // Symbols FEC corrects per codeword
     bool fecEnabled;
+    bool burstErrorsEnabled;
+    double burstErrorRate;      // Bit error rate inside a burst
+    double meanGoodTime;        // seconds
+    double meanBurstTime;
+    PortSelection portSelection;
     
     // Statistics
     simsignal_t fecCorrections;
     simsignal_t uncorrectableErrors;
     simsignal_t linkUtilization;
+    simsignal_t portSelected;
+    
+    // Packet outcomes by length, outside and inside error bursts
+    ChannelErrorModel channel;
+    ChannelErrorModel burstChannel;
+    long burstPackets;
+    
+    // One serializer per connected ethOut gate
+    std::vector<Port> ports;
+    std::vector<int> connectedPorts;
+    int nextStripe;
+    long packetsSent;
+    long timerEvents;
     
-    // Performance optimization
-    cMessage *transmissionTimer;
-    std::queue<cPacket*> transmissionQueue;
+    // Hybrid mode: fluid flows leaving this host share the NIC links
+    FluidNetwork *fluid;
     
 public:
     UltraEthernetPhy();
     virtual ~UltraEthernetPhy();
     
+    int getNumPorts() const { return ports.size(); }
+    
+    // When the port has serialized everything handed to it, pauses included
+    simtime_t getTransmitterFreeTime(int port) const;
+    
+    // Port the selection policy picks for pkt, for callers that pin it
+    int selectPort(cPacket *pkt);
+    
 protected:
     virtual void initialize() override;
     virtual void handleMessage(cMessage *msg) override;
@@ -40,13 +107,15 @@ protected:
     
     // Core functionality
     void processTransmission(cPacket *pkt);
-    bool simulateChannelErrors(cPacket *pkt);
-    void applyFEC(cPacket *pkt);
-    void scheduleNextTransmission();
+    void serialize(int port, cPacket *pkt);
+    bool simulateChannelErrors(int port, cPacket *pkt);
+    double codedBits(const cPacket *pkt) const;
+    void resumeTransmission(int port);
+    simtime_t getBacklog();
+    int getPausedPackets();
     
     // Performance measurement
-    void updateLinkUtilization();
-    void recordErrorStatistics(bool corrected);
+    void updateLinkUtilization(simtime_t now);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,609 @@
+//
+// UltraEthernetTopology.cc - Programmatic topology builder implementation
+//
+
+#include "UltraEthernetTopology.h"
+#include "RouteService.h"
+#include "UltraEthernetIP.h"
+#include "SwitchFabric.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+Define_Module(UltraEthernetTopology);
+
+//
+// TopologyPlan
+//
+
+TopologyPlan::TopologyPlan() {
+    kind = TOPO_DRAGONFLY;
+    numNodes = 0;
+    radix = 0;
+    numRails = 1;
+    planeThreeTier = false;
+    half = 0;
+    numLeaves = 0;
+    numSpines = 0;
+    numPods = 0;
+    planeSwitches = 0;
+    dfHostsPerRouter = 0;
+    dfRoutersPerGroup = 0;
+    dfGlobalPerRouter = 0;
+    dfGroups = 0;
+    dfLinksPerPair = 0;
+}
+
+TopologyKind TopologyPlan::parseKind(const std::string& topologyType) {
+    if (topologyType == "DRAGONFLY") return TOPO_DRAGONFLY;
+    if (topologyType == "FAT_TREE_2TIER") return TOPO_FAT_TREE_2TIER;
+    if (topologyType == "FAT_TREE_3TIER") return TOPO_FAT_TREE_3TIER;
+    if (topologyType == "RAIL_OPTIMIZED") return TOPO_RAIL_OPTIMIZED;
+    throw std::invalid_argument("Unknown topologyType '" + topologyType +
+            "' (expected DRAGONFLY, FAT_TREE_2TIER, FAT_TREE_3TIER or RAIL_OPTIMIZED)");
+}
+
+void TopologyPlan::configure(const std::string& topologyType, int numNodes, int radix, int numRails) {
+    this->kind = parseKind(topologyType);
+    this->numNodes = numNodes;
+    this->radix = radix;
+    this->numRails = numRails;
+
+    if (numNodes <= 0)
+        throw std::invalid_argument("numNodes must be positive");
+    if (radix < 4 || radix % 4 != 0)
+        throw std::invalid_argument("switchRadix must be a positive multiple of 4");
+
+    half = radix / 2;
+
+    switch (kind) {
+        case TOPO_DRAGONFLY: {
+            // Balanced Dragonfly: a = 2p = 2h, radix = p + (a - 1) + h + 1 spare
+            dfHostsPerRouter = radix / 4;
+            dfGlobalPerRouter = radix / 4;
+            dfRoutersPerGroup = radix / 2;
+            int hostsPerGroup = dfRoutersPerGroup * dfHostsPerRouter;
+            dfGroups = (numNodes + hostsPerGroup - 1) / hostsPerGroup;
+            int globalPerGroup = dfRoutersPerGroup * dfGlobalPerRouter;
+            if (dfGroups > globalPerGroup + 1)
+                throw std::invalid_argument("Dragonfly with radix " + std::to_string(radix) +
+                        " supports at most " + std::to_string((globalPerGroup + 1) * hostsPerGroup) + " nodes");
+            dfLinksPerPair = dfGroups > 1 ? globalPerGroup / (dfGroups - 1) : 0;
+            break;
+        }
+        case TOPO_FAT_TREE_2TIER:
+            computePlaneGeometry(false);
+            break;
+        case TOPO_FAT_TREE_3TIER:
+            computePlaneGeometry(true);
+            break;
+        case TOPO_RAIL_OPTIMIZED:
+            if (numRails <= 0)
+                throw std::invalid_argument("numRails must be positive");
+            // Each rail is its own leaf-spine plane, grown to 3 tiers when needed
+            computePlaneGeometry((numNodes + half - 1) / half > radix);
+            break;
+    }
+}
+
+void TopologyPlan::computePlaneGeometry(bool threeTier) {
+    planeThreeTier = threeTier;
+    if (!threeTier) {
+        numLeaves = (numNodes + half - 1) / half;
+        numSpines = half;
+        if (numLeaves > radix)
+            throw std::invalid_argument("2-tier fat tree with radix " + std::to_string(radix) +
+                    " supports at most " + std::to_string(radix * half) + " nodes");
+        planeSwitches = numLeaves + numSpines;
+    } else {
+        int hostsPerPod = half * half;
+        numPods = (numNodes + hostsPerPod - 1) / hostsPerPod;
+        if (numPods > radix)
+            throw std::invalid_argument("3-tier fat tree with radix " + std::to_string(radix) +
+                    " supports at most " + std::to_string(radix * hostsPerPod) + " nodes");
+        planeSwitches = 2 * numPods * half + half * half;
+    }
+}
+
+int TopologyPlan::getNumSwitches() const {
+    switch (kind) {
+        case TOPO_DRAGONFLY: return dfGroups * dfRoutersPerGroup;
+        case TOPO_RAIL_OPTIMIZED: return numRails * planeSwitches;
+        default: return planeSwitches;
+    }
+}
+
+std::vector<TopologyLink> TopologyPlan::getLinks() const {
+    std::vector<TopologyLink> links;
+    if (kind == TOPO_DRAGONFLY) {
+        addDragonflyLinks(links);
+    } else {
+        int planes = kind == TOPO_RAIL_OPTIMIZED ? numRails : 1;
+        for (int plane = 0; plane < planes; plane++) {
+            addPlaneLinks(plane, links);
+        }
+    }
+    return links;
+}
+
+void TopologyPlan::addPlaneLinks(int plane, std::vector<TopologyLink>& links) const {
+    int base = plane * planeSwitches;
+
+    if (!planeThreeTier) {
+        int spineBase = base + numLeaves;
+        for (int h = 0; h < numNodes; h++) {
+            links.push_back({{true, h, plane}, {false, base + h / half, h % half}, HOST_LINK});
+        }
+        for (int leaf = 0; leaf < numLeaves; leaf++) {
+            for (int s = 0; s < numSpines; s++) {
+                links.push_back({{false, base + leaf, half + s}, {false, spineBase + s, leaf}, FABRIC_LINK});
+            }
+        }
+    } else {
+        int hostsPerPod = half * half;
+        int aggBase = base + numPods * half;
+        int coreBase = base + 2 * numPods * half;
+        for (int h = 0; h < numNodes; h++) {
+            int edge = base + (h / hostsPerPod) * half + (h % hostsPerPod) / half;
+            links.push_back({{true, h, plane}, {false, edge, h % half}, HOST_LINK});
+        }
+        for (int pod = 0; pod < numPods; pod++) {
+            for (int e = 0; e < half; e++) {
+                for (int a = 0; a < half; a++) {
+                    links.push_back({{false, base + pod * half + e, half + a},
+                                     {false, aggBase + pod * half + a, e}, FABRIC_LINK});
+                }
+            }
+            for (int a = 0; a < half; a++) {
+                for (int j = 0; j < half; j++) {
+                    links.push_back({{false, aggBase + pod * half + a, half + j},
+                                     {false, coreBase + a * half + j, pod}, FABRIC_LINK});
+                }
+            }
+        }
+    }
+}
+
+int TopologyPlan::dragonflyGlobalTarget(int group, int slot) const {
+    // Global slot s = c * (g - 1) + o connects to group (group + 1 + o) mod g
+    int round = slot / (dfGroups - 1);
+    if (round >= dfLinksPerPair) return -1;
+    return (group + 1 + slot % (dfGroups - 1)) % dfGroups;
+}
+
+void TopologyPlan::addDragonflyLinks(std::vector<TopologyLink>& links) const {
+    int p = dfHostsPerRouter;
+    int a = dfRoutersPerGroup;
+    int h = dfGlobalPerRouter;
+    int hostsPerGroup = a * p;
+
+    for (int d = 0; d < numNodes; d++) {
+        int router = (d / hostsPerGroup) * a + (d % hostsPerGroup) / p;
+        links.push_back({{true, d, 0}, {false, router, d % p}, HOST_LINK});
+    }
+
+    // Intra-group all-to-all; port p + i reaches the i-th other router
+    for (int g = 0; g < dfGroups; g++) {
+        for (int r1 = 0; r1 < a; r1++) {
+            for (int r2 = r1 + 1; r2 < a; r2++) {
+                links.push_back({{false, g * a + r1, p + r2 - 1}, {false, g * a + r2, p + r1}, FABRIC_LINK});
+            }
+        }
+    }
+
+    if (dfGroups < 2) return;
+
+    int slots = dfLinksPerPair * (dfGroups - 1);
+    for (int g = 0; g < dfGroups; g++) {
+        for (int s = 0; s < slots; s++) {
+            int t = dragonflyGlobalTarget(g, s);
+            if (t <= g) continue;
+            int peerSlot = (s / (dfGroups - 1)) * (dfGroups - 1) + (g - t - 1 + 2 * dfGroups) % dfGroups;
+            links.push_back({{false, g * a + s / h, p + a - 1 + s % h},
+                             {false, t * a + peerSlot / h, p + a - 1 + peerSlot % h}, GLOBAL_LINK});
+        }
+    }
+}
+
+void TopologyPlan::computeSwitchRoutes(int sw, SwitchRoutes& routes) const {
+    routes.destGroup.assign(numNodes, -1);
+    routes.groups.clear();
+
+    if (kind == TOPO_DRAGONFLY) {
+        computeDragonflyRoutes(sw, routes);
+    } else {
+        computePlaneRoutes(sw, routes);
+    }
+}
+
+void TopologyPlan::computePlaneRoutes(int sw, SwitchRoutes& routes) const {
+    int local = sw % planeSwitches;
+
+    // Group 0 of every first/second-tier switch is the ECMP set of up ports
+    std::vector<int> upPorts;
+    for (int port = half; port < radix; port++) {
+        upPorts.push_back(port);
+    }
+
+    if (!planeThreeTier) {
+        if (local < numLeaves) {
+            routes.groups.push_back(upPorts);
+            for (int port = 0; port < half; port++) {
+                routes.groups.push_back({port});
+            }
+            for (int d = 0; d < numNodes; d++) {
+                routes.destGroup[d] = d / half == local ? 1 + d % half : 0;
+            }
+        } else {
+            for (int leaf = 0; leaf < numLeaves; leaf++) {
+                routes.groups.push_back({leaf});
+            }
+            for (int d = 0; d < numNodes; d++) {
+                routes.destGroup[d] = d / half;
+            }
+        }
+        return;
+    }
+
+    int hostsPerPod = half * half;
+    if (local < numPods * half) {
+        // Edge switch
+        int pod = local / half;
+        int edge = local % half;
+        routes.groups.push_back(upPorts);
+        for (int port = 0; port < half; port++) {
+            routes.groups.push_back({port});
+        }
+        for (int d = 0; d < numNodes; d++) {
+            bool below = d / hostsPerPod == pod && (d % hostsPerPod) / half == edge;
+            routes.destGroup[d] = below ? 1 + d % half : 0;
+        }
+    } else if (local < 2 * numPods * half) {
+        // Aggregation switch
+        int pod = (local - numPods * half) / half;
+        routes.groups.push_back(upPorts);
+        for (int port = 0; port < half; port++) {
+            routes.groups.push_back({port});
+        }
+        for (int d = 0; d < numNodes; d++) {
+            routes.destGroup[d] = d / hostsPerPod == pod ? 1 + (d % hostsPerPod) / half : 0;
+        }
+    } else {
+        // Core switch: port q leads to pod q
+        for (int pod = 0; pod < numPods; pod++) {
+            routes.groups.push_back({pod});
+        }
+        for (int d = 0; d < numNodes; d++) {
+            routes.destGroup[d] = d / hostsPerPod;
+        }
+    }
+}
+
+void TopologyPlan::computeDragonflyRoutes(int sw, SwitchRoutes& routes) const {
+    int p = dfHostsPerRouter;
+    int a = dfRoutersPerGroup;
+    int h = dfGlobalPerRouter;
+    int hostsPerGroup = a * p;
+    int group = sw / a;
+    int router = sw % a;
+
+    // Groups [0, p) are host ports, [p, p + a - 1) the local router ports
+    std::map<std::vector<int>, int> interned;
+    for (int port = 0; port < p + a - 1; port++) {
+        interned.emplace(std::vector<int>{port}, port);
+        routes.groups.push_back({port});
+    }
+
+    // Minimal routing towards each remote group: take a direct global link
+    // if this router owns one, otherwise hop to a local router that does
+    std::vector<int> remoteGroup(dfGroups, -1);
+    for (int g = 0; g < dfGroups; g++) {
+        if (g == group) continue;
+        std::vector<int> ports;
+        for (int k = 0; k < h; k++) {
+            if (dragonflyGlobalTarget(group, router * h + k) == g) {
+                ports.push_back(p + a - 1 + k);
+            }
+        }
+        if (ports.empty()) {
+            int offset = (g - group - 1 + dfGroups) % dfGroups;
+            for (int round = 0; round < dfLinksPerPair; round++) {
+                int owner = (round * (dfGroups - 1) + offset) / h;
+                ports.push_back(p + (owner < router ? owner : owner - 1));
+            }
+            std::sort(ports.begin(), ports.end());
+            ports.erase(std::unique(ports.begin(), ports.end()), ports.end());
+        }
+        auto it = interned.find(ports);
+        if (it == interned.end()) {
+            it = interned.emplace(ports, (int)routes.groups.size()).first;
+            routes.groups.push_back(ports);
+        }
+        remoteGroup[g] = it->second;
+    }
+
+    for (int d = 0; d < numNodes; d++) {
+        int destGroup = d / hostsPerGroup;
+        int destRouter = (d % hostsPerGroup) / p;
+        if (destGroup != group) {
+            routes.destGroup[d] = remoteGroup[destGroup];
+        } else if (destRouter == router) {
+            routes.destGroup[d] = d % p;
+        } else {
+            routes.destGroup[d] = p + (destRouter < router ? destRouter : destRouter - 1);
+        }
+    }
+}
+
+DragonflyLayout TopologyPlan::getDragonflyLayout(int sw) const {
+    DragonflyLayout layout;
+    layout.group = sw / dfRoutersPerGroup;
+    layout.numGroups = dfGroups;
+    layout.hostsPerGroup = dfRoutersPerGroup * dfHostsPerRouter;
+    layout.firstLocalPort = dfHostsPerRouter;
+    layout.firstGlobalPort = dfHostsPerRouter + dfRoutersPerGroup - 1;
+    return layout;
+}
+
+int TopologyPlan::hostsPerFirstTierSwitch() const {
+    return kind == TOPO_DRAGONFLY ? dfHostsPerRouter : half;
+}
+
+void TopologyPlan::computePartitions(int numPartitions, std::vector<int>& hostPartition,
+        std::vector<int>& switchPartition) const {
+    hostPartition.assign(numNodes, 0);
+    switchPartition.assign(getNumSwitches(), 0);
+
+    // Hosts are numbered contiguously below their first-tier switch, so unit
+    // u owns hosts [u * perUnit, (u + 1) * perUnit)
+    int perUnit = hostsPerFirstTierSwitch();
+    int numUnits = (numNodes + perUnit - 1) / perUnit;
+    auto unitPartition = [&](int unit) {
+        return (int)((long)std::min(unit, numUnits - 1) * numPartitions / numUnits);
+    };
+    auto spread = [&](int i, int count) {
+        return (int)((long)i * numPartitions / count);
+    };
+
+    for (int h = 0; h < numNodes; h++) {
+        hostPartition[h] = unitPartition(h / perUnit);
+    }
+
+    if (kind == TOPO_DRAGONFLY) {
+        // Router g * a + r is the unit of hosts [(g * a + r) * p, ...)
+        for (int sw = 0; sw < getNumSwitches(); sw++) {
+            switchPartition[sw] = unitPartition(sw);
+        }
+        return;
+    }
+
+    int planes = kind == TOPO_RAIL_OPTIMIZED ? numRails : 1;
+    for (int plane = 0; plane < planes; plane++) {
+        int base = plane * planeSwitches;
+        if (!planeThreeTier) {
+            for (int leaf = 0; leaf < numLeaves; leaf++) {
+                switchPartition[base + leaf] = unitPartition(leaf);
+            }
+            for (int s = 0; s < numSpines; s++) {
+                switchPartition[base + numLeaves + s] = spread(s, numSpines);
+            }
+        } else {
+            int numEdges = numPods * half;
+            int numCores = half * half;
+            for (int e = 0; e < numEdges; e++) {
+                switchPartition[base + e] = unitPartition(e);
+            }
+            // Aggregation switch (q, a) follows edge switch (q, a) of its pod
+            for (int agg = 0; agg < numEdges; agg++) {
+                switchPartition[base + numEdges + agg] = unitPartition(agg);
+            }
+            for (int c = 0; c < numCores; c++) {
+                switchPartition[base + 2 * numEdges + c] = spread(c, numCores);
+            }
+        }
+    }
+}
+
+int TopologyPlan::countCutLinks(const std::vector<int>& hostPartition, const std::vector<int>& switchPartition) const {
+    int cut = 0;
+    for (const TopologyLink& link : getLinks()) {
+        int pa = link.a.isHost ? hostPartition[link.a.index] : switchPartition[link.a.index];
+        int pb = link.b.isHost ? hostPartition[link.b.index] : switchPartition[link.b.index];
+        if (pa != pb) cut++;
+    }
+    return cut;
+}
+
+static void writePartitionRanges(std::ostream& os, const std::string& prefix, const std::vector<int>& partition) {
+    size_t start = 0;
+    for (size_t i = 1; i <= partition.size(); i++) {
+        if (i == partition.size() || partition[i] != partition[start]) {
+            os << prefix << "[" << start;
+            if (i - 1 > start) os << ".." << i - 1;
+            os << "]**.partition-id = " << partition[start] << "\n";
+            start = i;
+        }
+    }
+}
+
+void TopologyPlan::writePartitionConfig(std::ostream& os, const std::string& networkName, int numPartitions) const {
+    std::vector<int> hostPartition;
+    std::vector<int> switchPartition;
+    computePartitions(numPartitions, hostPartition, switchPartition);
+
+    os << "# Generated by UltraEthernetTopology: " << numNodes << " nodes, radix " << radix
+       << ", " << numPartitions << " partitions, " << countCutLinks(hostPartition, switchPartition)
+       << " of " << getLinks().size() << " links cross partitions\n";
+    writePartitionRanges(os, networkName + ".hosts", hostPartition);
+    writePartitionRanges(os, networkName + ".switches", switchPartition);
+    os << networkName << ".**.partition-id = 0\n";
+}
+
+//
+// NED helper so UltraEthernetNetwork.ned can size switches[] from the plan
+//
+
+static cValue uetTopologySwitchCount(cComponent *context, cValue argv[], int argc) {
+    TopologyPlan plan;
+    try {
+        plan.configure(argv[0].stdstringValue(), argv[1].intValue(), argv[2].intValue(), argv[3].intValue());
+    } catch (std::invalid_argument& e) {
+        throw cRuntimeError("%s", e.what());
+    }
+    return plan.getNumSwitches();
+}
+
+Define_NED_Function(uetTopologySwitchCount,
+        "int uetTopologySwitchCount(string topologyType, int numNodes, int radix, int numRails)");
+
+//
+// UltraEthernetTopology
+//
+
+UltraEthernetTopology::UltraEthernetTopology() {
+    routeService = nullptr;
+    numLinks = 0;
+    numCutLinks = 0;
+    buildWallTime = 0;
+}
+
+UltraEthernetTopology::~UltraEthernetTopology() {
+    delete routeService;
+}
+
+void UltraEthernetTopology::doBuildInside() {
+    // Let the NED builder create hosts[] and switches[] first
+    cModule::doBuildInside();
+
+    auto start = std::chrono::steady_clock::now();
+
+    try {
+        plan.configure(par("topologyType").stdstringValue(), par("numNodes").intValue(),
+                par("switchRadix").intValue(), par("numRails").intValue());
+    } catch (std::invalid_argument& e) {
+        throw cRuntimeError("%s", e.what());
+    }
+
+    if (getSubmoduleVectorSize("switches") != plan.getNumSwitches()) {
+        throw cRuntimeError("switches[] has %d elements but the %s plan needs %d",
+                getSubmoduleVectorSize("switches"), par("topologyType").stringValue(), plan.getNumSwitches());
+    }
+
+    // Partition assignment for a later parallel run of the same layout
+    std::string partitionFile = par("partitionFile").stdstringValue();
+    if (!partitionFile.empty()) {
+        std::ofstream out(partitionFile);
+        if (!out) {
+            throw cRuntimeError("Cannot write partition file '%s'", partitionFile.c_str());
+        }
+        plan.writePartitionConfig(out, getName(), par("numPartitions").intValue());
+    }
+
+    connectLinks();
+    installRoutes();
+
+    buildWallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+cChannel *UltraEthernetTopology::createChannel(simtime_t delay) {
+    cDelayChannel *channel = cDelayChannel::create("channel");
+    channel->setDelay(delay.dbl());
+    return channel;
+}
+
+void UltraEthernetTopology::connectLinks() {
+    int numHosts = getSubmoduleVectorSize("hosts");
+    int numSwitches = getSubmoduleVectorSize("switches");
+
+    // Resolve module pointers once; per-link name lookups dominate otherwise
+    std::vector<cModule*> hosts(numHosts);
+    std::vector<cModule*> switches(numSwitches);
+    for (int i = 0; i < numHosts; i++) {
+        hosts[i] = getSubmodule("hosts", i);
+    }
+    for (int i = 0; i < numSwitches; i++) {
+        switches[i] = getSubmodule("switches", i);
+    }
+
+    simtime_t delays[3];
+    delays[HOST_LINK] = par("hostLinkDelay").doubleValue();
+    delays[FABRIC_LINK] = par("fabricLinkDelay").doubleValue();
+    delays[GLOBAL_LINK] = par("globalLinkDelay").doubleValue();
+
+    std::vector<TopologyLink> links = plan.getLinks();
+    for (const TopologyLink& link : links) {
+        cModule *a = link.a.isHost ? hosts[link.a.index] : switches[link.a.index];
+        cModule *b = link.b.isHost ? hosts[link.b.index] : switches[link.b.index];
+
+        // Both ends live in other partitions
+        if (a->isPlaceholder() && b->isPlaceholder()) continue;
+
+        simtime_t delay = delays[link.linkClass];
+        if (a->isPlaceholder() || b->isPlaceholder()) {
+            if (delay <= SIMTIME_ZERO) {
+                throw cRuntimeError("Link %s <-> %s crosses partitions but has zero delay, "
+                        "which leaves the null message protocol without lookahead",
+                        a->getFullName(), b->getFullName());
+            }
+            numCutLinks++;
+        }
+
+        // Channels are initialized together with the rest of the network
+        a->gate("ethg$o", link.a.port)->connectTo(b->gate("ethg$i", link.b.port), createChannel(delay), true);
+        b->gate("ethg$o", link.b.port)->connectTo(a->gate("ethg$i", link.a.port), createChannel(delay), true);
+    }
+    numLinks = links.size();
+}
+
+void UltraEthernetTopology::installRoutes() {
+    // Nodes with the same next hops share one read-only table; the tables
+    // stay alive through the nodes' references after the service is gone
+    routeService = new RouteService(plan);
+
+    int numHosts = getSubmoduleVectorSize("hosts");
+    for (int i = 0; i < numHosts; i++) {
+        cModule *host = getSubmodule("hosts", i);
+        if (host->isPlaceholder()) continue;
+        UltraEthernetIP *ip = check_and_cast<UltraEthernetIP*>(host->getSubmodule("networkLayer"));
+        ip->setRoutingTable(routeService->getHostTable());
+    }
+
+    for (int s = 0; s < plan.getNumSwitches(); s++) {
+        cModule *sw = getSubmodule("switches", s);
+        if (sw->isPlaceholder()) continue;
+        SwitchFabric *fabric = check_and_cast<SwitchFabric*>(sw->getSubmodule("switchFabric"));
+        fabric->setForwardingTable(routeService->getSwitchTable(s));
+        if (plan.getKind() == TOPO_DRAGONFLY) {
+            fabric->setDragonflyLayout(plan.getDragonflyLayout(s));
+        }
+    }
+}
+
+void UltraEthernetTopology::initialize() {
+    EV_INFO << "Built " << par("topologyType").stringValue() << " topology: "
+            << plan.getNumNodes() << " hosts, " << plan.getNumSwitches() << " switches, "
+            << numLinks << " links in " << buildWallTime << "s" << endl;
+
+    // Module placement comes from the partition-id entries in the ini file
+    int numPartitions = par("numPartitions").intValue();
+    int activePartitions = getSimulation()->getParsimNumPartitions();
+    if (par("parallelSimulation").boolValue() && activePartitions > 1) {
+        if (activePartitions != numPartitions) {
+            throw cRuntimeError("numPartitions = %d but the simulation runs with %d partitions",
+                    numPartitions, activePartitions);
+        }
+        EV_INFO << "Partition " << getSimulation()->getParsimProcId() << "/" << activePartitions
+                << ": " << numCutLinks << " links to remote partitions" << endl;
+    }
+}
+
+void UltraEthernetTopology::finish() {
+    recordScalar("topologySwitches", plan.getNumSwitches());
+    recordScalar("topologyLinks", numLinks);
+    recordScalar("topologyCutLinks", numCutLinks);
+    recordScalar("topologyBuildTime", buildWallTime, "s");
+    recordScalar("routingTables", routeService->getNumTables());
+    recordScalar("routingTableBytes", routeService->getMemoryUsage(), "B");
+}
\ No newline at end of file
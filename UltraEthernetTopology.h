@@ -0,0 +1,153 @@
+//
+// UltraEthernetTopology.h - Programmatic topology builder for UltraEthernetCluster
+//
+
+#ifndef __ULTRAETHERNET_TOPOLOGY_H
+#define __ULTRAETHERNET_TOPOLOGY_H
+
+#include <omnetpp.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace omnetpp;
+
+enum TopologyKind {
+    TOPO_DRAGONFLY,
+    TOPO_FAT_TREE_2TIER,
+    TOPO_FAT_TREE_3TIER,
+    TOPO_RAIL_OPTIMIZED
+};
+
+enum LinkClass {
+    HOST_LINK,      // host NIC port <-> first-tier switch
+    FABRIC_LINK,    // switch <-> switch inside a pod, plane or group
+    GLOBAL_LINK     // Dragonfly inter-group link
+};
+
+struct TopologyEndpoint {
+    bool isHost;
+    int index;      // index into hosts[] or switches[]
+    int port;       // NIC port for hosts, ethg index for switches
+};
+
+struct TopologyLink {
+    TopologyEndpoint a;
+    TopologyEndpoint b;
+    LinkClass linkClass;
+};
+
+// ECMP forwarding state of one switch: destGroup[destAddr] indexes into
+// groups, -1 marks an unreachable destination.
+struct SwitchRoutes {
+    std::vector<int> destGroup;
+    std::vector<std::vector<int>> groups;
+};
+
+// Position of one Dragonfly router, used by SwitchFabric for UGAL routing.
+// Hosts of group g are numbered from g * hostsPerGroup.
+struct DragonflyLayout {
+    int group;
+    int numGroups;
+    int hostsPerGroup;
+    int firstLocalPort;     // ports below are host ports
+    int firstGlobalPort;    // ports from here on are global links
+};
+
+//
+// Pure index arithmetic describing a cluster layout. Every query is answered
+// from closed-form formulas, so enumerating links is O(links) and computing
+// one switch's routes is O(numNodes) without any graph search.
+//
+class TopologyPlan {
+private:
+    TopologyKind kind;
+    int numNodes;
+    int radix;
+    int numRails;
+
+    // Fat-tree plane geometry (one plane, or one per rail)
+    bool planeThreeTier;
+    int half;               // radix / 2
+    int numLeaves;          // 2-tier: leaf switches
+    int numSpines;          // 2-tier: spine switches
+    int numPods;            // 3-tier: pods in use
+    int planeSwitches;
+
+    // Dragonfly geometry
+    int dfHostsPerRouter;   // p
+    int dfRoutersPerGroup;  // a
+    int dfGlobalPerRouter;  // h
+    int dfGroups;           // g
+    int dfLinksPerPair;
+
+    void computePlaneGeometry(bool threeTier);
+    void addPlaneLinks(int plane, std::vector<TopologyLink>& links) const;
+    void addDragonflyLinks(std::vector<TopologyLink>& links) const;
+    void computePlaneRoutes(int sw, SwitchRoutes& routes) const;
+    void computeDragonflyRoutes(int sw, SwitchRoutes& routes) const;
+    int dragonflyGlobalTarget(int group, int slot) const;
+    int hostsPerFirstTierSwitch() const;
+
+public:
+    TopologyPlan();
+
+    // Throws std::invalid_argument if the layout does not fit the radix
+    void configure(const std::string& topologyType, int numNodes, int radix, int numRails);
+    static TopologyKind parseKind(const std::string& topologyType);
+
+    TopologyKind getKind() const { return kind; }
+    int getNumNodes() const { return numNodes; }
+    int getRadix() const { return radix; }
+    int getNumSwitches() const;
+    int getHostPorts() const { return kind == TOPO_RAIL_OPTIMIZED ? numRails : 1; }
+
+    std::vector<TopologyLink> getLinks() const;
+    void computeSwitchRoutes(int sw, SwitchRoutes& routes) const;
+    DragonflyLayout getDragonflyLayout(int sw) const;
+
+    // Partition index for every host and switch. Each first-tier switch and
+    // the hosts below it stay together; those units are cut into contiguous,
+    // host-balanced blocks and upper-tier switches are spread evenly.
+    void computePartitions(int numPartitions, std::vector<int>& hostPartition,
+            std::vector<int>& switchPartition) const;
+    int countCutLinks(const std::vector<int>& hostPartition, const std::vector<int>& switchPartition) const;
+
+    // Emits partition-id entries for omnetpp.ini, one line per contiguous range
+    void writePartitionConfig(std::ostream& os, const std::string& networkName, int numPartitions) const;
+};
+
+class RouteService;
+
+//
+// Network module class for UltraEthernetCluster (@class in NED). After the
+// NED builder has created hosts[] and switches[], doBuildInside() wires the
+// fabric and installs forwarding state before any module is initialized.
+// Under parallel simulation only links with a local end are created, and
+// every link crossing partitions must have a nonzero delay for lookahead.
+//
+class UltraEthernetTopology : public cModule {
+private:
+    TopologyPlan plan;
+    RouteService *routeService;
+    int numLinks;
+    int numCutLinks;
+    double buildWallTime;
+
+    void connectLinks();
+    void installRoutes();
+    cChannel *createChannel(simtime_t delay);
+
+protected:
+    virtual void doBuildInside() override;
+    virtual void initialize() override;
+    virtual void finish() override;
+
+public:
+    UltraEthernetTopology();
+    virtual ~UltraEthernetTopology();
+
+    const TopologyPlan& getPlan() const { return plan; }
+};
+
+#endif
\ No newline at end of file